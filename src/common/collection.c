@@ -66,10 +66,14 @@ static void _dt_collection_filmroll_imported_callback(gpointer instance, uint8_t
 static int dt_collection_image_offset_with_collection(const dt_collection_t *collection, int imgid);
 /* update aspect ratio for the selected images */
 static void _collection_update_aspect_ratio(const dt_collection_t *collection);
+static void _collection_drop_ids(const dt_collection_t *collection);
+static gboolean _collection_get_ids_count(const dt_collection_t *collection, uint32_t *count);
+static gboolean _collection_get_ids_offset(const dt_collection_t *collection, const int imgid, int *offset);
 
 const dt_collection_t *dt_collection_new(const dt_collection_t *clone)
 {
   dt_collection_t *collection = g_malloc0(sizeof(dt_collection_t));
+  dt_pthread_mutex_init(&collection->ids_lock, NULL);
 
   /* initialize collection context*/
   if(clone) /* if clone is provided let's copy it into this context */
@@ -105,6 +109,10 @@ const dt_collection_t *dt_collection_new(const dt_collection_t *clone)
 
 void dt_collection_free(const dt_collection_t *collection)
 {
+  if(collection->recount_source) g_source_remove(collection->recount_source);
+  _collection_drop_ids(collection);
+  dt_pthread_mutex_destroy(&((dt_collection_t *)collection)->ids_lock);
+
   dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_dt_collection_recount_callback_1),
                                (gpointer)collection);
   dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_dt_collection_recount_callback_2),
@@ -470,6 +478,7 @@ int dt_collection_update(const dt_collection_t *collection)
 
   /* update the cached count. collection isn't a real const anyway, we are writing to it in
    * _dt_collection_store, too. */
+  _collection_drop_ids(collection);
   ((dt_collection_t *)collection)->count = _dt_collection_compute_count(collection, FALSE);
   ((dt_collection_t *)collection)->count_no_group = _dt_collection_compute_count(collection, TRUE);
   dt_collection_hint_message(collection);
@@ -995,8 +1004,91 @@ static int _dt_collection_store(const dt_collection_t *collection, gchar *query,
   return 1;
 }
 
+static void _collection_drop_ids(const dt_collection_t *collection)
+{
+  dt_collection_t *c = (dt_collection_t *)collection;
+  dt_pthread_mutex_lock(&c->ids_lock);
+  if(c->ids) g_array_free(c->ids, TRUE);
+  if(c->offsets) g_hash_table_destroy(c->offsets);
+  c->ids = NULL;
+  c->offsets = NULL;
+  dt_pthread_mutex_unlock(&c->ids_lock);
+}
+
+// run the query once and keep its result, so that counting and looking up positions
+// and images by position don't need to go back to the database. call with ids_lock held.
+static gboolean _collection_fetch_ids(const dt_collection_t *collection)
+{
+  if(collection->ids) return TRUE;
+
+  const gchar *query = dt_collection_get_query(collection);
+  if(!query) return FALSE;
+
+  dt_collection_t *c = (dt_collection_t *)collection;
+  c->ids = g_array_new(FALSE, FALSE, sizeof(int));
+  c->offsets = g_hash_table_new(NULL, NULL);
+
+  sqlite3_stmt *stmt = NULL;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+  if(collection->params.query_flags & COLLECTION_QUERY_USE_LIMIT)
+  {
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, 0);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, -1);
+  }
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    const int id = sqlite3_column_int(stmt, 0);
+    // keep the first position, like a scan of the query would
+    if(!g_hash_table_contains(c->offsets, GINT_TO_POINTER(id)))
+      g_hash_table_insert(c->offsets, GINT_TO_POINTER(id), GINT_TO_POINTER(c->ids->len));
+    g_array_append_val(c->ids, id);
+  }
+  sqlite3_finalize(stmt);
+  return TRUE;
+}
+
+static gboolean _collection_get_ids_count(const dt_collection_t *collection, uint32_t *count)
+{
+  dt_collection_t *c = (dt_collection_t *)collection;
+  dt_pthread_mutex_lock(&c->ids_lock);
+  const gboolean res = _collection_fetch_ids(collection);
+  if(res) *count = c->ids->len;
+  dt_pthread_mutex_unlock(&c->ids_lock);
+  return res;
+}
+
+// image id at position nth of the query, -1 if there is none
+static int _collection_get_ids_nth(const dt_collection_t *collection, const int nth)
+{
+  dt_collection_t *c = (dt_collection_t *)collection;
+  int id = -1;
+  dt_pthread_mutex_lock(&c->ids_lock);
+  if(_collection_fetch_ids(collection) && nth < (int)c->ids->len) id = g_array_index(c->ids, int, nth);
+  dt_pthread_mutex_unlock(&c->ids_lock);
+  return id;
+}
+
+// position of imgid in the query, FALSE if it isn't part of it
+static gboolean _collection_get_ids_offset(const dt_collection_t *collection, const int imgid, int *offset)
+{
+  dt_collection_t *c = (dt_collection_t *)collection;
+  gpointer value = NULL;
+  dt_pthread_mutex_lock(&c->ids_lock);
+  const gboolean found = _collection_fetch_ids(collection)
+                         && g_hash_table_lookup_extended(c->offsets, GINT_TO_POINTER(imgid), NULL, &value);
+  dt_pthread_mutex_unlock(&c->ids_lock);
+  if(found) *offset = GPOINTER_TO_INT(value);
+  return found;
+}
+
 static uint32_t _dt_collection_compute_count(const dt_collection_t *collection, gboolean no_group)
 {
+  // the grouped count is the length of the result, which we keep anyway
+  uint32_t ids_count = 0;
+  if(!no_group && !(collection->params.query_flags & COLLECTION_QUERY_USE_ONLY_WHERE_EXT)
+     && _collection_get_ids_count(collection, &ids_count))
+    return ids_count;
+
   sqlite3_stmt *stmt = NULL;
   uint32_t count = 1;
   const gchar *query = no_group ? dt_collection_get_query_no_group(collection) : dt_collection_get_query(collection);
@@ -1105,22 +1197,7 @@ int dt_collection_get_nth(const dt_collection_t *collection, int nth)
 {
   if(nth < 0 || nth >= dt_collection_get_count(collection))
     return -1;
-  const gchar *query = dt_collection_get_query(collection);
-  sqlite3_stmt *stmt = NULL;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, nth);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, 1);
-
-  int result = -1;
-  if(sqlite3_step(stmt) == SQLITE_ROW)
-  {
-    result  = sqlite3_column_int(stmt, 0);
-  }
-
-  sqlite3_finalize(stmt);
-
-  return result;
-
+  return _collection_get_ids_nth(collection, nth);
 }
 
 GList *dt_collection_get_selected(const dt_collection_t *collection, int limit)
@@ -2040,17 +2117,16 @@ void dt_collection_hint_message(const dt_collection_t *collection)
   if(cs == 1)
   {
     //determine offset of selection
-    GList *selected_imgids = dt_collection_get_selected(collection, 1);
     int selected = -1;
+    sqlite3_stmt *stmt = NULL;
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                "SELECT imgid FROM main.selected_images", -1, &stmt, NULL);
+    int offset;
+    if(sqlite3_step(stmt) == SQLITE_ROW
+       && _collection_get_ids_offset(collection, sqlite3_column_int(stmt, 0), &offset))
+      selected = offset + 1;
+    sqlite3_finalize(stmt);
 
-    if(selected_imgids)
-    {
-      selected = GPOINTER_TO_INT(selected_imgids->data);
-      selected = dt_collection_image_offset_with_collection(collection, selected);
-      selected++;
-    }
-
-    g_list_free(selected_imgids);
     message = g_strdup_printf(_("%d image of %d (#%d) in current collection is selected"), cs, c, selected);
   }
   else
@@ -2069,38 +2145,8 @@ void dt_collection_hint_message(const dt_collection_t *collection)
 static int dt_collection_image_offset_with_collection(const dt_collection_t *collection, int imgid)
 {
   if(imgid == -1) return 0;
-  const gchar *qin = dt_collection_get_query(collection);
   int offset = 0;
-  sqlite3_stmt *stmt;
-
-  if(qin)
-  {
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), qin, -1, &stmt, NULL);
-
-    // was the limit portion of the query tacked on?
-    if(collection->params.query_flags & COLLECTION_QUERY_USE_LIMIT)
-    {
-      DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, 0);
-      DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, -1);
-    }
-
-    gboolean found = FALSE;
-
-    while(sqlite3_step(stmt) == SQLITE_ROW)
-    {
-      const int id = sqlite3_column_int(stmt, 0);
-      if(imgid == id)
-      {
-        found = TRUE;
-        break;
-      }
-      offset++;
-    }
-
-    if(!found) offset = 0;
-
-    sqlite3_finalize(stmt);
-  }
+  _collection_get_ids_offset(collection, imgid, &offset);
   return offset;
 }
 
@@ -2112,6 +2158,7 @@ int dt_collection_image_offset(int imgid)
 static void _dt_collection_recount_callback_1(gpointer instance, gpointer user_data)
 {
   dt_collection_t *collection = (dt_collection_t *)user_data;
+  _collection_drop_ids(collection);
   const int old_count = collection->count;
   collection->count = _dt_collection_compute_count(collection, FALSE);
   collection->count_no_group = _dt_collection_compute_count(collection, TRUE);
@@ -2122,14 +2169,31 @@ static void _dt_collection_recount_callback_1(gpointer instance, gpointer user_d
   }
 }
 
+static gboolean _dt_collection_recount_deferred(gpointer user_data)
+{
+  dt_collection_t *collection = (dt_collection_t *)user_data;
+  collection->recount_source = 0;
+  _dt_collection_recount_callback_1(NULL, user_data);
+  return FALSE;
+}
+
 static void _dt_collection_recount_callback_2(gpointer instance, uint8_t id, gpointer user_data)
 {
-  _dt_collection_recount_callback_1(instance, user_data);
+  // this fires once per imported image, only recount once a burst of them is over
+  dt_collection_t *collection = (dt_collection_t *)user_data;
+  if(collection->recount_source) g_source_remove(collection->recount_source);
+  collection->recount_source = g_timeout_add(250, _dt_collection_recount_deferred, collection);
 }
 
 static void _dt_collection_filmroll_imported_callback(gpointer instance, uint8_t id, gpointer user_data)
 {
   dt_collection_t *collection = (dt_collection_t *)user_data;
+  if(collection->recount_source)
+  {
+    g_source_remove(collection->recount_source);
+    collection->recount_source = 0;
+  }
+  _collection_drop_ids(collection);
   const int old_count = collection->count;
   collection->count = _dt_collection_compute_count(collection, FALSE);
   collection->count_no_group = _dt_collection_compute_count(collection, TRUE);
@@ -21,6 +21,7 @@
 #include <glib.h>
 #include <glib/gi18n.h>
 #include <inttypes.h>
+#include "common/dtpthread.h"
 #include "common/metadata.h"
 
 typedef enum dt_collection_query_t
@@ -167,6 +168,14 @@ typedef struct dt_collection_t
   unsigned int tagid;
   dt_collection_params_t params;
   dt_collection_params_t store;
+  /* result of query in query order and the offset of each image id in it, NULL until
+     needed and dropped whenever the query or the set of images may have changed.
+     the delete job updates the collection from its own thread, only touch them with ids_lock held. */
+  dt_pthread_mutex_t ids_lock;
+  GArray *ids;
+  GHashTable *offsets;
+  /* pending deferred recount after imports */
+  guint recount_source;
 } dt_collection_t;
 
 /* returns the name for the given collection property */
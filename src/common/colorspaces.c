@@ -17,6 +17,7 @@
 */
 
 #include "common/colorspaces.h"
+#include "common/colorspaces_lut3d.h"
 #include "common/darktable.h"
 #include "common/debug.h"
 #include "common/file_location.h"
@@ -782,6 +783,28 @@ cmsHPROFILE dt_colorspaces_get_rgb_profile_from_mem(uint8_t *data, uint32_t size
   return profile;
 }
 
+cmsHPROFILE dt_colorspaces_create_gray_profile(cmsHPROFILE rgb_profile)
+{
+  if(!rgb_profile || cmsGetColorSpace(rgb_profile) != cmsSigRgbData)
+    return NULL;
+
+  // colorout encodes the gray channel with the red curve of the output profile
+  cmsToneCurve *trc = cmsReadTag(rgb_profile, cmsSigRedTRCTag);
+  if(!trc)
+    return NULL;
+
+  cmsHPROFILE gray_profile = cmsCreateGrayProfile(cmsD50_xyY(), trc);
+  if(!gray_profile)
+    return NULL;
+
+  cmsMLU *cprt = cmsReadTag(rgb_profile, cmsSigCopyrightTag);
+  cmsMLU *desc = cmsReadTag(rgb_profile, cmsSigProfileDescriptionTag);
+  if(cprt) cmsWriteTag(gray_profile, cmsSigCopyrightTag, cprt);
+  if(desc) cmsWriteTag(gray_profile, cmsSigProfileDescriptionTag, desc);
+
+  return gray_profile;
+}
+
 void dt_colorspaces_cleanup_profile(cmsHPROFILE p)
 {
   if(!p)
@@ -1075,6 +1098,7 @@ dt_colorspaces_t *dt_colorspaces_init()
   dt_colorspaces_t *res = (dt_colorspaces_t *)calloc(1, sizeof(dt_colorspaces_t));
   _compute_prequantized_primaries(&D65xyY, &Rec709_Primaries, &Rec709_Primaries_Prequantized);
   pthread_rwlock_init(&res->xprofile_lock, NULL);
+  dt_pthread_mutex_init(&res->lut3d_lock, NULL);
 
   int in_pos = -1,
       out_pos = -1,
@@ -1293,6 +1317,8 @@ void dt_colorspaces_cleanup(dt_colorspaces_t *self)
   }
   g_list_free_full(self->profiles, free);
 
+  dt_colorspaces_lut3d_cleanup(self);
+  dt_pthread_mutex_destroy(&self->lut3d_lock);
   pthread_rwlock_destroy(&self->xprofile_lock);
   g_free(self->colord_profile_file);
   g_free(self->xprofile_data);
@@ -167,6 +167,10 @@ typedef struct dt_colorspaces_t
   cmsHTRANSFORM transform_srgb_to_display, transform_adobe_rgb_to_display;
   cmsHTRANSFORM transform_srgb_to_display2, transform_adobe_rgb_to_display2;
 
+  // baked transforms shared between pipes, see colorspaces_lut3d.h
+  GList *lut3d_cache;
+  dt_pthread_mutex_t lut3d_lock;
+
 } dt_colorspaces_t;
 
 typedef struct dt_colorspaces_color_profile_t
@@ -227,6 +231,10 @@ const dt_colorspaces_color_profile_t *dt_colorspaces_get_output_profile(const in
  * that has the same TRC, black and white point and rec709 primaries. */
 cmsHPROFILE dt_colorspaces_get_rgb_profile_from_mem(uint8_t *data, uint32_t size);
 
+/** return a grayscale lcms2 profile with the TRC of the matrix rgb profile and a D50 white point,
+ * describing the single channel written for gray pipes. NULL if the profile has no TRC. */
+cmsHPROFILE dt_colorspaces_create_gray_profile(cmsHPROFILE rgb_profile);
+
 /** free the resources of a profile created with the functions above. */
 void dt_colorspaces_cleanup_profile(cmsHPROFILE p);
 
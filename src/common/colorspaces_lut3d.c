@@ -0,0 +1,282 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/colorspaces_lut3d.h"
+#include "common/darktable.h"
+
+#include <stdlib.h>
+
+// unreferenced luts kept around for the next pipe that needs them
+#define DT_COLORSPACES_LUT3D_KEEP 8
+
+uint64_t dt_colorspaces_lut3d_hash_int(uint64_t hash, uint64_t value)
+{
+  for(int k = 0; k < 8; k++, value >>= 8)
+    hash = ((hash << 5) + hash) ^ (value & 0xff);
+  return hash;
+}
+
+uint64_t dt_colorspaces_lut3d_hash_profile(uint64_t hash, cmsHPROFILE profile)
+{
+  cmsUInt32Number size = 0;
+  if(!profile || !cmsSaveProfileToMem(profile, NULL, &size) || size == 0)
+    return dt_colorspaces_lut3d_hash_int(hash, 0);
+
+  uint8_t *data = malloc(size);
+  if(!data) return dt_colorspaces_lut3d_hash_int(hash, (uint64_t)(uintptr_t)profile);
+
+  if(cmsSaveProfileToMem(profile, data, &size))
+    for(cmsUInt32Number k = 0; k < size; k++) hash = ((hash << 5) + hash) ^ data[k];
+  else
+    hash = dt_colorspaces_lut3d_hash_int(hash, (uint64_t)(uintptr_t)profile);
+
+  free(data);
+  return dt_colorspaces_lut3d_hash_int(hash, size);
+}
+
+static void _lut3d_domain(const cmsUInt32Number in_format, float lo[3], float hi[3])
+{
+  if(T_COLORSPACE(in_format) == PT_Lab)
+  {
+    lo[0] = 0.0f;
+    hi[0] = 100.0f;
+    lo[1] = lo[2] = -128.0f;
+    hi[1] = hi[2] = 128.0f;
+  }
+  else
+  {
+    // rgb and XYZ
+    for(int c = 0; c < 3; c++)
+    {
+      lo[c] = 0.0f;
+      hi[c] = 1.0f;
+    }
+  }
+}
+
+static dt_colorspaces_lut3d_t *_lut3d_bake(const uint64_t key, const int size, const cmsUInt32Number in_format,
+                                           cmsHTRANSFORM xform, cmsHTRANSFORM xform2)
+{
+  dt_colorspaces_lut3d_t *lut = (dt_colorspaces_lut3d_t *)calloc(1, sizeof(dt_colorspaces_lut3d_t));
+  if(!lut) return NULL;
+
+  const size_t slab = (size_t)size * size;
+  lut->clut = dt_alloc_align(64, sizeof(float) * 4 * slab * size);
+  if(!lut->clut)
+  {
+    free(lut);
+    return NULL;
+  }
+
+  lut->key = key;
+  lut->size = size;
+  _lut3d_domain(in_format, lut->lo, lut->hi);
+  for(int c = 0; c < 3; c++) lut->scale[c] = (size - 1) / (lut->hi[c] - lut->lo[c]);
+
+  float *const clut = lut->clut;
+  const float *const lo = lut->lo;
+  const float *const hi = lut->hi;
+
+  // one slab of constant red per iteration, transformed in place
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(clut, lo, hi, size, slab, xform, xform2) \
+  schedule(static)
+#endif
+  for(int r = 0; r < size; r++)
+  {
+    float *const grid = clut + 4 * slab * r;
+    const float R = lo[0] + (hi[0] - lo[0]) * r / (size - 1);
+    for(int g = 0; g < size; g++)
+      for(int b = 0; b < size; b++)
+      {
+        float *const px = grid + 4 * ((size_t)g * size + b);
+        px[0] = R;
+        px[1] = lo[1] + (hi[1] - lo[1]) * g / (size - 1);
+        px[2] = lo[2] + (hi[2] - lo[2]) * b / (size - 1);
+        px[3] = 0.0f;
+      }
+
+    cmsDoTransform(xform, grid, grid, slab);
+    if(xform2)
+    {
+      for(size_t k = 0; k < 4 * slab; k += 4)
+        for(int c = 0; c < 3; c++) grid[k + c] = CLAMP(grid[k + c], 0.0f, 1.0f);
+      cmsDoTransform(xform2, grid, grid, slab);
+    }
+  }
+
+  return lut;
+}
+
+static void _lut3d_free(dt_colorspaces_lut3d_t *lut)
+{
+  dt_free_align(lut->clut);
+  free(lut);
+}
+
+// take a reference on the cached lut with key, called with the lock held
+static dt_colorspaces_lut3d_t *_lut3d_find(dt_colorspaces_t *cs, const uint64_t key)
+{
+  for(GList *iter = cs->lut3d_cache; iter; iter = g_list_next(iter))
+  {
+    dt_colorspaces_lut3d_t *lut = (dt_colorspaces_lut3d_t *)iter->data;
+    if(lut->key == key)
+    {
+      // move to the front, the tail is evicted first
+      cs->lut3d_cache = g_list_remove_link(cs->lut3d_cache, iter);
+      cs->lut3d_cache = g_list_concat(iter, cs->lut3d_cache);
+      lut->refs++;
+      return lut;
+    }
+  }
+  return NULL;
+}
+
+dt_colorspaces_lut3d_t *dt_colorspaces_lut3d_get(uint64_t key, const int size, const cmsUInt32Number in_format,
+                                                 cmsHTRANSFORM xform, cmsHTRANSFORM xform2)
+{
+  if(!xform || size < 2) return NULL;
+
+  key = dt_colorspaces_lut3d_hash_int(key, size);
+  key = dt_colorspaces_lut3d_hash_int(key, in_format);
+  key = dt_colorspaces_lut3d_hash_int(key, xform2 != NULL);
+
+  dt_colorspaces_t *cs = darktable.color_profiles;
+  dt_pthread_mutex_lock(&cs->lut3d_lock);
+  dt_colorspaces_lut3d_t *lut = _lut3d_find(cs, key);
+  dt_pthread_mutex_unlock(&cs->lut3d_lock);
+  if(lut) return lut;
+
+  // bake without the lock, pipes getting other luts don't have to wait for it
+  dt_colorspaces_lut3d_t *baked = _lut3d_bake(key, size, in_format, xform, xform2);
+  if(!baked) return NULL;
+
+  dt_pthread_mutex_lock(&cs->lut3d_lock);
+  // another pipe might have baked the same one meanwhile, keep the first
+  lut = _lut3d_find(cs, key);
+  if(lut)
+  {
+    dt_pthread_mutex_unlock(&cs->lut3d_lock);
+    _lut3d_free(baked);
+    return lut;
+  }
+
+  lut = baked;
+  lut->refs = 1;
+  cs->lut3d_cache = g_list_prepend(cs->lut3d_cache, lut);
+
+  // drop the least recently used unreferenced luts
+  int kept = 0;
+  GList *iter = cs->lut3d_cache;
+  while(iter)
+  {
+    GList *next = g_list_next(iter);
+    dt_colorspaces_lut3d_t *l = (dt_colorspaces_lut3d_t *)iter->data;
+    if(l->refs == 0 && ++kept > DT_COLORSPACES_LUT3D_KEEP)
+    {
+      cs->lut3d_cache = g_list_delete_link(cs->lut3d_cache, iter);
+      _lut3d_free(l);
+    }
+    iter = next;
+  }
+
+  dt_pthread_mutex_unlock(&cs->lut3d_lock);
+  return lut;
+}
+
+void dt_colorspaces_lut3d_release(dt_colorspaces_lut3d_t *lut)
+{
+  if(!lut) return;
+  dt_colorspaces_t *cs = darktable.color_profiles;
+  dt_pthread_mutex_lock(&cs->lut3d_lock);
+  lut->refs--;
+  dt_pthread_mutex_unlock(&cs->lut3d_lock);
+}
+
+int dt_colorspaces_lut3d_apply(const dt_colorspaces_lut3d_t *const lut, const float *const in,
+                               float *const out, const int width)
+{
+  const int size = lut->size;
+  const float *const clut = lut->clut;
+  const size_t stride[3] = { (size_t)4 * size * size, (size_t)4 * size, 4 };
+
+  // check the whole row first: the caller runs the exact transform on it
+  // otherwise, and in and out may alias
+  for(int j = 0; j < width; j++)
+  {
+    const float *const pin = in + (size_t)4 * j;
+    for(int c = 0; c < 3; c++)
+    {
+      const float v = pin[c];
+      // also catches NaN
+      if(!(v >= lut->lo[c] && v <= lut->hi[c])) return 0;
+    }
+  }
+
+  for(int j = 0; j < width; j++)
+  {
+    const float *const pin = in + (size_t)4 * j;
+    float *const pout = out + (size_t)4 * j;
+
+    float f[3];
+    size_t idx = 0;
+    for(int c = 0; c < 3; c++)
+    {
+      const float x = CLAMP((pin[c] - lut->lo[c]) * lut->scale[c], 0.0f, (float)(size - 1));
+      const int i = MIN((int)x, size - 2);
+      f[c] = x - i;
+      idx += stride[c] * i;
+    }
+
+    // sort the fractions: the pixel lies in the tetrahedron spanned by the
+    // corners 000, a, b and 111, walking the axes in decreasing order.
+    int o0 = 0, o1 = 1, o2 = 2, t;
+    if(f[o0] < f[o1]) t = o0, o0 = o1, o1 = t;
+    if(f[o1] < f[o2]) t = o1, o1 = o2, o2 = t;
+    if(f[o0] < f[o1]) t = o0, o0 = o1, o1 = t;
+
+    const float *const c000 = clut + idx;
+    const float *const ca = c000 + stride[o0];
+    const float *const cb = ca + stride[o1];
+    const float *const c111 = c000 + stride[0] + stride[1] + stride[2];
+    const float w0 = 1.0f - f[o0], w1 = f[o0] - f[o1], w2 = f[o1] - f[o2], w3 = f[o2];
+    const float alpha = pin[3];
+
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+    for(int c = 0; c < 3; c++)
+      pout[c] = w0 * c000[c] + w1 * ca[c] + w2 * cb[c] + w3 * c111[c];
+    pout[3] = alpha;
+  }
+
+  return 1;
+}
+
+void dt_colorspaces_lut3d_cleanup(dt_colorspaces_t *self)
+{
+  for(GList *iter = self->lut3d_cache; iter; iter = g_list_next(iter))
+    _lut3d_free((dt_colorspaces_lut3d_t *)iter->data);
+  g_list_free(self->lut3d_cache);
+  self->lut3d_cache = NULL;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,71 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "common/colorspaces.h"
+
+/** grid sizes of the baked luts, per axis */
+#define DT_COLORSPACES_LUT3D_SIZE 33
+#define DT_COLORSPACES_LUT3D_SIZE_HQ 65
+
+/**
+ * an lcms2 float transform sampled once on a regular grid, applied with
+ * tetrahedral interpolation. luts are shared through a small cache in
+ * darktable.color_profiles, keyed by the profiles, intent and formats.
+ */
+typedef struct dt_colorspaces_lut3d_t
+{
+  uint64_t key;
+  int size;          // grid points per axis
+  float lo[3];       // baked input domain, per channel
+  float hi[3];
+  float scale[3];    // (size - 1) / (hi - lo)
+  float *clut;       // size^3 RGBA floats, red is the slowest axis
+  int refs;
+} dt_colorspaces_lut3d_t;
+
+/** fold the contents of a profile into a lut key, profile may be NULL */
+uint64_t dt_colorspaces_lut3d_hash_profile(uint64_t hash, cmsHPROFILE profile);
+/** fold a plain value (intent, format, flags) into a lut key */
+uint64_t dt_colorspaces_lut3d_hash_int(uint64_t hash, uint64_t value);
+
+/**
+ * get the lut baked from xform, or bake it. if xform2 is given, the output of xform
+ * is clipped to [0,1] and fed through xform2. in_format is the lcms2 input format of
+ * xform, it selects the baked domain (rgb and XYZ [0,1], Lab [0,100]x[-128,128]^2).
+ * returns NULL if the lut cannot be created, release with dt_colorspaces_lut3d_release().
+ */
+dt_colorspaces_lut3d_t *dt_colorspaces_lut3d_get(uint64_t key, int size, cmsUInt32Number in_format,
+                                                 cmsHTRANSFORM xform, cmsHTRANSFORM xform2);
+void dt_colorspaces_lut3d_release(dt_colorspaces_lut3d_t *lut);
+
+/**
+ * apply the lut to width RGBA pixels, in and out may alias. alpha is copied.
+ * returns 0 without touching out if any pixel lies outside the baked domain,
+ * the caller has to run the exact transform on the row then.
+ */
+int dt_colorspaces_lut3d_apply(const dt_colorspaces_lut3d_t *const lut, const float *const in,
+                               float *const out, const int width);
+
+/** free all cached luts on shutdown */
+void dt_colorspaces_lut3d_cleanup(dt_colorspaces_t *self);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
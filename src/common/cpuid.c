@@ -29,6 +29,7 @@
 #include "cpuid.h"
 #include "common/darktable.h"
 #include <glib.h>
+#include <unistd.h>
 
 #ifdef HAVE_CPUID_H
 #include <cpuid.h>
@@ -88,6 +89,32 @@ dt_cpu_flags_t dt_detect_cpu_features()
 }
 #endif /* __i386__ || __x86_64__ */
 
+// what most x86_64 cores since skylake and most arm64 cores have per core
+#define DT_CPU_L2_CACHE_DEFAULT (256 * 1024)
+
+size_t dt_get_cpu_l2_cache_size()
+{
+  static size_t l2size = 0;
+  static GMutex lock;
+
+  g_mutex_lock(&lock);
+  if(l2size == 0)
+  {
+    long size = 0;
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+    // some kernels report nothing or nonsense for virtualized or heterogeneous cpus
+    l2size = (size >= 64 * 1024 && size <= 64 * 1024 * 1024) ? (size_t)size : DT_CPU_L2_CACHE_DEFAULT;
+    dt_print(DT_DEBUG_PERF, "[dt_get_cpu_l2_cache_size] using %zu KiB L2 cache per core%s\n", l2size / 1024,
+             size == (long)l2size ? "" : " (default)");
+  }
+  g_mutex_unlock(&lock);
+  return l2size;
+}
+
+#undef DT_CPU_L2_CACHE_DEFAULT
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
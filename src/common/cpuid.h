@@ -19,6 +19,7 @@
 #pragma once
 
 #include <glib.h>
+#include <stddef.h>
 
 typedef enum dt_cpu_flags_t
 {
@@ -38,6 +39,9 @@ typedef enum dt_cpu_flags_t
 
 dt_cpu_flags_t dt_detect_cpu_features();
 
+/** size of the per core L2 cache in bytes, a sane default if it cannot be detected */
+size_t dt_get_cpu_l2_cache_size();
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
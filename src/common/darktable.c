@@ -111,7 +111,7 @@ static int usage(const char *argv0)
   printf("  --conf <key>=<value>\n");
   printf("  --configdir <user config directory>\n");
   printf("  -d {all,cache,control,dev,fswatch,input,lighttable, lua\n");
-  printf("      masks,memory,nan,perf,pwstorage,print,sql,ioporder,\n");
+  printf("      masks,memory,nan,perf,pwstorage,print,sql,sqlprofile,ioporder,\n");
   printf("      imageio,undo,signal}\n");
   printf("  --d-signal <signal> \n");
   printf("  --d-signal-act <all,raise,connect,disconnect");
@@ -566,6 +566,8 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
           darktable.unmuted |= DT_DEBUG_PWSTORAGE; // pwstorage module
         else if(!strcmp(argv[k + 1], "sql"))
           darktable.unmuted |= DT_DEBUG_SQL; // SQLite3 queries
+        else if(!strcmp(argv[k + 1], "sqlprofile"))
+          darktable.unmuted |= DT_DEBUG_SQL_PROFILE; // SQLite3 statement timings, printed on exit
         else if(!strcmp(argv[k + 1], "memory"))
           darktable.unmuted |= DT_DEBUG_MEMORY; // some stats on mem usage now and then.
         else if(!strcmp(argv[k + 1], "lighttable"))
@@ -874,14 +876,6 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   dt_database_maybe_maintenance(darktable.db, init_gui, FALSE);
   // Initialize the signal system
   darktable.signals = dt_control_signal_init();
-  // Make sure that the database and xmp files are in sync
-  // We need conf and db to be up and running for this
-  // FIXME: is this also useful in non-gui mode?
-  GList *changed_xmp_files = NULL;
-
-  if(init_gui && dt_conf_get_bool("run_crawler_on_start"))
-    changed_xmp_files = dt_control_crawler_run();
-
   if(init_gui)
     dt_control_init(darktable.control);
   else
@@ -1040,9 +1034,11 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
 
 #endif
   }
-  // construct the popup that asks the user about images whose xmp files are newer than the db entry
-  if(init_gui && changed_xmp_files)
-    dt_control_crawler_show_image_list(changed_xmp_files);
+  // Make sure that the database and xmp files are in sync, in the background. the crawler
+  // constructs the popup that asks the user about images whose xmp files are newer than the db entry
+  // FIXME: is this also useful in non-gui mode?
+  if(init_gui && dt_conf_get_bool("run_crawler_on_start"))
+    dt_control_crawler_run_job();
 
   dt_print(DT_DEBUG_CONTROL, "[init] startup took %f seconds\n", dt_get_wtime() - start_wtime);
   return 0;
@@ -246,7 +246,8 @@ typedef enum dt_debug_thread_t
   DT_DEBUG_PARAMS         = 1 << 21,
   DT_DEBUG_DEMOSAIC       = 1 << 22,
   DT_DEBUG_TILING         = 1 << 23,
-  DT_DEBUG_ACT_ON         = 1 << 24                                   
+  DT_DEBUG_ACT_ON         = 1 << 24,
+  DT_DEBUG_SQL_PROFILE    = 1 << 25
 } dt_debug_thread_t;
 
 typedef struct dt_codepath_t
@@ -293,7 +294,7 @@ typedef struct darktable_t
   dt_pthread_mutex_t plugin_threadsafe;
   dt_pthread_mutex_t capabilities_threadsafe;
   dt_pthread_mutex_t exiv2_threadsafe;
-  dt_pthread_mutex_t readFile_mutex;
+  dt_pthread_mutex_t readFile_mutex; // guards the per device reader counts of the raw loader
   char *progname;
   char *datadir;
   char *plugindir;
@@ -42,7 +42,7 @@
 #include <sys/types.h>
 // whenever _create_*_schema() gets changed you HAVE to bump this version and add an update path to
 // _upgrade_*_schema_step()!
-#define CURRENT_DATABASE_VERSION_LIBRARY 30
+#define CURRENT_DATABASE_VERSION_LIBRARY 31
 #define CURRENT_DATABASE_VERSION_DATA     6
 
 typedef struct dt_database_t
@@ -56,8 +56,33 @@ typedef struct dt_database_t
   sqlite3 *handle;
   gchar *error_message, *error_dbfilename;
   int error_other_pid;
+  // serializes transactions between threads, depth of the nested ones
+  GRecMutex transaction_lock;
+  int transaction_depth;
+  // threads blocked in dt_database_start_transaction(), and a count of outermost transactions started,
+  // so dt_database_yield_transaction() can tell when one of them got its turn
+  gint transaction_waiters;
+  gint transaction_epoch;
+  // idle prepared statements by sql text, see dt_database_prepare_cached()
+  GHashTable *stmt_cache;
+  GMutex stmt_cache_lock;
+  // per statement timings for -d sqlprofile, by sql text
+  GHashTable *profile;
+  GMutex profile_lock;
 } dt_database_t;
 
+// idle statements kept per sql text, more than that are finalized on release
+#define DT_DATABASE_STMT_CACHE_DEPTH 4
+// longest a yielding transaction waits for another thread to take over, in ms
+#define DT_DATABASE_YIELD_POLLS 50
+
+typedef struct dt_database_profile_t
+{
+  guint64 count;
+  guint64 total_ns;
+  GArray *samples_us; // one guint32 per run, for the percentiles
+} dt_database_profile_t;
+
 /* migrates database from old place to new */
 static void _database_migrate_to_xdg_structure();
 
@@ -472,6 +497,18 @@ static int _upgrade_library_schema_step(dt_database_t *db, int version)
     sqlite3_exec(db->handle, "COMMIT", NULL, NULL, NULL);
     new_version = 30;
   }
+  else if(version == 30)
+  {
+    sqlite3_exec(db->handle, "BEGIN TRANSACTION", NULL, NULL, NULL);
+    // history hash the final size stored in images.output_width/height was computed for
+    TRY_EXEC("ALTER TABLE main.history_hash ADD COLUMN final_size_hash BLOB",
+             "[init] can't add `final_size_hash' column to history_hash table in database\n");
+    // output_width/height used to be filled with the input size, these are not final sizes
+    TRY_EXEC("UPDATE main.images SET output_width = 0, output_height = 0",
+             "[init] can't reset output size in images table\n");
+    sqlite3_exec(db->handle, "COMMIT", NULL, NULL, NULL);
+    new_version = 31;
+  }
   else
     new_version = version; // should be the fallback so that calling code sees that we are in an infinite loop
   // write the new version to db
@@ -643,7 +680,7 @@ static void _create_library_schema(dt_database_t *db)
   sqlite3_exec(db->handle, "CREATE TABLE main.module_order (imgid INTEGER PRIMARY KEY, version INTEGER, iop_list VARCHAR)",
                NULL, NULL, NULL);
   sqlite3_exec(db->handle, "CREATE TABLE main.history_hash (imgid INTEGER PRIMARY KEY, "
-               "basic_hash BLOB, auto_hash BLOB, current_hash BLOB, mipmap_hash BLOB)",
+               "basic_hash BLOB, auto_hash BLOB, current_hash BLOB, mipmap_hash BLOB, final_size_hash BLOB)",
                NULL, NULL, NULL);
 }
 
@@ -703,11 +740,32 @@ static void _create_memory_schema(dt_database_t *db)
       "CREATE TABLE memory.collected_images (rowid INTEGER PRIMARY KEY AUTOINCREMENT, imgid INTEGER)", NULL,
       NULL, NULL);
   sqlite3_exec(db->handle, "CREATE TABLE memory.tmp_selection (imgid INTEGER PRIMARY KEY)", NULL, NULL, NULL);
-  sqlite3_exec(db->handle, "CREATE TABLE memory.taglist "
-                           "(tmpid INTEGER PRIMARY KEY, id INTEGER UNIQUE ON CONFLICT IGNORE, count INTEGER)",
-               NULL, NULL, NULL);
   sqlite3_exec(db->handle, "CREATE TABLE memory.similar_tags (tagid INTEGER PRIMARY KEY)", NULL, NULL, NULL);
   sqlite3_exec(db->handle, "CREATE TABLE memory.darktable_tags (tagid INTEGER PRIMARY KEY)", NULL, NULL, NULL);
+  // number of images per tag, kept up to date by the triggers below whoever writes main.tagged_images
+  sqlite3_exec(db->handle, "CREATE TABLE memory.tag_usage (tagid INTEGER PRIMARY KEY, count INTEGER)",
+               NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "INSERT INTO memory.tag_usage (tagid, count)"
+                           "  SELECT tagid, COUNT(*) FROM main.tagged_images GROUP BY tagid",
+               NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE TEMP TRIGGER tag_usage_insert AFTER INSERT ON main.tagged_images"
+                           " BEGIN"
+                           "  INSERT OR IGNORE INTO tag_usage (tagid, count) VALUES (NEW.tagid, 0);"
+                           "  UPDATE tag_usage SET count = count + 1 WHERE tagid = NEW.tagid;"
+                           " END",
+               NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE TEMP TRIGGER tag_usage_delete AFTER DELETE ON main.tagged_images"
+                           " BEGIN"
+                           "  UPDATE tag_usage SET count = count - 1 WHERE tagid = OLD.tagid;"
+                           " END",
+               NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE TEMP TRIGGER tag_usage_update AFTER UPDATE OF tagid ON main.tagged_images"
+                           " BEGIN"
+                           "  UPDATE tag_usage SET count = count - 1 WHERE tagid = OLD.tagid;"
+                           "  INSERT OR IGNORE INTO tag_usage (tagid, count) VALUES (NEW.tagid, 0);"
+                           "  UPDATE tag_usage SET count = count + 1 WHERE tagid = NEW.tagid;"
+                           " END",
+               NULL, NULL, NULL);
   sqlite3_exec(
       db->handle,
       "CREATE TABLE memory.history (imgid INTEGER, num INTEGER, module INTEGER, "
@@ -1086,6 +1144,117 @@ void dt_database_backup(const char *filename)
   g_free(backup);
 }
 
+static void _database_profile_free(gpointer data)
+{
+  dt_database_profile_t *p = (dt_database_profile_t *)data;
+  g_array_free(p->samples_us, TRUE);
+  g_free(p);
+}
+
+static int _database_profile_callback(unsigned type, void *ctx, void *stmt, void *ns)
+{
+  if(type != SQLITE_TRACE_PROFILE) return 0;
+
+  dt_database_t *db = (dt_database_t *)ctx;
+  const char *sql = sqlite3_sql((sqlite3_stmt *)stmt);
+  const sqlite3_int64 elapsed = *(sqlite3_int64 *)ns;
+  if(!sql) return 0;
+
+  g_mutex_lock(&db->profile_lock);
+  dt_database_profile_t *p = g_hash_table_lookup(db->profile, sql);
+  if(!p)
+  {
+    p = g_malloc0(sizeof(dt_database_profile_t));
+    p->samples_us = g_array_new(FALSE, FALSE, sizeof(guint32));
+    g_hash_table_insert(db->profile, g_strdup(sql), p);
+  }
+  const guint32 us = MIN(elapsed / 1000, G_MAXUINT32);
+  p->count++;
+  p->total_ns += elapsed;
+  g_array_append_val(p->samples_us, us);
+  g_mutex_unlock(&db->profile_lock);
+  return 0;
+}
+
+static gint _database_profile_cmp_total(gconstpointer a, gconstpointer b, gpointer user_data)
+{
+  GHashTable *profile = (GHashTable *)user_data;
+  const dt_database_profile_t *pa = g_hash_table_lookup(profile, *(const char **)a);
+  const dt_database_profile_t *pb = g_hash_table_lookup(profile, *(const char **)b);
+  return pa->total_ns < pb->total_ns ? 1 : pa->total_ns > pb->total_ns ? -1 : 0;
+}
+
+static gint _database_profile_cmp_us(gconstpointer a, gconstpointer b)
+{
+  const guint32 ua = *(const guint32 *)a, ub = *(const guint32 *)b;
+  return ua < ub ? -1 : ua > ub ? 1 : 0;
+}
+
+// print the statements that took the most time overall
+static void _database_profile_report(dt_database_t *db)
+{
+  GPtrArray *keys = g_ptr_array_new();
+  GHashTableIter iter;
+  gpointer key;
+  g_hash_table_iter_init(&iter, db->profile);
+  while(g_hash_table_iter_next(&iter, &key, NULL)) g_ptr_array_add(keys, key);
+  g_ptr_array_sort_with_data(keys, _database_profile_cmp_total, db->profile);
+
+  dt_print(DT_DEBUG_SQL_PROFILE, "[sql profile] %10s %12s %10s %10s  statement\n", "count", "total ms", "mean us",
+           "p99 us");
+  for(guint k = 0; k < MIN(keys->len, 50); k++)
+  {
+    const char *sql = g_ptr_array_index(keys, k);
+    dt_database_profile_t *p = g_hash_table_lookup(db->profile, sql);
+    g_array_sort(p->samples_us, _database_profile_cmp_us);
+    const guint32 p99 = g_array_index(p->samples_us, guint32, (guint)(0.99 * (p->samples_us->len - 1)));
+    dt_print(DT_DEBUG_SQL_PROFILE, "[sql profile] %10" G_GUINT64_FORMAT " %12.3f %10.1f %10u  %s\n", p->count,
+             p->total_ns * 1e-6, p->total_ns * 1e-3 / p->count, p99, sql);
+  }
+  g_ptr_array_free(keys, TRUE);
+}
+
+int dt_database_prepare_cached(const struct dt_database_t *db, const char *query, sqlite3_stmt **stmt)
+{
+  dt_database_t *d = (dt_database_t *)db;
+
+  g_mutex_lock(&d->stmt_cache_lock);
+  GSList *idle = g_hash_table_lookup(d->stmt_cache, query);
+  if(idle)
+  {
+    *stmt = (sqlite3_stmt *)idle->data;
+    g_hash_table_insert(d->stmt_cache, g_strdup(query), g_slist_delete_link(idle, idle));
+    g_mutex_unlock(&d->stmt_cache_lock);
+    return SQLITE_OK;
+  }
+  g_mutex_unlock(&d->stmt_cache_lock);
+
+  return sqlite3_prepare_v2(d->handle, query, -1, stmt, NULL);
+}
+
+void dt_database_release_cached(const struct dt_database_t *db, sqlite3_stmt *stmt)
+{
+  if(!stmt) return;
+  dt_database_t *d = (dt_database_t *)db;
+
+  sqlite3_reset(stmt);
+  sqlite3_clear_bindings(stmt);
+
+  // sqlite3_sql() returns the text the statement was prepared from, which is our key
+  const char *query = sqlite3_sql(stmt);
+
+  g_mutex_lock(&d->stmt_cache_lock);
+  GSList *idle = g_hash_table_lookup(d->stmt_cache, query);
+  if(g_slist_length(idle) < DT_DATABASE_STMT_CACHE_DEPTH)
+  {
+    g_hash_table_insert(d->stmt_cache, g_strdup(query), g_slist_prepend(idle, stmt));
+    stmt = NULL;
+  }
+  g_mutex_unlock(&d->stmt_cache_lock);
+
+  if(stmt) sqlite3_finalize(stmt);
+}
+
 dt_database_t *dt_database_init(const char *alternative, const gboolean load_data, const gboolean has_gui)
 {
   //  set the threading mode to Serialized
@@ -1130,6 +1299,10 @@ start:
     snprintf(dbfilename_data, sizeof(dbfilename_data), ":memory:");
   // create database
   dt_database_t *db = (dt_database_t *)g_malloc0(sizeof(dt_database_t));
+  g_rec_mutex_init(&db->transaction_lock);
+  g_mutex_init(&db->stmt_cache_lock);
+  g_mutex_init(&db->profile_lock);
+  db->stmt_cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
   db->dbfilename_data = g_strdup(dbfilename_data);
   db->dbfilename_library = g_strdup(dbfilename_library);
   // make sure the folder exists. this might not be the case for new databases
@@ -1184,6 +1357,12 @@ start:
     return NULL;
   }
 
+  if(darktable.unmuted & DT_DEBUG_SQL_PROFILE)
+  {
+    db->profile = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, _database_profile_free);
+    sqlite3_trace_v2(db->handle, SQLITE_TRACE_PROFILE, _database_profile_callback, db);
+  }
+
   // attach a memory database to db connection for use with temporary tables
   // used during instance life time, which is discarded on exit.
   sqlite3_exec(db->handle, "attach database ':memory:' as memory", NULL, NULL, NULL);
@@ -1420,6 +1599,25 @@ error:
 
 void dt_database_destroy(const dt_database_t *db)
 {
+  dt_database_t *d = (dt_database_t *)db;
+
+  // statements have to be gone before the connection can be closed
+  GHashTableIter iter;
+  gpointer value;
+  g_hash_table_iter_init(&iter, d->stmt_cache);
+  while(g_hash_table_iter_next(&iter, NULL, &value))
+    g_slist_free_full((GSList *)value, (GDestroyNotify)sqlite3_finalize);
+  g_hash_table_destroy(d->stmt_cache);
+  g_mutex_clear(&d->stmt_cache_lock);
+
+  if(d->profile)
+  {
+    sqlite3_trace_v2(d->handle, 0, NULL, NULL);
+    _database_profile_report(d);
+    g_hash_table_destroy(d->profile);
+  }
+  g_mutex_clear(&d->profile_lock);
+
   sqlite3_close(db->handle);
 
   if (db->lockfile_data)
@@ -1436,11 +1634,85 @@ void dt_database_destroy(const dt_database_t *db)
 
   g_free(db->dbfilename_data);
   g_free(db->dbfilename_library);
+  g_rec_mutex_clear(&((dt_database_t *)db)->transaction_lock);
   g_free((dt_database_t *)db);
 
   sqlite3_shutdown();
 }
 
+void dt_database_start_transaction(const struct dt_database_t *db)
+{
+  dt_database_t *d = (dt_database_t *)db;
+  if(!g_rec_mutex_trylock(&d->transaction_lock))
+  {
+    g_atomic_int_inc(&d->transaction_waiters);
+    g_rec_mutex_lock(&d->transaction_lock);
+    g_atomic_int_dec_and_test(&d->transaction_waiters);
+  }
+
+  if(d->transaction_depth++ == 0)
+  {
+    g_atomic_int_inc(&d->transaction_epoch);
+    DT_DEBUG_SQLITE3_EXEC(d->handle, "BEGIN TRANSACTION", NULL, NULL, NULL);
+  }
+  else
+  {
+    gchar *query = g_strdup_printf("SAVEPOINT dt_nested_%d", d->transaction_depth);
+    DT_DEBUG_SQLITE3_EXEC(d->handle, query, NULL, NULL, NULL);
+    g_free(query);
+  }
+}
+
+static void _database_end_transaction(dt_database_t *d, const gboolean commit)
+{
+  if(d->transaction_depth <= 0)
+  {
+    fprintf(stderr, "[dt_database_%s_transaction] no transaction open\n", commit ? "release" : "rollback");
+    return;
+  }
+
+  if(d->transaction_depth == 1)
+    DT_DEBUG_SQLITE3_EXEC(d->handle, commit ? "COMMIT" : "ROLLBACK TRANSACTION", NULL, NULL, NULL);
+  else
+  {
+    gchar *query = commit
+      ? g_strdup_printf("RELEASE SAVEPOINT dt_nested_%d", d->transaction_depth)
+      : g_strdup_printf("ROLLBACK TO SAVEPOINT dt_nested_%d; RELEASE SAVEPOINT dt_nested_%d",
+                        d->transaction_depth, d->transaction_depth);
+    DT_DEBUG_SQLITE3_EXEC(d->handle, query, NULL, NULL, NULL);
+    g_free(query);
+  }
+
+  d->transaction_depth--;
+  g_rec_mutex_unlock(&d->transaction_lock);
+}
+
+void dt_database_release_transaction(const struct dt_database_t *db)
+{
+  _database_end_transaction((dt_database_t *)db, TRUE);
+}
+
+void dt_database_rollback_transaction(const struct dt_database_t *db)
+{
+  _database_end_transaction((dt_database_t *)db, FALSE);
+}
+
+void dt_database_yield_transaction(const struct dt_database_t *db)
+{
+  dt_database_t *d = (dt_database_t *)db;
+  // only the outermost transaction can be handed over
+  if(d->transaction_depth != 1) return;
+
+  const gint epoch = g_atomic_int_get(&d->transaction_epoch);
+  _database_end_transaction(d, TRUE);
+  // the mutex isn't fair, wait for a waiting thread to actually get it before taking it back
+  for(int k = 0; k < DT_DATABASE_YIELD_POLLS && g_atomic_int_get(&d->transaction_waiters) > 0
+                     && g_atomic_int_get(&d->transaction_epoch) == epoch;
+      k++)
+    g_usleep(1000);
+  dt_database_start_transaction(db);
+}
+
 sqlite3 *dt_database_get(const dt_database_t *db)
 {
   return db ? db->handle : NULL;
@@ -38,6 +38,22 @@ void dt_database_show_error(const struct dt_database_t *db);
 void dt_database_optimize(const struct dt_database_t *);
 /** conditionally perfrom db maintenance */
 void dt_database_maybe_maintenance(const struct dt_database_t *db, const gboolean has_gui, const gboolean closing_time);
+/** open a transaction, nested calls open savepoints inside of it. transactions of other threads
+    wait until the outermost one is released. every start needs a release or a rollback. */
+void dt_database_start_transaction(const struct dt_database_t *db);
+/** commit the innermost open transaction */
+void dt_database_release_transaction(const struct dt_database_t *db);
+/** roll back the innermost open transaction */
+void dt_database_rollback_transaction(const struct dt_database_t *db);
+/** commit the outermost transaction, let a thread waiting for one go first and open a new one.
+    does nothing inside a nested transaction. */
+void dt_database_yield_transaction(const struct dt_database_t *db);
+/** get an idle prepared statement for query from the cache of db, or prepare a new one.
+    the statement belongs to the caller until it is given back with dt_database_release_cached(),
+    it must not be finalized. meant for fixed queries on hot paths. */
+int dt_database_prepare_cached(const struct dt_database_t *db, const char *query, struct sqlite3_stmt **stmt);
+/** reset a statement from dt_database_prepare_cached() and put it back into the cache */
+void dt_database_release_cached(const struct dt_database_t *db, struct sqlite3_stmt *stmt);
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
@@ -38,6 +38,7 @@ extern "C" {
 #include <cmath>
 #include <fstream>
 #include <iostream>
+#include <list>
 #include <sstream>
 #include <string>
 
@@ -1440,151 +1441,236 @@ static void dt_remove_exif_geotag(Exiv2::ExifData &exifData)
   dt_remove_exif_keys(exifData, keys, n_keys);
 }
 
-int dt_exif_read_blob(uint8_t **buf, const char *path, const int imgid, const int sRGB, const int out_width,
-                      const int out_height, const int dng_mode)
+// drop everything of the source exif that is meaningless or wrong for an exported image,
+// the part of dt_exif_read_blob() that only depends on the original file
+static void _exif_blob_strip_source(Exiv2::ExifData &exifData)
 {
-  *buf = NULL;
-  try
+  // get rid of thumbnails
+  Exiv2::ExifThumb(exifData).erase();
+
+  {
+    static const char *keys[] = {
+      "Exif.Image.ImageWidth",
+      "Exif.Image.ImageLength",
+      "Exif.Image.BitsPerSample",
+      "Exif.Image.Compression",
+      "Exif.Image.PhotometricInterpretation",
+      "Exif.Image.FillOrder",
+      "Exif.Image.SamplesPerPixel",
+      "Exif.Image.StripOffsets",
+      "Exif.Image.RowsPerStrip",
+      "Exif.Image.StripByteCounts",
+      "Exif.Image.PlanarConfiguration",
+      "Exif.Image.DNGVersion",
+      "Exif.Image.DNGBackwardVersion"
+    };
+    static const guint n_keys = G_N_ELEMENTS(keys);
+    dt_remove_exif_keys(exifData, keys, n_keys);
+  }
+
+  /* Many tags should be removed in all cases as they are simply wrong also for dng files */
+
+  // remove subimage* trees, related to thumbnails or HDR usually; also UserCrop
+  for(Exiv2::ExifData::iterator i = exifData.begin(); i != exifData.end();)
   {
-    std::unique_ptr<Exiv2::Image> image(Exiv2::ImageFactory::open(WIDEN(path)));
-    assert(image.get() != 0);
-    read_metadata_threadsafe(image);
-    Exiv2::ExifData &exifData = image->exifData();
+    static const std::string needle = "Exif.SubImage";
+    if(i->key().compare(0, needle.length(), needle) == 0)
+      i = exifData.erase(i);
+    else
+      ++i;
+  }
+
+  {
+    static const char *keys[] = {
+      // Canon color space info
+      "Exif.Canon.ColorSpace",
+      "Exif.Canon.ColorData",
+
+      // Nikon thumbnail data
+      "Exif.Nikon3.Preview",
+      "Exif.NikonPreview.JPEGInterchangeFormat",
+
+      // DNG stuff that is irrelevant or misleading
+      "Exif.Image.DNGPrivateData",
+      "Exif.Image.DefaultBlackRender",
+      "Exif.Image.DefaultCropOrigin",
+      "Exif.Image.DefaultCropSize",
+      "Exif.Image.RawDataUniqueID",
+      "Exif.Image.OriginalRawFileName",
+      "Exif.Image.OriginalRawFileData",
+      "Exif.Image.ActiveArea",
+      "Exif.Image.MaskedAreas",
+      "Exif.Image.AsShotICCProfile",
+      "Exif.Image.OpcodeList1",
+      "Exif.Image.OpcodeList2",
+      "Exif.Image.OpcodeList3",
+      "Exif.Photo.MakerNote",
+
+      // Pentax thumbnail data
+      "Exif.Pentax.PreviewResolution",
+      "Exif.Pentax.PreviewLength",
+      "Exif.Pentax.PreviewOffset",
+      "Exif.PentaxDng.PreviewResolution",
+      "Exif.PentaxDng.PreviewLength",
+      "Exif.PentaxDng.PreviewOffset",
+      // Pentax color info
+      "Exif.PentaxDng.ColorInfo",
+
+      // Minolta thumbnail data
+      "Exif.Minolta.Thumbnail",
+      "Exif.Minolta.ThumbnailOffset",
+      "Exif.Minolta.ThumbnailLength",
+
+      // Sony thumbnail data
+      "Exif.SonyMinolta.ThumbnailOffset",
+      "Exif.SonyMinolta.ThumbnailLength",
+
+      // Olympus thumbnail data
+      "Exif.Olympus.Thumbnail",
+      "Exif.Olympus.ThumbnailOffset",
+      "Exif.Olympus.ThumbnailLength",
+
+      "Exif.Image.BaselineExposureOffset",
+    // Samsung makernote cleanup, the entries below have no relevance for exported images
+      "Exif.Samsung2.SensorAreas",
+      "Exif.Samsung2.ColorSpace",
+      "Exif.Samsung2.EncryptionKey",
+      "Exif.Samsung2.WB_RGGBLevelsUncorrected",
+      "Exif.Samsung2.WB_RGGBLevelsAuto",
+      "Exif.Samsung2.WB_RGGBLevelsIlluminator1",
+      "Exif.Samsung2.WB_RGGBLevelsIlluminator2",
+      "Exif.Samsung2.WB_RGGBLevelsBlack",
+      "Exif.Samsung2.ColorMatrix",
+      "Exif.Samsung2.ColorMatrixSRGB",
+      "Exif.Samsung2.ColorMatrixAdobeRGB",
+      "Exif.Samsung2.ToneCurve1",
+      "Exif.Samsung2.ToneCurve2",
+      "Exif.Samsung2.ToneCurve3",
+      "Exif.Samsung2.ToneCurve4"
+    };
+    static const guint n_keys = G_N_ELEMENTS(keys);
+    dt_remove_exif_keys(exifData, keys, n_keys);
+  }
+
+  static const char *dngkeys[] = {
+    // Embedded color profile info
+    "Exif.Image.CalibrationIlluminant1",
+    "Exif.Image.CalibrationIlluminant2",
+    "Exif.Image.ColorMatrix1",
+    "Exif.Image.ColorMatrix2",
+    "Exif.Image.ForwardMatrix1",
+    "Exif.Image.ForwardMatrix2",
+    "Exif.Image.ProfileCalibrationSignature",
+    "Exif.Image.ProfileCopyright",
+    "Exif.Image.ProfileEmbedPolicy",
+    "Exif.Image.ProfileHueSatMapData1",
+    "Exif.Image.ProfileHueSatMapData2",
+    "Exif.Image.ProfileHueSatMapDims",
+    "Exif.Image.ProfileHueSatMapEncoding",
+    "Exif.Image.ProfileLookTableData",
+    "Exif.Image.ProfileLookTableDims",
+    "Exif.Image.ProfileLookTableEncoding",
+    "Exif.Image.ProfileName",
+    "Exif.Image.ProfileToneCurve",
+    "Exif.Image.ReductionMatrix1",
+    "Exif.Image.ReductionMatrix2"
+  };
+  static const guint n_dngkeys = G_N_ELEMENTS(dngkeys);
+  dt_remove_exif_keys(exifData, dngkeys, n_dngkeys);
+}
 
-    // get rid of thumbnails
-    Exiv2::ExifThumb(exifData).erase();
-    Exiv2::ExifData::const_iterator pos;
+// the stripped source exif of recently exported images, keyed by path, size and mtime, so a
+// repeated or batch export doesn't open and parse the original file again each time.
+#define DT_EXIF_BLOB_CACHE_SIZE 64
 
-    {
-      static const char *keys[] = {
-        "Exif.Image.ImageWidth",
-        "Exif.Image.ImageLength",
-        "Exif.Image.BitsPerSample",
-        "Exif.Image.Compression",
-        "Exif.Image.PhotometricInterpretation",
-        "Exif.Image.FillOrder",
-        "Exif.Image.SamplesPerPixel",
-        "Exif.Image.StripOffsets",
-        "Exif.Image.RowsPerStrip",
-        "Exif.Image.StripByteCounts",
-        "Exif.Image.PlanarConfiguration",
-        "Exif.Image.DNGVersion",
-        "Exif.Image.DNGBackwardVersion"
-      };
-      static const guint n_keys = G_N_ELEMENTS(keys);
-      dt_remove_exif_keys(exifData, keys, n_keys);
-    }
+typedef struct dt_exif_blob_cache_entry_t
+{
+  std::string path;
+  off_t size;
+  time_t mtime;
+  Exiv2::Blob blob;
+} dt_exif_blob_cache_entry_t;
+
+static std::list<dt_exif_blob_cache_entry_t> _exif_blob_cache; // most recently used first
+static dt_pthread_mutex_t _exif_blob_cache_lock;
 
-      /* Many tags should be removed in all cases as they are simply wrong also for dng files */
+static gboolean _exif_blob_cache_stat(const char *path, off_t *size, time_t *mtime)
+{
+  GStatBuf st;
+  if(g_stat(path, &st)) return FALSE;
+  *size = st.st_size;
+  *mtime = st.st_mtime;
+  return TRUE;
+}
 
-      // remove subimage* trees, related to thumbnails or HDR usually; also UserCrop
-    for(Exiv2::ExifData::iterator i = exifData.begin(); i != exifData.end();)
+static gboolean _exif_blob_cache_get(const char *path, Exiv2::ExifData &exifData)
+{
+  off_t size;
+  time_t mtime;
+  if(!_exif_blob_cache_stat(path, &size, &mtime)) return FALSE;
+
+  // only copy the blob under the lock, decoding may take a while and throw
+  gboolean found = FALSE;
+  Exiv2::Blob blob;
+  dt_pthread_mutex_lock(&_exif_blob_cache_lock);
+  for(auto it = _exif_blob_cache.begin(); it != _exif_blob_cache.end(); ++it)
+  {
+    if(it->path != path) continue;
+    if(it->size == size && it->mtime == mtime)
     {
-      static const std::string needle = "Exif.SubImage";
-      if(i->key().compare(0, needle.length(), needle) == 0)
-        i = exifData.erase(i);
-      else
-        ++i;
+      try
+      {
+        blob = it->blob;
+      }
+      catch(...)
+      {
+        dt_pthread_mutex_unlock(&_exif_blob_cache_lock);
+        throw;
+      }
+      _exif_blob_cache.splice(_exif_blob_cache.begin(), _exif_blob_cache, it);
+      found = TRUE;
     }
+    else
+      _exif_blob_cache.erase(it); // the file changed
+    break;
+  }
+  dt_pthread_mutex_unlock(&_exif_blob_cache_lock);
+
+  if(found) Exiv2::ExifParser::decode(exifData, blob.data(), blob.size());
+  return found;
+}
+
+static void _exif_blob_cache_put(const char *path, const Exiv2::ExifData &exifData)
+{
+  dt_exif_blob_cache_entry_t entry;
+  if(!_exif_blob_cache_stat(path, &entry.size, &entry.mtime)) return;
+  entry.path = path;
+  Exiv2::ExifParser::encode(entry.blob, Exiv2::bigEndian, exifData);
+
+  dt_pthread_mutex_lock(&_exif_blob_cache_lock);
+  _exif_blob_cache.remove_if([path](const dt_exif_blob_cache_entry_t &e) { return e.path == path; });
+  _exif_blob_cache.push_front(std::move(entry));
+  if(_exif_blob_cache.size() > DT_EXIF_BLOB_CACHE_SIZE) _exif_blob_cache.pop_back();
+  dt_pthread_mutex_unlock(&_exif_blob_cache_lock);
+}
 
+int dt_exif_read_blob(uint8_t **buf, const char *path, const int imgid, const int sRGB, const int out_width,
+                      const int out_height, const int dng_mode)
+{
+  *buf = NULL;
+  try
+  {
+    Exiv2::ExifData exifData;
+    if(!_exif_blob_cache_get(path, exifData))
     {
-      static const char *keys[] = {
-        // Canon color space info
-        "Exif.Canon.ColorSpace",
-        "Exif.Canon.ColorData",
-
-        // Nikon thumbnail data
-        "Exif.Nikon3.Preview",
-        "Exif.NikonPreview.JPEGInterchangeFormat",
-
-        // DNG stuff that is irrelevant or misleading
-        "Exif.Image.DNGPrivateData",
-        "Exif.Image.DefaultBlackRender",
-        "Exif.Image.DefaultCropOrigin",
-        "Exif.Image.DefaultCropSize",
-        "Exif.Image.RawDataUniqueID",
-        "Exif.Image.OriginalRawFileName",
-        "Exif.Image.OriginalRawFileData",
-        "Exif.Image.ActiveArea",
-        "Exif.Image.MaskedAreas",
-        "Exif.Image.AsShotICCProfile",
-        "Exif.Image.OpcodeList1",
-        "Exif.Image.OpcodeList2",
-        "Exif.Image.OpcodeList3",
-        "Exif.Photo.MakerNote",
-
-        // Pentax thumbnail data
-        "Exif.Pentax.PreviewResolution",
-        "Exif.Pentax.PreviewLength",
-        "Exif.Pentax.PreviewOffset",
-        "Exif.PentaxDng.PreviewResolution",
-        "Exif.PentaxDng.PreviewLength",
-        "Exif.PentaxDng.PreviewOffset",
-        // Pentax color info
-        "Exif.PentaxDng.ColorInfo",
-
-        // Minolta thumbnail data
-        "Exif.Minolta.Thumbnail",
-        "Exif.Minolta.ThumbnailOffset",
-        "Exif.Minolta.ThumbnailLength",
-
-        // Sony thumbnail data
-        "Exif.SonyMinolta.ThumbnailOffset",
-        "Exif.SonyMinolta.ThumbnailLength",
-
-        // Olympus thumbnail data
-        "Exif.Olympus.Thumbnail",
-        "Exif.Olympus.ThumbnailOffset",
-        "Exif.Olympus.ThumbnailLength",
-
-        "Exif.Image.BaselineExposureOffset",
-      // Samsung makernote cleanup, the entries below have no relevance for exported images
-        "Exif.Samsung2.SensorAreas",
-        "Exif.Samsung2.ColorSpace",
-        "Exif.Samsung2.EncryptionKey",
-        "Exif.Samsung2.WB_RGGBLevelsUncorrected",
-        "Exif.Samsung2.WB_RGGBLevelsAuto",
-        "Exif.Samsung2.WB_RGGBLevelsIlluminator1",
-        "Exif.Samsung2.WB_RGGBLevelsIlluminator2",
-        "Exif.Samsung2.WB_RGGBLevelsBlack",
-        "Exif.Samsung2.ColorMatrix",
-        "Exif.Samsung2.ColorMatrixSRGB",
-        "Exif.Samsung2.ColorMatrixAdobeRGB",
-        "Exif.Samsung2.ToneCurve1",
-        "Exif.Samsung2.ToneCurve2",
-        "Exif.Samsung2.ToneCurve3",
-        "Exif.Samsung2.ToneCurve4"
-      };
-      static const guint n_keys = G_N_ELEMENTS(keys);
-      dt_remove_exif_keys(exifData, keys, n_keys);
+      std::unique_ptr<Exiv2::Image> image(Exiv2::ImageFactory::open(WIDEN(path)));
+      assert(image.get() != 0);
+      read_metadata_threadsafe(image);
+      exifData = image->exifData();
+      _exif_blob_strip_source(exifData);
+      _exif_blob_cache_put(path, exifData);
     }
 
-      static const char *dngkeys[] = {
-        // Embedded color profile info
-        "Exif.Image.CalibrationIlluminant1",
-        "Exif.Image.CalibrationIlluminant2",
-        "Exif.Image.ColorMatrix1",
-        "Exif.Image.ColorMatrix2",
-        "Exif.Image.ForwardMatrix1",
-        "Exif.Image.ForwardMatrix2",
-        "Exif.Image.ProfileCalibrationSignature",
-        "Exif.Image.ProfileCopyright",
-        "Exif.Image.ProfileEmbedPolicy",
-        "Exif.Image.ProfileHueSatMapData1",
-        "Exif.Image.ProfileHueSatMapData2",
-        "Exif.Image.ProfileHueSatMapDims",
-        "Exif.Image.ProfileHueSatMapEncoding",
-        "Exif.Image.ProfileLookTableData",
-        "Exif.Image.ProfileLookTableDims",
-        "Exif.Image.ProfileLookTableEncoding",
-        "Exif.Image.ProfileName",
-        "Exif.Image.ProfileToneCurve",
-        "Exif.Image.ReductionMatrix1",
-        "Exif.Image.ReductionMatrix2"
-        };
-      static const guint n_dngkeys = G_N_ELEMENTS(dngkeys);
-    dt_remove_exif_keys(exifData, dngkeys, n_dngkeys);
-
     /* Write appropriate color space tag if using sRGB output */
     if(sRGB)
       exifData["Exif.Photo.ColorSpace"] = uint16_t(1); /* sRGB */
@@ -2267,6 +2353,7 @@ int dt_exif_xmp_read(dt_image_t *img, const char *filename, const int history_on
   // exclude pfm to avoid stupid errors on the console
   const char *c = filename + strlen(filename) - 4;
   if(c >= filename && !strcmp(c, ".pfm")) return 1;
+  gboolean in_transaction = FALSE;
   try
   {
     // read xmp sidecar
@@ -2360,7 +2447,6 @@ int dt_exif_xmp_read(dt_image_t *img, const char *filename, const int history_on
       add_mask_entry_to_db(img->id, mask_entry);
     }
 
-    sqlite3_exec(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
     // history
     int num = 0;
     gboolean all_ok = TRUE;
@@ -2375,7 +2461,8 @@ int dt_exif_xmp_read(dt_image_t *img, const char *filename, const int history_on
       return 1;
     }
 
-    sqlite3_exec(dt_database_get(darktable.db), "BEGIN TRANSACTION", NULL, NULL, NULL);
+    dt_database_start_transaction(darktable.db);
+    in_transaction = TRUE;
 
     DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "DELETE FROM main.history WHERE imgid = ?1", -1,
                                 &stmt, NULL);
@@ -2521,9 +2608,10 @@ int dt_exif_xmp_read(dt_image_t *img, const char *filename, const int history_on
     if(mask_entries)
       g_hash_table_destroy(mask_entries);
 
+    in_transaction = FALSE;
     if(all_ok)
     {
-      sqlite3_exec(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
+      dt_database_release_transaction(darktable.db);
       // history_hash
       dt_history_hash_values_t hash = {NULL, 0, NULL, 0, NULL, 0};
 
@@ -2563,13 +2651,14 @@ int dt_exif_xmp_read(dt_image_t *img, const char *filename, const int history_on
     else
     {
       std::cerr << "[exif] error reading history from '" << filename << "'" << std::endl;
-      sqlite3_exec(dt_database_get(darktable.db), "ROLLBACK TRANSACTION", NULL, NULL, NULL);
+      dt_database_rollback_transaction(darktable.db);
       return 1;
     }
 
   }
   catch(Exiv2::AnyError &e)
   {
+    if(in_transaction) dt_database_rollback_transaction(darktable.db);
     // actually nobody's interested in that if the file doesn't exist:
     // std::string s(e.what());
     // std::cerr << "[exiv2] " << filename << ": " << s << std::endl;
@@ -3444,23 +3533,27 @@ int dt_exif_xmp_write(const int imgid, const char *filename)
       // we want to avoid writing the sidecar file if it didn't change to avoid issues when using the same images
       // from different computers. sample use case: images on NAS, several computers using them NOT AT THE SAME TIME and
       // the xmp crawler is used to find changed sidecars.
-      errno = 0;
-      size_t end;
-      unsigned char *content = (unsigned char*)dt_read_file(filename, &end);
+      // map the old sidecar once, it serves both the checksum and the packet to merge into
+      GError *error = NULL;
+      GMappedFile *content = g_mapped_file_new(filename, FALSE, &error);
 
       if(content)
       {
-        checksum_old = g_compute_checksum_for_data(G_CHECKSUM_MD5, content, end);
-        free(content);
+        const char *data = g_mapped_file_get_contents(content);
+        const gsize end = g_mapped_file_get_length(content);
+        checksum_old = g_compute_checksum_for_data(G_CHECKSUM_MD5, (const guchar *)data, end);
+        if(data) xmpPacket.assign(data, end);
+        g_mapped_file_unref(content);
       }
       else
       {
-        fprintf(stderr, "cannot read xmp file '%s': '%s'\n", filename, strerror(errno));
-        dt_control_log(_("cannot read xmp file '%s': '%s'"), filename, strerror(errno));
+        fprintf(stderr, "cannot read xmp file '%s': '%s'\n", filename, error->message);
+        dt_control_log(_("cannot read xmp file '%s': '%s'"), filename, error->message);
+        g_error_free(error);
+        // don't replace what we couldn't read
+        return 1;
       }
 
-      Exiv2::DataBuf buf = Exiv2::readFile(WIDEN(filename));
-      xmpPacket.assign(reinterpret_cast<char *>(buf.pData_), buf.size_);
       Exiv2::XmpParser::decode(xmpData, xmpPacket);
       // because XmpSeq or XmpBag are added to the list, we first have
       // to remove these so that we don't end up with a string of duplicates
@@ -3629,6 +3722,7 @@ void dt_exif_init()
   #endif
 
   Exiv2::XmpParser::initialize();
+  dt_pthread_mutex_init(&_exif_blob_cache_lock, NULL);
   // this has to stay with the old url (namespace already propagated outside dt)
   Exiv2::XmpProperties::registerNs("http://darktable.sf.net/", "darktable");
   // check is Exiv2 version already knows these prefixes
@@ -3654,6 +3748,8 @@ void dt_exif_init()
 
 void dt_exif_cleanup()
 {
+  _exif_blob_cache.clear();
+  dt_pthread_mutex_destroy(&_exif_blob_cache_lock);
   Exiv2::XmpParser::terminate();
 }
 
@@ -461,28 +461,15 @@ int dt_history_merge_module_into_history(dt_develop_t *dev_dest, dt_develop_t *d
   return module_added;
 }
 
-static int _history_copy_and_paste_on_image_merge(int32_t imgid, int32_t dest_imgid, GList *ops, const gboolean copy_full)
+// load the source history into dev_src and return the modules to be merged into a destination
+static GList *_history_merge_source_init(dt_develop_t *dev_src, const int32_t imgid, GList *ops)
 {
-  GList *modules_used = NULL;
-  dt_develop_t _dev_src = { 0 };
-  dt_develop_t _dev_dest = { 0 };
-  dt_develop_t *dev_src = &_dev_src;
-  dt_develop_t *dev_dest = &_dev_dest;
-  // we will do the copy/paste on memory so we can deal with masks
   dt_dev_init(dev_src, FALSE);
-  dt_dev_init(dev_dest, FALSE);
   dev_src->iop = dt_iop_load_modules_ext(dev_src, TRUE);
-  dev_dest->iop = dt_iop_load_modules_ext(dev_dest, TRUE);
   dt_dev_read_history_ext(dev_src, imgid, TRUE);
-  // This prepends the default modules and converts just in case it's an empty history
-  dt_dev_read_history_ext(dev_dest, dest_imgid, TRUE);
-
   dt_ioppr_check_iop_order(dev_src, imgid, "_history_copy_and_paste_on_image_merge ");
-  dt_ioppr_check_iop_order(dev_dest, dest_imgid, "_history_copy_and_paste_on_image_merge ");
   dt_dev_pop_history_items_ext(dev_src, dev_src->history_end);
-  dt_dev_pop_history_items_ext(dev_dest, dev_dest->history_end);
   dt_ioppr_check_iop_order(dev_src, imgid, "_history_copy_and_paste_on_image_merge 1");
-  dt_ioppr_check_iop_order(dev_dest, dest_imgid, "_history_copy_and_paste_on_image_merge 1");
 
   GList *mod_list = NULL;
 
@@ -526,7 +513,24 @@ static int _history_copy_and_paste_on_image_merge(int32_t imgid, int32_t dest_im
   }
   if (DT_IOP_ORDER_INFO) fprintf(stderr,"\nvvvvv\n");
 
-  mod_list = g_list_reverse(mod_list);
+  return g_list_reverse(mod_list);
+}
+
+// merge the modules of mod_list, from the source loaded by _history_merge_source_init(), into dest_imgid
+static void _history_merge_into_image(dt_develop_t *dev_src, GList *mod_list, const int32_t dest_imgid)
+{
+  GList *modules_used = NULL;
+  dt_develop_t _dev_dest = { 0 };
+  dt_develop_t *dev_dest = &_dev_dest;
+  // we will do the copy/paste on memory so we can deal with masks
+  dt_dev_init(dev_dest, FALSE);
+  dev_dest->iop = dt_iop_load_modules_ext(dev_dest, TRUE);
+  // This prepends the default modules and converts just in case it's an empty history
+  dt_dev_read_history_ext(dev_dest, dest_imgid, TRUE);
+
+  dt_ioppr_check_iop_order(dev_dest, dest_imgid, "_history_copy_and_paste_on_image_merge ");
+  dt_dev_pop_history_items_ext(dev_dest, dev_dest->history_end);
+  dt_ioppr_check_iop_order(dev_dest, dest_imgid, "_history_copy_and_paste_on_image_merge 1");
 
   for(GList *l = mod_list; l; l = g_list_next(l))
   {
@@ -537,13 +541,48 @@ static int _history_copy_and_paste_on_image_merge(int32_t imgid, int32_t dest_im
   dt_ioppr_check_iop_order(dev_dest, dest_imgid, "_history_copy_and_paste_on_image_merge 2");
   // write history and forms to db
   dt_dev_write_history_ext(dev_dest, dest_imgid);
-  dt_dev_cleanup(dev_src);
   dt_dev_cleanup(dev_dest);
   g_list_free(modules_used);
+}
+
+static int _history_copy_and_paste_on_image_merge(int32_t imgid, int32_t dest_imgid, GList *ops, const gboolean copy_full)
+{
+  dt_develop_t _dev_src = { 0 };
+  dt_develop_t *dev_src = &_dev_src;
+  GList *mod_list = _history_merge_source_init(dev_src, imgid, ops);
+  _history_merge_into_image(dev_src, mod_list, dest_imgid);
+  g_list_free(mod_list);
+  dt_dev_cleanup(dev_src);
 
   return 0;
 }
 
+// the list of IOP not to copy, quoted for an sql IN ()
+static gchar *_history_skip_modules(const gboolean copy_full)
+{
+  gchar *skip_modules = NULL;
+  if(!copy_full)
+  {
+    for(GList *modules = darktable.iop; modules; modules = g_list_next(modules))
+    {
+      dt_iop_module_so_t *module = (dt_iop_module_so_t *)modules->data;
+
+      if(dt_history_module_skip_copy(module->flags()))
+      {
+        if(skip_modules)
+          skip_modules = dt_util_dstrcat(skip_modules, ",");
+
+        skip_modules = dt_util_dstrcat(skip_modules, "'%s'", module->op);
+      }
+    }
+  }
+
+  if(!skip_modules)
+    skip_modules = g_strdup("'@'");
+
+  return skip_modules;
+}
+
 static int _history_copy_and_paste_on_image_overwrite(const int32_t imgid, const int32_t dest_imgid,
                                                       GList *ops, const gboolean copy_full)
 {
@@ -573,27 +612,7 @@ static int _history_copy_and_paste_on_image_overwrite(const int32_t imgid, const
   // the user wants an exact duplicate of the history, so just copy the db
   if(!ops)
   {
-    // let's build the list of IOP to not copy
-    gchar *skip_modules = NULL;
-    if(!copy_full)
-    {
-      for(GList *modules = darktable.iop; modules; modules = g_list_next(modules))
-      {
-        dt_iop_module_so_t *module = (dt_iop_module_so_t *)modules->data;
-
-        if(dt_history_module_skip_copy(module->flags()))
-        {
-          if(skip_modules)
-            skip_modules = dt_util_dstrcat(skip_modules, ",");
-       
-          skip_modules = dt_util_dstrcat(skip_modules, "'%s'", module->op);
-        }
-      }
-    }
-
-    if(!skip_modules)
-      skip_modules = g_strdup("'@'");
-
+    gchar *skip_modules = _history_skip_modules(copy_full);
     gchar *query = g_strdup_printf
       ("INSERT INTO main.history "
        "            (imgid,num,module,operation,op_params,enabled,blendop_params, "
@@ -750,6 +769,248 @@ int dt_history_copy_and_paste_on_image(const int32_t imgid, const int32_t dest_i
   return ret_val;
 }
 
+// destination images pasted onto per transaction
+#define DT_HISTORY_PASTE_CHUNK 256
+
+// lock the db stripes of the source and of a chunk of destinations, each stripe once and in order
+static uint64_t _history_lock_images(const int32_t imgid, const GList *chunk) NO_THREAD_SAFETY_ANALYSIS
+{
+  uint64_t stripes = (uint64_t)1 << (imgid & (DT_IMAGE_DBLOCKS - 1));
+  for(const GList *l = chunk; l; l = g_list_next(l))
+    stripes |= (uint64_t)1 << (GPOINTER_TO_INT(l->data) & (DT_IMAGE_DBLOCKS - 1));
+
+  for(int k = 0; k < DT_IMAGE_DBLOCKS; k++)
+    if(stripes & ((uint64_t)1 << k)) dt_pthread_mutex_lock(&darktable.db_image[k]);
+
+  return stripes;
+}
+
+static void _history_unlock_images(const uint64_t stripes) NO_THREAD_SAFETY_ANALYSIS
+{
+  for(int k = 0; k < DT_IMAGE_DBLOCKS; k++)
+    if(stripes & ((uint64_t)1 << k)) dt_pthread_mutex_unlock(&darktable.db_image[k]);
+}
+
+// _history_copy_and_paste_on_image_overwrite() without ops, for all the images of dest_list at once
+static void _history_overwrite_on_list(const int32_t imgid, const gchar *dest_list, const gboolean copy_full)
+{
+  sqlite3_stmt *stmt;
+  gchar *skip_modules = _history_skip_modules(copy_full);
+  // replace history stack and shapes
+  gchar *query = g_strdup_printf("DELETE FROM main.history WHERE imgid IN (%s)", dest_list);
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), query, NULL, NULL, NULL);
+  g_free(query);
+  query = g_strdup_printf("DELETE FROM main.masks_history WHERE imgid IN (%s)", dest_list);
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), query, NULL, NULL, NULL);
+  g_free(query);
+
+  query = g_strdup_printf
+    ("INSERT INTO main.history "
+     "            (imgid,num,module,operation,op_params,enabled,blendop_params, "
+     "             blendop_version,multi_priority,multi_name)"
+     " SELECT i.id,h.num,h.module,h.operation,h.op_params,h.enabled,h.blendop_params, "
+     "        h.blendop_version,h.multi_priority,h.multi_name "
+     " FROM main.history AS h"
+     " JOIN main.images AS i ON i.id IN (%s)"
+     " WHERE h.imgid=?1"
+     "       AND h.operation NOT IN (%s)"
+     " ORDER BY i.id, h.num", dest_list, skip_modules);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+  g_free(query);
+
+  query = g_strdup_printf
+    ("INSERT INTO main.masks_history "
+     "           (imgid, num, formid, form, name, version, points, points_count, source)"
+     " SELECT i.id, m.num, m.formid, m.form, m.name, m.version, m.points, m.points_count, m.source "
+     "  FROM main.masks_history AS m"
+     "  JOIN main.images AS i ON i.id IN (%s)"
+     "  WHERE m.imgid = ?1"
+     "    AND m.num NOT IN (SELECT num FROM main.history WHERE imgid=?1 AND operation IN (%s))",
+     dest_list, skip_modules);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+  g_free(query);
+  g_free(skip_modules);
+
+  query = g_strdup_printf("UPDATE main.images"
+                          " SET history_end = IFNULL((SELECT history_end FROM main.images WHERE id = ?1), 0),"
+                          "     aspect_ratio = 0.0"
+                          " WHERE id IN (%s)", dest_list);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+  g_free(query);
+  // copy the module order
+  query = g_strdup_printf("INSERT OR REPLACE INTO main.module_order (imgid, iop_list, version)"
+                          " SELECT i.id, m.iop_list, m.version"
+                          "   FROM main.module_order AS m"
+                          "   JOIN main.images AS i ON i.id IN (%s)"
+                          "   WHERE m.imgid = ?1", dest_list);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+  g_free(query);
+  // and finally the history hash, except mipmap hash. the source may have none yet
+  query = g_strdup_printf("DELETE FROM main.history_hash WHERE imgid IN (%s)", dest_list);
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), query, NULL, NULL, NULL);
+  g_free(query);
+  query = g_strdup_printf("INSERT INTO main.history_hash"
+                          "    (imgid, basic_hash, auto_hash, current_hash)"
+                          " SELECT i.id, h.basic_hash, h.auto_hash, h.current_hash"
+                          "   FROM main.history_hash AS h"
+                          "   JOIN main.images AS i ON i.id IN (%s)"
+                          "   WHERE h.imgid = ?1", dest_list);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+  g_free(query);
+}
+
+// dt_history_copy_and_paste_on_image() for a list of destinations. the source is read once, the
+// history of each chunk of destinations is written in one transaction (with plain sql when the whole
+// history is overwritten) and the mipmaps, sidecars and signals follow once the chunk is committed.
+static void _history_paste_on_list(const int32_t imgid, const GList *list, const gboolean merge, GList *ops,
+                                   const gboolean copy_iop_order, const gboolean copy_full)
+{
+  // be sure the current history is written before pasting some other history data
+  const dt_view_t *cv = dt_view_manager_get_current_view(darktable.view_manager);
+
+  if(cv->view((dt_view_t *)cv) == DT_VIEW_DARKROOM)
+    dt_dev_write_history(darktable.develop);
+
+  const gboolean sql_only = !merge && !ops;
+  dt_develop_t _dev_src = { 0 };
+  dt_develop_t *dev_src = &_dev_src;
+  GList *mod_list = sql_only ? NULL : _history_merge_source_init(dev_src, imgid, ops);
+  GList *iop_list = copy_iop_order ? dt_ioppr_get_iop_order_list(imgid, FALSE) : NULL;
+
+  guint tagid = 0;
+  dt_tag_new("darktable|changed", &tagid);
+
+  const GList *l = list;
+  while(l)
+  {
+    GList *chunk = NULL;
+    gchar *dest_list = NULL;
+    for(int k = 0; l && k < DT_HISTORY_PASTE_CHUNK; l = g_list_next(l))
+    {
+      if(GPOINTER_TO_INT(l->data) == imgid) continue;
+      chunk = g_list_prepend(chunk, l->data);
+      dest_list = dt_util_dstrcat(dest_list, "%d,", GPOINTER_TO_INT(l->data));
+      k++;
+    }
+    if(!chunk) break;
+    dest_list[strlen(dest_list) - 1] = '\0';
+    chunk = g_list_reverse(chunk);
+
+    const uint64_t stripes = _history_lock_images(imgid, chunk);
+    dt_database_start_transaction(darktable.db);
+
+    GList *undo = NULL;
+    for(const GList *c = chunk; c; c = g_list_next(c))
+    {
+      dt_undo_lt_history_t *hist = dt_history_snapshot_item_init();
+      hist->imgid = GPOINTER_TO_INT(c->data);
+      dt_history_snapshot_undo_create(hist->imgid, &hist->before, &hist->before_history_end);
+      undo = g_list_prepend(undo, hist);
+    }
+    undo = g_list_reverse(undo);
+
+    if(sql_only)
+      _history_overwrite_on_list(imgid, dest_list, copy_full);
+
+    for(const GList *c = chunk; c; c = g_list_next(c))
+    {
+      const int32_t dest_imgid = GPOINTER_TO_INT(c->data);
+      // the plain sql overwrite copied the module order already
+      if(sql_only) continue;
+      if(iop_list) dt_ioppr_write_iop_order_list(iop_list, dest_imgid);
+
+      if(!merge)
+      {
+        // clear the history, the selected modules are merged into an empty one
+        sqlite3_stmt *stmt;
+        DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                    "DELETE FROM main.history WHERE imgid = ?1",
+                                    -1, &stmt, NULL);
+        DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, dest_imgid);
+        sqlite3_step(stmt);
+        sqlite3_finalize(stmt);
+        DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                    "DELETE FROM main.masks_history WHERE imgid = ?1",
+                                    -1, &stmt, NULL);
+        DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, dest_imgid);
+        sqlite3_step(stmt);
+        sqlite3_finalize(stmt);
+        DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                    "UPDATE main.images SET history_end = 0, aspect_ratio = 0.0 WHERE id = ?1",
+                                    -1, &stmt, NULL);
+        DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, dest_imgid);
+        sqlite3_step(stmt);
+        sqlite3_finalize(stmt);
+      }
+      _history_merge_into_image(dev_src, mod_list, dest_imgid);
+    }
+
+    dt_undo_start_group(darktable.undo, DT_UNDO_LT_HISTORY);
+    for(GList *u = undo; u; u = g_list_next(u))
+    {
+      dt_undo_lt_history_t *hist = (dt_undo_lt_history_t *)u->data;
+      dt_history_snapshot_undo_create(hist->imgid, &hist->after, &hist->after_history_end);
+      dt_undo_record(darktable.undo, NULL, DT_UNDO_LT_HISTORY, (dt_undo_data_t)hist,
+                     dt_history_snapshot_undo_pop, dt_history_snapshot_undo_lt_history_data_free);
+    }
+    dt_undo_end_group(darktable.undo);
+    g_list_free(undo);
+
+    // attach changed tag reflecting actual change
+    dt_tag_attach_images(tagid, chunk, FALSE);
+    for(const GList *c = chunk; c; c = g_list_next(c))
+      dt_image_cache_set_change_timestamp(darktable.image_cache, GPOINTER_TO_INT(c->data));
+
+    dt_database_release_transaction(darktable.db);
+    _history_unlock_images(stripes);
+
+    // update xmp files
+    dt_image_synch_xmps(chunk);
+
+    for(const GList *c = chunk; c; c = g_list_next(c))
+    {
+      const int32_t dest_imgid = GPOINTER_TO_INT(c->data);
+      /* if current image in develop reload history */
+      if(dt_dev_is_current_image(darktable.develop, dest_imgid))
+        dt_dev_reload_history_items(darktable.develop);
+      dt_mipmap_cache_remove(darktable.mipmap_cache, dest_imgid);
+      dt_image_reset_final_size(dest_imgid);
+      // update the aspect ratio. recompute only if really needed for performance reasons
+      if(darktable.collection->params.sort == DT_COLLECTION_SORT_ASPECT_RATIO)
+        dt_image_set_aspect_ratio(dest_imgid, FALSE);
+      else
+        dt_image_reset_aspect_ratio(dest_imgid, FALSE);
+      // signal that the mipmap need to be updated
+      dt_control_signal_raise(darktable.signals, DT_SIGNAL_DEVELOP_MIPMAP_UPDATED, dest_imgid);
+    }
+
+    g_list_free(chunk);
+    g_free(dest_list);
+  }
+
+  g_list_free_full(iop_list, g_free);
+  if(!sql_only)
+  {
+    g_list_free(mod_list);
+    dt_dev_cleanup(dev_src);
+  }
+}
+
 GList *dt_history_get_items(const int32_t imgid, gboolean enabled)
 {
   GList *result = NULL;
@@ -859,27 +1120,37 @@ void dt_history_set_compress_problem(const int32_t imgid, const gboolean set)
     dt_tag_detach(tagid, imgid, FALSE, FALSE);
 }
 
+static int _history_get_end(const int32_t imgid)
+{
+  sqlite3_stmt *stmt;
+  int history_end = 0;
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+                                  "SELECT history_end FROM main.images WHERE id=?1", &stmt);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+
+  if (sqlite3_step(stmt) == SQLITE_ROW)
+    history_end = sqlite3_column_int(stmt, 0);
+
+  dt_database_release_cached(darktable.db, stmt);
+  return history_end;
+}
+
 static int dt_history_end_attop(const int32_t imgid)
 {
   int size=0;
   int end=0;
   sqlite3_stmt *stmt;
   // get highest num in history
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-    "SELECT MAX(num) FROM main.history WHERE imgid=?1", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+    "SELECT MAX(num) FROM main.history WHERE imgid=?1", &stmt);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
 
   if (sqlite3_step(stmt) == SQLITE_ROW)
     size = sqlite3_column_int(stmt, 0);
     
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
   // get history_end
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-    "SELECT history_end FROM main.images WHERE id=?1", -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-  if (sqlite3_step(stmt) == SQLITE_ROW)
-    end = sqlite3_column_int(stmt, 0);
-  sqlite3_finalize(stmt);
+  end = _history_get_end(imgid);
   // a special case right after removing all history
   // It must be absolutely fresh and untouched so history_end is always on top
   if ((size==0) && (end==0)) 
@@ -891,37 +1162,19 @@ static int dt_history_end_attop(const int32_t imgid)
   return 0;
 }
 
-void dt_history_compress_on_image(const int32_t imgid)
+// compress the history of imgid up to my_history_end, the caller holds the image lock and a transaction.
+// these statements run for every image of a list, they are kept prepared.
+static void _history_compress_on_image(const int32_t imgid, const int my_history_end)
 {
-  dt_lock_image(imgid);
   sqlite3_stmt *stmt;
-  // get history_end for image
-  int my_history_end = 0;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-    "SELECT history_end FROM main.images WHERE id=?1", -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-
-  if (sqlite3_step(stmt) == SQLITE_ROW)
-    my_history_end = sqlite3_column_int(stmt, 0);
-
-  sqlite3_finalize(stmt);
-
-  if (my_history_end == 0)
-  {
-    dt_history_delete_on_image(imgid);
-    dt_unlock_image(imgid);
-    return;
-  }
-
   int masks_count = 0;
   const char *op_mask_manager = "mask_manager";
   gboolean manager_position = FALSE;
 
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "BEGIN", NULL, NULL, NULL);
   // We must know for sure whether there is a mask manager at slot 0 in history
   // because only if this is **not** true history nums and history_end must be increased
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-    "SELECT COUNT(*) FROM main.history WHERE imgid = ?1 AND operation = ?2 AND num = 0", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+    "SELECT COUNT(*) FROM main.history WHERE imgid = ?1 AND operation = ?2 AND num = 0", &stmt);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 2, op_mask_manager, -1, SQLITE_TRANSIENT);
 
@@ -929,37 +1182,37 @@ void dt_history_compress_on_image(const int32_t imgid)
     if (sqlite3_column_int(stmt, 0) == 1)
       manager_position = TRUE;
 
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
   // compress history
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "DELETE FROM main.history"
-                              " WHERE imgid = ?1 AND num NOT IN"
-                              "   (SELECT MAX(num) FROM main.history"
-                              "     WHERE imgid = ?1 AND num < ?2"
-                              "     GROUP BY operation, multi_priority)",
-                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+                                  "DELETE FROM main.history"
+                                  " WHERE imgid = ?1 AND num NOT IN"
+                                  "   (SELECT MAX(num) FROM main.history"
+                                  "     WHERE imgid = ?1 AND num < ?2"
+                                  "     GROUP BY operation, multi_priority)",
+                                  &stmt);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, my_history_end);
   sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
   // delete all mask_manager entries
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-    "DELETE FROM main.history WHERE imgid = ?1 AND operation = ?2", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+    "DELETE FROM main.history WHERE imgid = ?1 AND operation = ?2", &stmt);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 2, op_mask_manager, -1, SQLITE_TRANSIENT);
   sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
   // compress masks history
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "DELETE FROM main.masks_history"
-                              " WHERE imgid = ?1 "
-                              "   AND num NOT IN (SELECT MAX(num)"
-                              "                   FROM main.masks_history"
-                              "                   WHERE imgid = ?1 AND num < ?2)", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+                                  "DELETE FROM main.masks_history"
+                                  " WHERE imgid = ?1 "
+                                  "   AND num NOT IN (SELECT MAX(num)"
+                                  "                   FROM main.masks_history"
+                                  "                   WHERE imgid = ?1 AND num < ?2)", &stmt);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, my_history_end);
   sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
   // this removes not enabled iops
 /*  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
                               "DELETE FROM main.history  WHERE imgid=?1 AND enabled=0", -1, &stmt, NULL);
@@ -967,55 +1220,71 @@ void dt_history_compress_on_image(const int32_t imgid)
   sqlite3_step(stmt);
   sqlite3_finalize(stmt);*/
   // if there are masks create a mask manager entry, so we need to count them
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-    "SELECT COUNT(*) FROM main.masks_history WHERE imgid = ?1", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+    "SELECT COUNT(*) FROM main.masks_history WHERE imgid = ?1", &stmt);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   
   if(sqlite3_step(stmt) == SQLITE_ROW)
     masks_count = sqlite3_column_int(stmt, 0);
 
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
 
   if(masks_count > 0)
   {
     // Set num in masks history to make sure they are owned by the manager at slot 0.
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-      "UPDATE main.masks_history SET num = 0 WHERE imgid = ?1", -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+      "UPDATE main.masks_history SET num = 0 WHERE imgid = ?1", &stmt);
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
     sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    dt_database_release_cached(darktable.db, stmt);
 
     if (!manager_position)
     {
       // make room for mask manager history entry
-      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-        "UPDATE main.history SET num=num+1 WHERE imgid = ?1", -1, &stmt, NULL);
+      DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+        "UPDATE main.history SET num=num+1 WHERE imgid = ?1", &stmt);
       DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
       sqlite3_step(stmt);
-      sqlite3_finalize(stmt);
+      dt_database_release_cached(darktable.db, stmt);
 
       // update history end
-      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-        "UPDATE main.images SET history_end = history_end+1 WHERE id = ?1", -1, &stmt, NULL);
+      DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+        "UPDATE main.images SET history_end = history_end+1 WHERE id = ?1", &stmt);
       DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
       sqlite3_step(stmt);
-      sqlite3_finalize(stmt);
+      dt_database_release_cached(darktable.db, stmt);
     }
     // create a mask manager entry in history as first entry
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "INSERT INTO main.history (imgid, num, operation, op_params, module, enabled, "
-                                "                          blendop_params, blendop_version, multi_priority, multi_name) "
-                                " VALUES(?1, 0, ?2, NULL, 1, 0, NULL, 0, 0, '')",
-                                -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+                                    "INSERT INTO main.history (imgid, num, operation, op_params, module, enabled, "
+                                    "                          blendop_params, blendop_version, multi_priority, multi_name) "
+                                    " VALUES(?1, 0, ?2, NULL, 1, 0, NULL, 0, 0, '')",
+                                    &stmt);
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
     DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 2, op_mask_manager, -1, SQLITE_TRANSIENT);
     sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    dt_database_release_cached(darktable.db, stmt);
   }
-  
+}
+
+void dt_history_compress_on_image(const int32_t imgid)
+{
+  dt_lock_image(imgid);
+  // get history_end for image
+  const int my_history_end = _history_get_end(imgid);
+
+  if (my_history_end == 0)
+  {
+    dt_history_delete_on_image(imgid);
+    dt_unlock_image(imgid);
+    return;
+  }
+
+  dt_database_start_transaction(darktable.db);
+  _history_compress_on_image(imgid, my_history_end);
   dt_unlock_image(imgid);
   dt_history_hash_write_from_history(imgid, DT_HISTORY_HASH_CURRENT);
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
+  dt_database_release_transaction(darktable.db);
   GList *imgs = g_list_append(NULL, GINT_TO_POINTER(imgid));
   dt_control_signal_raise(darktable.signals, DT_SIGNAL_DEVELOP_MIPMAP_UPDATED, imgs);
 }
@@ -1032,7 +1301,7 @@ void dt_history_truncate_on_image(const int32_t imgid, const int32_t history_end
     return;
   }
 
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "BEGIN", NULL, NULL, NULL);
+  dt_database_start_transaction(darktable.db);
   // delete end of history
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
                               "DELETE FROM main.history"
@@ -1063,102 +1332,129 @@ void dt_history_truncate_on_image(const int32_t imgid, const int32_t history_end
   dt_unlock_image(imgid);
   dt_history_hash_write_from_history(imgid, DT_HISTORY_HASH_CURRENT);
 
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
+  dt_database_release_transaction(darktable.db);
 
   GList *imgs = g_list_append(NULL, GINT_TO_POINTER(imgid));
   dt_control_signal_raise(darktable.signals, DT_SIGNAL_DEVELOP_MIPMAP_UPDATED, imgs);
 }
 
-int dt_history_compress_on_list(const GList *imgs)
+// images compressed per transaction
+#define DT_HISTORY_COMPRESS_CHUNK 64
+
+// renumber the compressed history of imgid from 0 without gaps, returns the number of items
+static int _history_renumber(const int32_t imgid)
 {
-  int uncompressed=0;
-  for(const GList *l = imgs; l; l = g_list_next(l))
+  sqlite3_stmt *stmt;
+  GArray *nums = g_array_new(FALSE, FALSE, sizeof(int));
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+    "SELECT num FROM main.history WHERE imgid=?1 ORDER BY num", &stmt);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
   {
-    const int imgid = GPOINTER_TO_INT(l->data);
-    dt_lock_image(imgid);
-    const int test = dt_history_end_attop(imgid);
+    const int num = sqlite3_column_int(stmt, 0);
+    g_array_append_val(nums, num);
+  }
+  dt_database_release_cached(darktable.db, stmt);
+
+  // nums are ascending, so a new num never collides with one still to be moved
+  const int size = nums->len;
+  for(int done = 0; done < size; done++)
+  {
+    const int index = g_array_index(nums, int, done);
+    if(index == done) continue;
+    // step by step set the correct num
+    DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+      "UPDATE main.history SET num = ?3 WHERE imgid = ?1 AND num = ?2", &stmt);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, index);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 3, done);
+    sqlite3_step(stmt);
+    dt_database_release_cached(darktable.db, stmt);
+  }
+  g_array_free(nums, TRUE);
+  return size;
+}
+
+int dt_history_compress_on_list_ext(const GList *imgs, dt_job_t *job)
+{
+  int uncompressed = 0;
+  const guint total = g_list_length((GList *)imgs);
+  guint count = 0;
+  const double start = dt_get_wtime();
 
-    if (test == 1) // we do a compression and we know for sure history_end is at the top!
+  const GList *l = imgs;
+  while(l && !(job && dt_control_job_get_state(job) == DT_JOB_STATE_CANCELLED))
+  {
+    GList *compressed = NULL;
+    GList *chunk = NULL;
+    for(int k = 0; l && k < DT_HISTORY_COMPRESS_CHUNK; k++, l = g_list_next(l), count++)
+      chunk = g_list_prepend(chunk, l->data);
+    chunk = g_list_reverse(chunk);
+
+    // image stripes before the transaction, like everyone else
+    const uint64_t stripes = _history_lock_images(GPOINTER_TO_INT(chunk->data), chunk);
+    dt_database_start_transaction(darktable.db);
+
+    for(const GList *c = chunk; c; c = g_list_next(c))
     {
-      dt_history_set_compress_problem(imgid, FALSE);
-      dt_history_compress_on_image(imgid);
-      // now the modules are in right order but need renumbering to remove leaks
-      int max=0;    // the maximum num in main_history for an image
-      int size=0;   // the number of items in main_history for an image
-      int done=0;   // used for renumbering index
-      sqlite3_stmt *stmt2;
-      // get highest num in history
-      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-        "SELECT MAX(num) FROM main.history WHERE imgid=?1", -1, &stmt2, NULL);
-      DT_DEBUG_SQLITE3_BIND_INT(stmt2, 1, imgid);
-
-      if (sqlite3_step(stmt2) == SQLITE_ROW)
-        max = sqlite3_column_int(stmt2, 0);
-
-      sqlite3_finalize(stmt2);
-      // get number of items in main.history
-      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-        "SELECT COUNT(*) FROM main.history WHERE imgid = ?1", -1, &stmt2, NULL);
-      DT_DEBUG_SQLITE3_BIND_INT(stmt2, 1, imgid);
-
-      if(sqlite3_step(stmt2) == SQLITE_ROW)
-        size = sqlite3_column_int(stmt2, 0);
-
-      sqlite3_finalize(stmt2);
-
-      if ((size>0) && (max>0))
+      const int imgid = GPOINTER_TO_INT(c->data);
+      const int test = dt_history_end_attop(imgid);
+
+      if (test == 1) // we do a compression and we know for sure history_end is at the top!
       {
-        for (int index=0;index<(max+1);index++)
-        {
-          sqlite3_stmt *stmt3;
-          DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-            "SELECT num FROM main.history WHERE imgid=?1 AND num=?2", -1, &stmt3, NULL);
-          DT_DEBUG_SQLITE3_BIND_INT(stmt3, 1, imgid);
-          DT_DEBUG_SQLITE3_BIND_INT(stmt3, 2, index);
+        dt_history_set_compress_problem(imgid, FALSE);
+        _history_compress_on_image(imgid, _history_get_end(imgid));
+        // now the modules are in right order but need renumbering to remove leaks
+        const int done = _history_renumber(imgid);
+        // update history end
+        sqlite3_stmt *stmt;
+        DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+          "UPDATE main.images SET history_end = ?2 WHERE id = ?1", &stmt);
+        DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+        DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, done);
+        sqlite3_step(stmt);
+        dt_database_release_cached(darktable.db, stmt);
+
+        compressed = g_list_prepend(compressed, GINT_TO_POINTER(imgid));
+      }
 
-          if (sqlite3_step(stmt3) == SQLITE_ROW)
-          {
-            sqlite3_stmt *stmt4;
-            // step by step set the correct num
-            DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-              "UPDATE main.history SET num = ?3 WHERE imgid = ?1 AND num = ?2", -1, &stmt4, NULL);
-            DT_DEBUG_SQLITE3_BIND_INT(stmt4, 1, imgid);
-            DT_DEBUG_SQLITE3_BIND_INT(stmt4, 2, index);
-            DT_DEBUG_SQLITE3_BIND_INT(stmt4, 3, done);
-            sqlite3_step(stmt4);
-            sqlite3_finalize(stmt4);
-            done++;
-          }
-          sqlite3_finalize(stmt3);
-        }
+      if (test == 0) // no compression as history_end is right in the middle of history
+      {
+        uncompressed++;
+        dt_history_set_compress_problem(imgid, TRUE);
       }
-      // update history end
-      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-        "UPDATE main.images SET history_end = ?2 WHERE id = ?1", -1, &stmt2, NULL);
-      DT_DEBUG_SQLITE3_BIND_INT(stmt2, 1, imgid);
-      DT_DEBUG_SQLITE3_BIND_INT(stmt2, 2, done);
-      sqlite3_step(stmt2);
-      sqlite3_finalize(stmt2);
-
-      dt_image_write_sidecar_file(imgid);
-    }
 
-    if (test == 0) // no compression as history_end is right in the middle of history
-    {
-      uncompressed++;
-      dt_history_set_compress_problem(imgid, TRUE);
+      if (test == -1)
+        dt_history_set_compress_problem(imgid, FALSE);
+
+      dt_history_hash_write_from_history(imgid, DT_HISTORY_HASH_CURRENT);
     }
 
-    if (test == -1)
-      dt_history_set_compress_problem(imgid, FALSE);
+    dt_database_release_transaction(darktable.db);
+    _history_unlock_images(stripes);
+    g_list_free(chunk);
 
-    dt_unlock_image(imgid);
-    dt_history_hash_write_from_history(imgid, DT_HISTORY_HASH_CURRENT);
+    // the sidecars and the thumbnails follow once the chunk is committed
+    compressed = g_list_reverse(compressed);
+    dt_image_synch_xmps(compressed);
+    for(const GList *c = compressed; c; c = g_list_next(c))
+      dt_control_signal_raise(darktable.signals, DT_SIGNAL_DEVELOP_MIPMAP_UPDATED, GPOINTER_TO_INT(c->data));
+    g_list_free(compressed);
+
+    if(job) dt_control_job_set_progress(job, (double)count / total);
   }
 
+  dt_print(DT_DEBUG_PERF, "[history] compressed the history of %u images in %.3f secs\n", count,
+           dt_get_wtime() - start);
+
   return uncompressed;
 }
 
+int dt_history_compress_on_list(const GList *imgs)
+{
+  return dt_history_compress_on_list_ext(imgs, NULL);
+}
+
 gboolean dt_history_check_module_exists(int32_t imgid, const char *operation)
 {
   dt_lock_image(imgid);
@@ -1241,28 +1537,17 @@ static gsize _history_hash_compute_from_db(const int32_t imgid, guint8 **hash)
   GChecksum *checksum = g_checksum_new(G_CHECKSUM_MD5);
   gsize hash_len = 0;
   sqlite3_stmt *stmt;
-  // get history end
-  int history_end = 0;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT history_end FROM main.images WHERE id = ?1",
-                              -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-
-  if(sqlite3_step(stmt) == SQLITE_ROW)
-    if(sqlite3_column_type(stmt, 0) != SQLITE_NULL)
-      history_end = sqlite3_column_int(stmt, 0);
-
-  sqlite3_finalize(stmt);
-  // get history
+  // get history, up to history end. this runs for every image on import and sidecar
+  // synchronisation, keep the statements prepared.
   gboolean history_on = FALSE;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT operation, op_params, blendop_params"
-                              " FROM main.history"
-                              " WHERE imgid = ?1 AND enabled = 1 AND num <= ?2"
-                              " ORDER BY num",
-                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+                                  "SELECT operation, op_params, blendop_params"
+                                  " FROM main.history"
+                                  " WHERE imgid = ?1 AND enabled = 1"
+                                  "   AND num <= (SELECT IFNULL(history_end, 0) FROM main.images WHERE id = ?1)"
+                                  " ORDER BY num",
+                                  &stmt);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, history_end);
 
   while(sqlite3_step(stmt) == SQLITE_ROW)
   {
@@ -1286,16 +1571,16 @@ static gsize _history_hash_compute_from_db(const int32_t imgid, guint8 **hash)
 
     history_on = TRUE;
   }
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
 
   if(history_on)
   {
     // get module order
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "SELECT version, iop_list"
-                                " FROM main.module_order"
-                                " WHERE imgid = ?1",
-                                -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+                                    "SELECT version, iop_list"
+                                    " FROM main.module_order"
+                                    " WHERE imgid = ?1",
+                                    &stmt);
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
     if(sqlite3_step(stmt) == SQLITE_ROW)
     {
@@ -1310,7 +1595,7 @@ static gsize _history_hash_compute_from_db(const int32_t imgid, guint8 **hash)
       }
     }
 
-    sqlite3_finalize(stmt);
+    dt_database_release_cached(darktable.db, stmt);
     const gsize checksum_len = g_checksum_type_get_length(G_CHECKSUM_MD5);
     *hash = g_malloc(checksum_len);
     hash_len = checksum_len;
@@ -1458,19 +1743,18 @@ gboolean dt_history_hash_is_mipmap_synced(const int32_t imgid)
   gboolean status = FALSE;
   if(imgid == -1) return status;
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT CASE"
-                              "  WHEN mipmap_hash == current_hash THEN 1"
-                              "  ELSE 0 END AS status"
-                              " FROM main.history_hash"
-                              " WHERE imgid = ?1",
-                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+                                  "SELECT CASE"
+                                  "  WHEN mipmap_hash == current_hash THEN 1"
+                                  "  ELSE 0 END AS status"
+                                  " FROM main.history_hash"
+                                  " WHERE imgid = ?1", &stmt);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
 
   if(sqlite3_step(stmt) == SQLITE_ROW)
     status = sqlite3_column_int(stmt, 0);
 
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
   return status;
 }
 
@@ -1480,14 +1764,13 @@ void dt_history_hash_set_mipmap(const int32_t imgid)
     return;
 
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "UPDATE main.history_hash"
-                              " SET mipmap_hash = current_hash"
-                              " WHERE imgid = ?1",
-                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+                                  "UPDATE main.history_hash"
+                                  " SET mipmap_hash = current_hash"
+                                  " WHERE imgid = ?1", &stmt);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
 }
 
 dt_history_hash_t dt_history_hash_get_status(const int32_t imgid)
@@ -1570,15 +1853,10 @@ gboolean dt_history_paste_on_list(const GList *list, gboolean undo)
   if(undo)
     dt_undo_start_group(darktable.undo, DT_UNDO_LT_HISTORY);
 
-  for(GList *l = (GList *)list; l; l = g_list_next(l))
-  {
-    const int dest = GPOINTER_TO_INT(l->data);
-    dt_history_copy_and_paste_on_image(darktable.view_manager->copy_paste.copied_imageid,
-                                       dest, merge,
-                                       darktable.view_manager->copy_paste.selops,
-                                       darktable.view_manager->copy_paste.copy_iop_order,
-                                       darktable.view_manager->copy_paste.full_copy);
-  }
+  _history_paste_on_list(darktable.view_manager->copy_paste.copied_imageid, list, merge,
+                         darktable.view_manager->copy_paste.selops,
+                         darktable.view_manager->copy_paste.copy_iop_order,
+                         darktable.view_manager->copy_paste.full_copy);
 
   if(undo)
     dt_undo_end_group(darktable.undo);
@@ -1615,15 +1893,10 @@ gboolean dt_history_paste_parts_on_list(const GList *list, gboolean undo)
   if(undo)
     dt_undo_start_group(darktable.undo, DT_UNDO_LT_HISTORY);
     
-  for (const GList *l = l_copy; l; l = g_list_next(l))
-  {
-    const int dest = GPOINTER_TO_INT(l->data);
-    dt_history_copy_and_paste_on_image(darktable.view_manager->copy_paste.copied_imageid,
-                                       dest, merge,
-                                       darktable.view_manager->copy_paste.selops,
-                                       darktable.view_manager->copy_paste.copy_iop_order,
-                                       darktable.view_manager->copy_paste.full_copy);
-  }
+  _history_paste_on_list(darktable.view_manager->copy_paste.copied_imageid, l_copy, merge,
+                         darktable.view_manager->copy_paste.selops,
+                         darktable.view_manager->copy_paste.copy_iop_order,
+                         darktable.view_manager->copy_paste.full_copy);
 
   if(undo)
     dt_undo_end_group(darktable.undo);
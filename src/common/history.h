@@ -25,6 +25,7 @@
 
 struct dt_develop_t;
 struct dt_iop_module_t;
+struct _dt_job_t;
 
 // history hash is designed to detect any change made on the image
 // if current = basic the image has only the mandatory modules with their original settings
@@ -98,6 +99,8 @@ gboolean dt_history_delete_on_list(const GList *list, gboolean undo);
 
 /** compress history stack */
 int dt_history_compress_on_list(const GList *imgs);
+/** compress history stack, chunk by chunk, reporting progress and honouring cancellation of job (may be NULL) */
+int dt_history_compress_on_list_ext(const GList *imgs, struct _dt_job_t *job);
 void dt_history_compress_on_image(const int32_t imgid);
 
 /** truncate history stack */
@@ -57,7 +57,7 @@ void dt_history_snapshot_undo_create(int32_t imgid, int *snap_id, int *history_e
 
   sqlite3_finalize(stmt);
 
-  sqlite3_exec(dt_database_get(darktable.db), "BEGIN TRANSACTION", NULL, NULL, NULL);
+  dt_database_start_transaction(darktable.db);
 
   if(*history_end == 0)
   {
@@ -108,9 +108,9 @@ void dt_history_snapshot_undo_create(int32_t imgid, int *snap_id, int *history_e
   sqlite3_finalize(stmt);
 
   if(all_ok)
-    sqlite3_exec(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
+    dt_database_release_transaction(darktable.db);
   else
-    sqlite3_exec(dt_database_get(darktable.db), "ROLLBACK_TRANSACTION", NULL, NULL, NULL);
+    dt_database_rollback_transaction(darktable.db);
 
   dt_unlock_image(imgid);
 }
@@ -122,7 +122,7 @@ static void _history_snapshot_undo_restore(int32_t imgid, int snap_id, int histo
   gboolean all_ok = TRUE;
   dt_lock_image(imgid);
 
-  sqlite3_exec(dt_database_get(darktable.db), "BEGIN TRANSACTION", NULL, NULL, NULL);
+  dt_database_start_transaction(darktable.db);
   dt_history_delete_on_image_ext(imgid, FALSE);
   dt_control_signal_raise(darktable.signals, DT_SIGNAL_TAG_CHANGED);
 
@@ -174,9 +174,9 @@ static void _history_snapshot_undo_restore(int32_t imgid, int snap_id, int histo
   sqlite3_finalize(stmt);
 
   if(all_ok)
-    sqlite3_exec(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
+    dt_database_release_transaction(darktable.db);
   else
-    sqlite3_exec(dt_database_get(darktable.db), "ROLLBACK_TRANSACTION", NULL, NULL, NULL);
+    dt_database_rollback_transaction(darktable.db);
 
   dt_unlock_image(imgid);
 }
@@ -350,6 +350,97 @@ void dt_image_reset_final_size(const int32_t imgid)
   dt_image_t *imgtmp = dt_image_cache_get(darktable.image_cache, imgid, 'w');
   imgtmp->final_width = imgtmp->final_height = 0;
   dt_image_cache_write_release(darktable.image_cache, imgtmp, DT_IMAGE_CACHE_RELAXED);
+
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "UPDATE main.images SET output_width = 0, output_height = 0 WHERE id = ?1",
+                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+}
+
+// the final size stored in the database is valid as long as the history hash
+// did not change since it was computed. images without a history hash row have
+// nothing to compare with (their size depends on auto-presets and module defaults),
+// they are always computed again.
+static gboolean _image_get_stored_final_size(const int32_t imgid, int *width, int *height)
+{
+  gboolean found = FALSE;
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT i.output_width, i.output_height"
+                              " FROM main.images AS i"
+                              " JOIN main.history_hash AS h ON h.imgid = i.id"
+                              " WHERE i.id = ?1 AND i.output_width > 0 AND i.output_height > 0"
+                              "   AND h.final_size_hash = h.current_hash",
+                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  if(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    *width = sqlite3_column_int(stmt, 0);
+    *height = sqlite3_column_int(stmt, 1);
+    found = TRUE;
+  }
+  sqlite3_finalize(stmt);
+  return found;
+}
+
+// the history hash the final size is computed for. returns FALSE if the image has no history hash row
+static gboolean _image_get_current_hash(const int32_t imgid, void **hash, int *hash_len)
+{
+  gboolean found = FALSE;
+  *hash = NULL;
+  *hash_len = 0;
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT current_hash FROM main.history_hash WHERE imgid = ?1",
+                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  if(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    const void *buf = sqlite3_column_blob(stmt, 0);
+    *hash_len = sqlite3_column_bytes(stmt, 0);
+    if(buf)
+    {
+      *hash = malloc(*hash_len);
+      memcpy(*hash, buf, *hash_len);
+    }
+    found = TRUE;
+  }
+  sqlite3_finalize(stmt);
+  return found;
+}
+
+// store the size only if the history is still the one it was computed for
+static void _image_store_final_size(const int32_t imgid, const int width, const int height,
+                                    const gboolean has_hash, const void *hash, const int hash_len)
+{
+  sqlite3_stmt *stmt;
+  // without a hash (or a NULL one) there is nothing to validate the size against later, don't cache it
+  if(!has_hash || !hash) return;
+
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "UPDATE main.images SET output_width = ?2, output_height = ?3"
+                              " WHERE id = ?1"
+                              "   AND EXISTS (SELECT 1 FROM main.history_hash WHERE imgid = ?1 AND current_hash = ?4)",
+                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, width);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 3, height);
+  DT_DEBUG_SQLITE3_BIND_BLOB(stmt, 4, hash, hash_len, SQLITE_TRANSIENT);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+
+  // if the history changed in between, final_size_hash stays behind and the size above is ignored
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "UPDATE main.history_hash SET final_size_hash = current_hash"
+                              " WHERE imgid = ?1 AND current_hash = ?2",
+                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  DT_DEBUG_SQLITE3_BIND_BLOB(stmt, 2, hash, hash_len, SQLITE_TRANSIENT);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
 }
 
 gboolean dt_image_get_final_size(const int32_t imgid, int *width, int *height)
@@ -365,12 +456,29 @@ gboolean dt_image_get_final_size(const int32_t imgid, int *width, int *height)
     *height = img.final_height;
     return 0;
   }
+
+  // or if they were computed for the current history in an earlier session
+  int wd = 0, ht = 0;
+  if(_image_get_stored_final_size(imgid, &wd, &ht))
+  {
+    imgtmp = dt_image_cache_get(darktable.image_cache, imgid, 'w');
+    imgtmp->final_width = *width = wd;
+    imgtmp->final_height = *height = ht;
+    dt_image_cache_write_release(darktable.image_cache, imgtmp, DT_IMAGE_CACHE_RELAXED);
+    return 0;
+  }
+  // remember the history the size is computed for, it might change meanwhile
+  void *hash = NULL;
+  int hash_len = 0;
+  const gboolean has_hash = _image_get_current_hash(imgid, &hash, &hash_len);
+
   // and now we can do the pipe stuff to get final image size
   dt_develop_t dev;
   dt_dev_init(&dev, 0);
   dt_dev_load_image(&dev, imgid);
   dt_dev_pixelpipe_t pipe;
-  int wd = img.width, ht = img.height;
+  wd = img.width;
+  ht = img.height;
   int res = dt_dev_pixelpipe_init_dummy(&pipe, wd, ht);
 
   if(res)
@@ -392,6 +500,8 @@ gboolean dt_image_get_final_size(const int32_t imgid, int *width, int *height)
   imgtmp->final_width = *width = wd;
   imgtmp->final_height = *height = ht;
   dt_image_cache_write_release(darktable.image_cache, imgtmp, DT_IMAGE_CACHE_RELAXED);
+  if(res) _image_store_final_size(imgid, wd, ht, has_hash, hash, hash_len);
+  free(hash);
   return res;
 }
 
@@ -677,7 +787,7 @@ int32_t _image_duplicate_with_version(const int32_t imgid, const int32_t newvers
      "   position, aspect_ratio, exposure_bias, import_timestamp)"
      " SELECT NULL, group_id, film_id, width, height, filename, maker, model, lens,"
      "       exposure, aperture, iso, focal_length, focus_distance, datetime_taken,"
-     "       flags, width, height, crop, raw_parameters, raw_denoise_threshold,"
+     "       flags, 0, 0, crop, raw_parameters, raw_denoise_threshold,"
      "       raw_auto_bright_threshold, raw_black, raw_maximum,"
      "       license, sha1sum, orientation, histogram, lightmap,"
      "       longitude, latitude, altitude, color_matrix, colorspace, NULL, NULL, 0, ?1,"
@@ -1355,6 +1465,9 @@ void dt_image_refresh_makermodel(dt_image_t *img)
 
 int32_t dt_image_rename(const int32_t imgid, const int32_t filmid, const gchar *newname)
 {
+  // the sidecar moves along with the image, write it if it is still pending
+  dt_image_cache_flush_sidecars(darktable.image_cache);
+
   // TODO: several places where string truncation could occur unnoticed
   int32_t result = -1;
   gchar oldimg[PATH_MAX] = { 0 };
@@ -1541,6 +1654,9 @@ int32_t dt_image_move(const int32_t imgid, const int32_t filmid)
 
 int32_t dt_image_copy_rename(const int32_t imgid, const int32_t filmid, const gchar *newname)
 {
+  // the sidecar is copied along with the image, write it if it is still pending
+  dt_image_cache_flush_sidecars(darktable.image_cache);
+
   int32_t newid = -1;
   sqlite3_stmt *stmt;
   gchar srcpath[PATH_MAX] = { 0 };
@@ -1621,7 +1737,7 @@ int32_t dt_image_copy_rename(const int32_t imgid, const int32_t filmid, const gc
          "   position, aspect_ratio, exposure_bias)"
          " SELECT NULL, group_id, ?1 as film_id, width, height, ?2 as filename, maker, model, lens,"
          "        exposure, aperture, iso, focal_length, focus_distance, datetime_taken,"
-         "        flags, width, height, crop, raw_parameters, raw_denoise_threshold,"
+         "        flags, 0, 0, crop, raw_parameters, raw_denoise_threshold,"
          "        raw_auto_bright_threshold, raw_black, raw_maximum,"
          "        license, sha1sum, orientation, histogram, lightmap,"
          "        longitude, latitude, altitude, color_matrix, colorspace, -1, -1,"
@@ -1791,6 +1907,9 @@ int32_t dt_image_copy(const int32_t imgid, const int32_t filmid)
 
 int dt_image_local_copy_set(const int32_t imgid)
 {
+  // the sidecar is copied along with the image, write it if it is still pending
+  dt_image_cache_flush_sidecars(darktable.image_cache);
+
   gchar srcpath[PATH_MAX] = { 0 };
   gchar destpath[PATH_MAX] = { 0 };
   gboolean from_cache = FALSE;
@@ -1857,6 +1976,9 @@ static int _nb_other_local_copy_for(const int32_t imgid)
 
 int dt_image_local_copy_reset(const int32_t imgid)
 {
+  // the sidecar of the local copy is synched back and removed, write it if it is still pending
+  dt_image_cache_flush_sidecars(darktable.image_cache);
+
   gchar destpath[PATH_MAX] = { 0 };
   gchar locppath[PATH_MAX] = { 0 };
   gchar cachedir[PATH_MAX] = { 0 };
@@ -1924,7 +2046,8 @@ int dt_image_local_copy_reset(const int32_t imgid)
 // xmp stuff
 // *******************************************************
 
-void dt_image_write_sidecar_file(const int32_t imgid)
+// writes the .xmp file of imgid, TRUE if it did
+static gboolean _image_write_sidecar(const int32_t imgid)
 {
   // TODO: compute hash and don't write if not needed!
   // write .xmp file
@@ -1941,42 +2064,59 @@ void dt_image_write_sidecar_file(const int32_t imgid)
       from_cache = TRUE;
       dt_image_full_path(imgid, filename, sizeof(filename), &from_cache);
       //  nothing to do, the original is not accessible and there is no local copy
-      if (!from_cache) return;
+      if (!from_cache) return FALSE;
     }
 
     dt_image_path_append_version(imgid, filename, sizeof(filename));
     g_strlcat(filename, ".xmp", sizeof(filename));
 
-    if(!dt_exif_xmp_write(imgid, filename))
-    {
-      // put the timestamp into db. this can't be done in exif.cc since that code gets called
-      // for the copy exporter, too
-      sqlite3_stmt *stmt;
-      DT_DEBUG_SQLITE3_PREPARE_V2
-        (dt_database_get(darktable.db),
-         "UPDATE main.images SET write_timestamp = STRFTIME('%s', 'now') WHERE id = ?1",
-         -1, &stmt, NULL);
-      DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-      sqlite3_step(stmt);
-      sqlite3_finalize(stmt);
-    }
+    return !dt_exif_xmp_write(imgid, filename);
   }
+  return FALSE;
 }
 
-void dt_image_synch_xmps(const GList *img)
+// put the timestamp into db. this can't be done in exif.cc since that code gets called
+// for the copy exporter, too
+static void _image_set_write_timestamp(const int32_t imgid)
 {
-  if(!img) return;
-  if(dt_conf_get_bool("write_sidecar_files"))
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2
+    (dt_database_get(darktable.db),
+     "UPDATE main.images SET write_timestamp = STRFTIME('%s', 'now') WHERE id = ?1",
+     -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+}
+
+void dt_image_write_sidecar_file(const int32_t imgid)
+{
+  if(_image_write_sidecar(imgid)) _image_set_write_timestamp(imgid);
+}
+
+// write the sidecars of imgs, then all their write timestamps in one transaction. the sidecars are written
+// outside of it, exiv2 and the image cache take their time.
+static void _image_write_sidecars(const GList *imgs)
+{
+  GList *written = NULL;
+  for(const GList *i = imgs; i; i = g_list_next(i))
+    if(_image_write_sidecar(GPOINTER_TO_INT(i->data))) written = g_list_prepend(written, i->data);
+
+  if(written)
   {
-    const GList *imgs = img;
-    while(imgs)
-    {
-      dt_image_write_sidecar_file(GPOINTER_TO_INT(imgs->data));
-      imgs = g_list_next(imgs);
-    }
+    dt_database_start_transaction(darktable.db);
+    for(const GList *i = written; i; i = g_list_next(i)) _image_set_write_timestamp(GPOINTER_TO_INT(i->data));
+    dt_database_release_transaction(darktable.db);
+    g_list_free(written);
   }
 }
 
+void dt_image_synch_xmps(const GList *img)
+{
+  if(!img) return;
+  if(dt_conf_get_bool("write_sidecar_files")) _image_write_sidecars(img);
+}
+
 void dt_image_synch_xmp(const int selected)
 {
   if(selected > 0)
@@ -2025,22 +2165,24 @@ void dt_image_local_copy_synch(void)
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT id FROM main.images WHERE flags&?1=?1", -1,
                               &stmt, NULL);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, DT_IMAGE_LOCAL_COPY);
-  int count = 0;
-
+  GList *imgs = NULL;
   while(sqlite3_step(stmt) == SQLITE_ROW)
+    imgs = g_list_prepend(imgs, GINT_TO_POINTER(sqlite3_column_int(stmt, 0)));
+  sqlite3_finalize(stmt);
+
+  GList *present = NULL;
+  for(const GList *i = imgs; i; i = g_list_next(i))
   {
-    const int32_t imgid = sqlite3_column_int(stmt, 0);
     gboolean from_cache = FALSE;
     char filename[PATH_MAX] = { 0 };
-    dt_image_full_path(imgid, filename, sizeof(filename), &from_cache);
-
-    if(g_file_test(filename, G_FILE_TEST_EXISTS))
-    {
-      dt_image_write_sidecar_file(imgid);
-      count++;
-    }
+    dt_image_full_path(GPOINTER_TO_INT(i->data), filename, sizeof(filename), &from_cache);
+    if(g_file_test(filename, G_FILE_TEST_EXISTS)) present = g_list_prepend(present, i->data);
   }
-  sqlite3_finalize(stmt);
+  g_list_free(imgs);
+
+  const int count = g_list_length(present);
+  _image_write_sidecars(present);
+  g_list_free(present);
 
   if(count > 0)
     dt_control_log(ngettext("%d local copy has been synchronized",
@@ -27,6 +27,9 @@
 #include <sqlite3.h>
 #include <inttypes.h>
 
+// longest time a changed image waits for its sidecar to be written, in microseconds
+#define DT_IMAGE_CACHE_SIDECAR_DELAY (G_USEC_PER_SEC / 2)
+
 void dt_image_cache_allocate(void *data, dt_cache_entry_t *entry)
 {
   entry->cost = sizeof(dt_image_t);
@@ -36,15 +39,14 @@ void dt_image_cache_allocate(void *data, dt_cache_entry_t *entry)
   entry->data = img;
   // load stuff from db and store in cache:
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(
-      dt_database_get(darktable.db),
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(
+      darktable.db,
       "SELECT id, group_id, film_id, width, height, filename, maker, model, lens, exposure, "
       "aperture, iso, focal_length, datetime_taken, flags, crop, orientation, focus_distance, "
       "raw_parameters, longitude, latitude, altitude, color_matrix, colorspace, version, raw_black, "
       "raw_maximum, aspect_ratio, exposure_bias, "
       "import_timestamp, change_timestamp, export_timestamp, print_timestamp "
-      "FROM main.images WHERE id = ?1",
-      -1, &stmt, NULL);
+      "FROM main.images WHERE id = ?1", &stmt);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, entry->key);
   if(sqlite3_step(stmt) == SQLITE_ROW)
   {
@@ -153,7 +155,7 @@ void dt_image_cache_allocate(void *data, dt_cache_entry_t *entry)
     fprintf(stderr, "[image_cache_allocate] failed to open image %" PRIu32 " from database: %s\n", entry->key,
             sqlite3_errmsg(dt_database_get(darktable.db)));
   }
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
   img->cache_entry = entry; // init backref
   // could downgrade lock write->read on entry->lock if we were using concurrencykit..
   dt_image_refresh_makermodel(img);
@@ -166,6 +168,75 @@ void dt_image_cache_deallocate(void *data, dt_cache_entry_t *entry)
   g_free(img);
 }
 
+// writes the pending sidecars, called and returns with sidecar_mutex held
+static void _image_cache_write_sidecars(dt_image_cache_t *cache)
+{
+  GHashTable *pending = cache->sidecar_pending;
+  if(g_hash_table_size(pending) == 0) return;
+
+  cache->sidecar_pending = g_hash_table_new(NULL, NULL);
+  cache->sidecar_busy++;
+  g_mutex_unlock(&cache->sidecar_mutex);
+
+  GHashTableIter iter;
+  gpointer key;
+  g_hash_table_iter_init(&iter, pending);
+  while(g_hash_table_iter_next(&iter, &key, NULL))
+    dt_image_write_sidecar_file(GPOINTER_TO_INT(key));
+  g_hash_table_destroy(pending);
+
+  g_mutex_lock(&cache->sidecar_mutex);
+  cache->sidecar_busy--;
+  g_cond_broadcast(&cache->sidecar_cond);
+}
+
+static void *_image_cache_sidecar_writer(void *data)
+{
+  dt_image_cache_t *cache = (dt_image_cache_t *)data;
+  dt_pthread_setname("sidecar writer");
+
+  g_mutex_lock(&cache->sidecar_mutex);
+  while(!cache->sidecar_quit)
+  {
+    if(g_hash_table_size(cache->sidecar_pending) == 0)
+      g_cond_wait(&cache->sidecar_cond, &cache->sidecar_mutex);
+    // let further changes to the same images pile up until the oldest one is due
+    else if(g_get_monotonic_time() < cache->sidecar_deadline)
+      g_cond_wait_until(&cache->sidecar_cond, &cache->sidecar_mutex, cache->sidecar_deadline);
+    else
+      _image_cache_write_sidecars(cache);
+  }
+  g_mutex_unlock(&cache->sidecar_mutex);
+  return NULL;
+}
+
+static void _image_cache_schedule_sidecar(dt_image_cache_t *cache, const int32_t imgid)
+{
+  g_mutex_lock(&cache->sidecar_mutex);
+  if(cache->sidecar_quit)
+  {
+    // no writer (any more)
+    g_mutex_unlock(&cache->sidecar_mutex);
+    dt_image_write_sidecar_file(imgid);
+    return;
+  }
+  if(g_hash_table_size(cache->sidecar_pending) == 0)
+  {
+    cache->sidecar_deadline = g_get_monotonic_time() + DT_IMAGE_CACHE_SIDECAR_DELAY;
+    g_cond_broadcast(&cache->sidecar_cond);
+  }
+  g_hash_table_add(cache->sidecar_pending, GINT_TO_POINTER(imgid));
+  g_mutex_unlock(&cache->sidecar_mutex);
+}
+
+void dt_image_cache_flush_sidecars(dt_image_cache_t *cache)
+{
+  g_mutex_lock(&cache->sidecar_mutex);
+  _image_cache_write_sidecars(cache);
+  while(cache->sidecar_busy) g_cond_wait(&cache->sidecar_cond, &cache->sidecar_mutex);
+  g_mutex_unlock(&cache->sidecar_mutex);
+}
+
 void dt_image_cache_init(dt_image_cache_t *cache)
 {
   // the image cache does no serialization.
@@ -180,11 +251,31 @@ void dt_image_cache_init(dt_image_cache_t *cache)
   dt_cache_set_allocate_callback(&cache->cache, &dt_image_cache_allocate, cache);
   dt_cache_set_cleanup_callback(&cache->cache, &dt_image_cache_deallocate, cache);
 
+  cache->sidecar_pending = g_hash_table_new(NULL, NULL);
+  g_mutex_init(&cache->sidecar_mutex);
+  g_cond_init(&cache->sidecar_cond);
+  // without a writer, sidecars are written right away
+  if(dt_pthread_create(&cache->sidecar_thread, _image_cache_sidecar_writer, cache))
+    cache->sidecar_quit = TRUE;
+
   dt_print(DT_DEBUG_CACHE, "[image_cache] has %d entries\n", num);
 }
 
 void dt_image_cache_cleanup(dt_image_cache_t *cache)
 {
+  // stop the writer and write whatever it left behind
+  g_mutex_lock(&cache->sidecar_mutex);
+  const gboolean running = !cache->sidecar_quit;
+  cache->sidecar_quit = TRUE;
+  g_cond_broadcast(&cache->sidecar_cond);
+  g_mutex_unlock(&cache->sidecar_mutex);
+  if(running) pthread_join(cache->sidecar_thread, NULL);
+  dt_image_cache_flush_sidecars(cache);
+
+  g_hash_table_destroy(cache->sidecar_pending);
+  g_cond_clear(&cache->sidecar_cond);
+  g_mutex_clear(&cache->sidecar_mutex);
+
   dt_cache_cleanup(&cache->cache);
 }
 
@@ -226,7 +317,7 @@ void dt_image_cache_read_release(dt_image_cache_t *cache, const dt_image_t *img)
 
 // drops the write privileges on an image struct.
 // this triggers a write-through to sql, and if the setting
-// is present, also to xmp sidecar files (safe setting).
+// is present, also schedules the xmp sidecar file (safe setting).
 void dt_image_cache_write_release(dt_image_cache_t *cache, dt_image_t *img, dt_image_cache_write_mode_t mode)
 {
   union {
@@ -243,8 +334,8 @@ void dt_image_cache_write_release(dt_image_cache_t *cache, dt_image_t *img, dt_i
   if(img->id <= 0) return;
 
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(
-      dt_database_get(darktable.db),
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(
+      darktable.db,
       "UPDATE main.images SET width = ?1, height = ?2, filename = ?3, maker = ?4, model = ?5, "
       "lens = ?6, exposure = ?7, aperture = ?8, iso = ?9, focal_length = ?10, "
       "focus_distance = ?11, film_id = ?12, datetime_taken = ?13, flags = ?14, "
@@ -252,8 +343,7 @@ void dt_image_cache_write_release(dt_image_cache_t *cache, dt_image_t *img, dt_i
       "latitude = ?20, altitude = ?21, color_matrix = ?22, colorspace = ?23, raw_black = ?24, "
       "raw_maximum = ?25, aspect_ratio = ROUND(?26,1), exposure_bias = ?27, "
       "import_timestamp = ?28, change_timestamp = ?29, export_timestamp = ?30, print_timestamp = ?31 "
-      "WHERE id = ?32",
-      -1, &stmt, NULL);
+      "WHERE id = ?32", &stmt);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, img->width);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, img->height);
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 3, img->filename, -1, SQLITE_STATIC);
@@ -289,14 +379,14 @@ void dt_image_cache_write_release(dt_image_cache_t *cache, dt_image_t *img, dt_i
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 32, img->id);
   const int rc = sqlite3_step(stmt);
   if(rc != SQLITE_DONE) fprintf(stderr, "[image_cache_write_release] sqlite3 error %d\n", rc);
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
 
   // TODO: make this work in relaxed mode, too.
   if(mode == DT_IMAGE_CACHE_SAFE)
   {
     // rest about sidecars:
-    // also synch dttags file:
-    dt_image_write_sidecar_file(img->id);
+    // also synch dttags file, in the background:
+    _image_cache_schedule_sidecar(cache, img->id);
   }
   dt_cache_release(&cache->cache, img->cache_entry);
 }
@@ -24,6 +24,16 @@
 typedef struct dt_image_cache_t
 {
   dt_cache_t cache;
+
+  // sidecar files waiting to be written by the background writer,
+  // keyed by image id. all of these are protected by sidecar_mutex.
+  GHashTable *sidecar_pending;
+  GMutex sidecar_mutex;
+  GCond sidecar_cond;
+  pthread_t sidecar_thread;
+  gint64 sidecar_deadline; // monotonic time the oldest pending sidecar has to be written by
+  int sidecar_busy;        // sidecars currently being written outside of the lock
+  gboolean sidecar_quit;
 }
 dt_image_cache_t;
 
@@ -60,9 +70,15 @@ void dt_image_cache_read_release(dt_image_cache_t *cache, const dt_image_t *img)
 
 // drops the write privileges on an image struct.
 // this triggers a write-through to sql, and if the setting
-// is present, also to xmp sidecar files (safe setting).
+// is present, also schedules the xmp sidecar file to be written (safe setting).
+// sidecars are written in the background, at most once per image
+// within a short delay.
 void dt_image_cache_write_release(dt_image_cache_t *cache, dt_image_t *img, dt_image_cache_write_mode_t mode);
 
+// writes all scheduled sidecar files now and waits for the ones in flight.
+// call before moving, copying or deleting sidecars on disk.
+void dt_image_cache_flush_sidecars(dt_image_cache_t *cache);
+
 // remove the image from the cache
 void dt_image_cache_remove(dt_image_cache_t *cache, const int32_t imgid);
 
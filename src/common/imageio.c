@@ -25,6 +25,7 @@
 #include "common/exif.h"
 #include "common/image_cache.h"
 #include "common/imageio.h"
+#include "common/imageio_encoder.h"
 #include "common/imageio_module.h"
 #ifdef HAVE_OPENJPEG
 #include "common/imageio_j2k.h"
@@ -641,6 +642,158 @@ int dt_imageio_export(const int32_t imgid, const char *filename, dt_imageio_modu
                                         storage, storage_params, num, total, metadata);
 }
 
+// color channels of the processed image. gray pipes carry L in the first channel, gamma spreads
+// it over rgb and reports 4 colors, so look at the last module that ran before it.
+static int _export_pipe_channels(const dt_dev_pixelpipe_t *pipe)
+{
+  for(const GList *nodes = g_list_last(pipe->nodes); nodes; nodes = g_list_previous(nodes))
+  {
+    const dt_dev_pixelpipe_iop_t *node = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    if(node->enabled && strcmp(node->module->op, "gamma"))
+      return node->colors == 1 ? 1 : 3;
+  }
+  return 3;
+}
+
+// interleaved gradient noise in [0,1): stateless, so rows can be dithered in parallel, and with
+// little low frequency energy, it breaks up banding in smooth gradients without visible grain.
+static inline float _dither_noise(const size_t x, const size_t y)
+{
+  const float f = 0.06711056f * x + 0.00583715f * y;
+  const float g = 52.9829189f * (f - floorf(f));
+  return g - floorf(g);
+}
+
+// float rgba to 8 or 16 bit integers, out of place so the rows can be converted in parallel.
+// bch == 1 is spread over rgb, or kept in the first channel alone for gray writers.
+// 8-bit output is rgb, or bgr in display byteorder, and may be dithered.
+static void _export_quantize(const float *const in, void *const out, const size_t width, const size_t height,
+                             const int bpp, const int bch, const gboolean gray, const gboolean display_byteorder,
+                             const gboolean dither)
+{
+  const int r = display_byteorder ? 2 : 0;
+  const int b = 2 - r;
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(in, out, width, height, bpp, bch, gray, r, b, dither) \
+  schedule(static)
+#endif
+  for(size_t j = 0; j < height; j++)
+  {
+    const float *const row = in + (size_t)4 * width * j;
+
+    if(bpp == 8)
+    {
+      uint8_t *const out8 = (uint8_t *)out + (size_t)4 * width * j;
+      for(size_t i = 0; i < width; i++)
+      {
+        const float *const px = row + 4 * i;
+        uint8_t *const o = out8 + 4 * i;
+        // truncating x * 0xff + u, u uniform in [0,1), keeps the mean of x * 0xff
+        const float n = dither ? _dither_noise(i, j) : 0.0f;
+
+        if(bch == 3)
+        {
+          o[r] = CLAMP(px[0] * 0xff + n, 0, 0xff);
+          o[1] = CLAMP(px[1] * 0xff + n, 0, 0xff);
+          o[b] = CLAMP(px[2] * 0xff + n, 0, 0xff);
+        }
+        else if(gray)
+          o[0] = CLAMP(px[0] * 0xff + n, 0, 0xff);
+        else
+          o[0] = o[1] = o[2] = CLAMP(px[0] * 0xff + n, 0, 0xff);
+        o[3] = 0;
+      }
+    }
+    else
+    {
+      // uint16_t per color channel
+      uint16_t *const out16 = (uint16_t *)out + (size_t)4 * width * j;
+      for(size_t i = 0; i < width; i++)
+      {
+        const float *const px = row + 4 * i;
+        uint16_t *const o = out16 + 4 * i;
+
+        if(bch == 3)
+          for(int c = 0; c < 3; c++) o[c] = CLAMP(px[c] * 0x10000, 0, 0xffff);
+        else if(gray)
+          o[0] = CLAMP(px[0] * 0x10000, 0, 0xffff);
+        else
+          o[0] = o[1] = o[2] = CLAMP(px[0] * 0x10000, 0, 0xffff);
+        o[3] = 0;
+      }
+    }
+  }
+}
+
+// everything the encoder thread needs to write one processed image
+typedef struct _export_write_t
+{
+  int32_t imgid;
+  gchar *filename;
+  dt_imageio_module_format_t *format;
+  dt_imageio_module_data_t *format_params; // private copy, the caller keeps reusing its own
+  void *buf;
+  int colors;
+  uint8_t *exif;
+  int exif_len;
+  dt_colorspaces_color_profile_type_t icc_type;
+  gchar *icc_filename;
+  gboolean copy_metadata;
+  dt_export_metadata_t *metadata;
+  dt_imageio_module_storage_t *storage;
+  dt_imageio_module_data_t *storage_params;
+  int num, total;
+} _export_write_t;
+
+static int _export_write(void *data)
+{
+  _export_write_t *w = (_export_write_t *)data;
+  dt_imageio_module_format_t *format = w->format;
+
+  // the writers only look at the channel count of the pipe
+  dt_dev_pixelpipe_t pipe = { 0 };
+  pipe.colors = w->colors;
+
+  const int res = format->write_image(w->format_params, w->filename, w->buf, w->icc_type, w->icc_filename,
+                                      w->exif, w->exif_len, w->imgid, w->num, w->total, &pipe);
+  if(res)
+  {
+    fprintf(stderr, "[export_job] could not write `%s'!\n", w->filename);
+    dt_control_log(_("could not export to file `%s'!"), w->filename);
+    return res;
+  }
+
+  if(w->copy_metadata && (format->flags(w->format_params) & FORMAT_FLAGS_SUPPORT_XMP))
+    dt_exif_xmp_attach_export(w->imgid, w->filename, w->metadata);
+
+  dt_control_signal_raise(darktable.signals, DT_SIGNAL_IMAGE_EXPORT_TMPFILE, w->imgid, w->filename, format,
+                          w->format_params, w->storage, w->storage_params);
+  dt_control_log(ngettext("%d/%d exported to `%s'", "%d/%d exported to `%s'", w->num), w->num, w->total,
+                 w->filename);
+  return 0;
+}
+
+static void _export_write_free(void *data)
+{
+  _export_write_t *w = (_export_write_t *)data;
+  w->format->free_params(w->format, w->format_params);
+  dt_free_align(w->buf);
+  free(w->exif);
+  g_free(w->filename);
+  g_free(w->icc_filename);
+  free(w);
+}
+
+gboolean dt_imageio_export_in_background(dt_imageio_module_format_t *format,
+                                         dt_imageio_module_data_t *format_params)
+{
+  // stateful formats (pdf, copy) are written in order, in place
+  return dt_imageio_encoder_get_current() && strcmp(format->mime(format_params), "memory")
+         && !(format->flags(format_params) & FORMAT_FLAGS_NO_TMPFILE);
+}
+
 // internal function: to avoid exif blob reading + 8-bit byteorder flag + high-quality override
 int dt_imageio_export_with_flags(const int32_t imgid, const char *filename,
                                  dt_imageio_module_format_t *format, dt_imageio_module_data_t *format_params,
@@ -697,8 +850,6 @@ int dt_imageio_export_with_flags(const int32_t imgid, const char *filename,
   dt_dev_pixelpipe_create_nodes(&pipe, &dev);
   dt_dev_pixelpipe_synch_all(&pipe, &dev);
 
-  const int ch = pipe.colors;
-  const int bch = ch < 4 ? ch : ch - 1;
   pipe.colors = 4;
 
   if(filter)
@@ -836,10 +987,18 @@ int dt_imageio_export_with_flags(const int32_t imgid, const char *filename,
   }
 
   const int bpp = format->bpp(format_params);
+  // dithering needs the float output, gamma quantizes on its own
+  const gboolean dither = bpp == 8 && !display_byteorder && !thumbnail_export
+                          && dt_conf_get_bool("plugins/lighttable/export/dither");
   dt_get_times(&start);
 
+  int bch = 3;
+
   if(high_quality_processing)  // if high quality, downsampling deferred to end.
+  {
     dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
+    bch = _export_pipe_channels(&pipe);
+  }
   else
   {
     // else,  need to turn temporarily disable in-pipe late downsampling iop.
@@ -861,120 +1020,117 @@ int dt_imageio_export_with_flags(const int32_t imgid, const char *filename,
       finalscale->enabled = 0;
 
     // do the processing (8-bit with special treatment, to make sure we can use openmp further down):
-    if(bpp == 8)
+    if(bpp == 8 && !dither)
       dt_dev_pixelpipe_process(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
     else
       dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
 
+    bch = _export_pipe_channels(&pipe);
     if(finalscale) finalscale->enabled = 1;
   }
 
+  // formats able to write a single channel get L alone, the others rgb
+  // thumbnail and print exports pass a bare format without flags()
+  const gboolean gray = (bch == 1) && !thumbnail_export && format->flags
+                        && (format->flags(format_params) & FORMAT_FLAGS_SUPPORT_GRAY);
+
   dt_show_times(&start, thumbnail_export ? "[dev_process_thumbnail] pixel pipeline processing"
                                          : "[dev_process_export] pixel pipeline processing");
   uint8_t *outbuf = pipe.backbuf;
+  void *quantized = NULL;
 
-  // downconversion to low-precision formats:
-  if(bpp == 8)
+  // downconversion to low-precision formats, from the float output of the pipe:
+  if((bpp == 8 && (high_quality_processing || dither)) || bpp == 16)
   {
-    if(display_byteorder)
+    dt_get_times(&start);
+    quantized = dt_alloc_align(64, (size_t)4 * processed_width * processed_height * (bpp / 8));
+    if(!quantized)
     {
-      if(high_quality_processing)
-      {
-        const float *const inbuf = (float *)outbuf;
-        const size_t K = processed_width * processed_height;
-
-        for(size_t k = 0; k < (size_t)4 * K; k += 4)
-        {
-          // convert in place, this is unfortunately very serial..
-          if(bch == 3)
-          {
-            const uint8_t r = CLAMP(inbuf[k + 2] * 0xff, 0, 0xff);
-            const uint8_t g = CLAMP(inbuf[k + 1] * 0xff, 0, 0xff);
-            const uint8_t b = CLAMP(inbuf[k + 0] * 0xff, 0, 0xff);
-            outbuf[k + 0] = r;
-            outbuf[k + 1] = g;
-            outbuf[k + 2] = b;
-          }
-          else
-          {
-            const uint8_t L = CLAMP(inbuf[k] * 0xff, 0, 0xff);
-            outbuf[k + 0] = outbuf[k + 1] = outbuf[k + 2] = L;
-          }
-        }
-      }
-      // else processing output was 8-bit already, and no need to swap order
+      dt_control_log(_("failed to allocate memory for %s, please lower the threads used for export or buy more memory."),
+                     thumbnail_export ? C_("noun", "thumbnail export") : C_("noun", "export"));
+      goto error;
     }
-    else // need to flip
-    {
-      // ldr output: char
-      if(high_quality_processing)
-      {
-        const float *const inbuf = (float *)outbuf;
-        const size_t K = processed_width * processed_height;
-
-        for(size_t k = 0; k < (size_t)4 * K; k += 4)
-        {
-          // convert in place, this is unfortunately very serial..
-          if(bch == 3)
-          {
-            const uint8_t r = CLAMP(inbuf[k + 0] * 0xff, 0, 0xff);
-            const uint8_t g = CLAMP(inbuf[k + 1] * 0xff, 0, 0xff);
-            const uint8_t b = CLAMP(inbuf[k + 2] * 0xff, 0, 0xff);
-            outbuf[k + 0] = r;
-            outbuf[k + 1] = g;
-            outbuf[k + 2] = b;
-          }
-          else
-          {
-            const uint8_t L = CLAMP(inbuf[k] * 0xff, 0, 0xff);
-            outbuf[k + 0] = outbuf[k + 1] = outbuf[k + 2] = L;
-          }
-        }
-      }
-      else
-      { // !display_byteorder, need to swap:
-        uint8_t *const buf8 = pipe.backbuf;
-        const size_t K = processed_width * processed_height;
+    _export_quantize((const float *)pipe.backbuf, quantized, processed_width, processed_height, bpp, bch, gray,
+                     display_byteorder, dither);
+    outbuf = (uint8_t *)quantized;
+    dt_show_times(&start, "[export] quantizing");
+  }
+  else if(bpp == 8 && !display_byteorder && !gray)
+  {
+    // processing output was 8-bit bgr already, flip to rgb. gamma spread gray over rgb, nothing to swap then
+    uint8_t *const buf8 = pipe.backbuf;
+    const size_t K = processed_width * processed_height;
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
   dt_omp_firstprivate(buf8, K) \
   schedule(static)
 #endif
-        // just flip byte order
-        for(size_t k = 0; k < (size_t)4 * K; k += 4)
-        {
-          uint8_t tmp = buf8[k + 0];
-          buf8[k + 0] = buf8[k + 2];
-          buf8[k + 2] = tmp;
-        }
-      }
-    }
-  }
-  else if(bpp == 16)
-  {
-    // uint16_t per color channel
-    float *buff = (float *)outbuf;
-    uint16_t *buf16 = (uint16_t *)outbuf;
-    const size_t K = processed_width * processed_height;
-
-// would need to get rid of the overwriting of floats by ints to make OPENMP work here
+    // just flip byte order
     for(size_t k = 0; k < (size_t)4 * K; k += 4)
     {
-      // convert in place
-      if(bch == 3)
-        for(int i = 0; i < 3; i++)
-          buf16[k + i] = CLAMP(buff[k + i] * 0x10000, 0, 0x10000);
-      else
-      {
-        const uint16_t L = CLAMP(buff[k] * 0x10000, 0, 0x10000);
-        buf16[k] = buf16[k + 1] = buf16[k + 2] = L;
-      }
+      uint8_t tmp = buf8[k + 0];
+      buf8[k + 0] = buf8[k + 2];
+      buf8[k + 2] = tmp;
     }
   }
   // else output float, no further harm done to the pixels :)
+  // tell the writer whether the buffer holds gray
+  pipe.colors = gray ? 1 : 4;
   format_params->width = processed_width;
   format_params->height = processed_height;
-  
+
+  // hand the finished buffer to the export job's encoder threads and go on with the next image
+  if(!thumbnail_export && dt_imageio_export_in_background(format, format_params))
+  {
+    _export_write_t *w = (_export_write_t *)calloc(1, sizeof(_export_write_t));
+    const size_t bufsize = (size_t)4 * processed_width * processed_height * (bpp / 8);
+    if(quantized)
+      w->buf = quantized;
+    else if((w->buf = dt_alloc_align(64, bufsize)))
+      memcpy(w->buf, outbuf, bufsize);
+    if(!w->buf)
+    {
+      free(w);
+      dt_control_log(_("failed to allocate memory for %s, please lower the threads used for export or buy more memory."),
+                     C_("noun", "export"));
+      goto error;
+    }
+    quantized = NULL;
+
+    w->format_params = format->get_params(format);
+    memcpy(w->format_params, format_params, format->params_size(format));
+
+    if(!ignore_exif)
+    {
+      char pathname[PATH_MAX] = { 0 };
+      gboolean from_cache = TRUE;
+      dt_image_full_path(imgid, pathname, sizeof(pathname), &from_cache);
+      w->exif_len = dt_exif_read_blob(&w->exif, pathname, imgid, sRGB, processed_width, processed_height, 0);
+    }
+
+    w->imgid = imgid;
+    w->filename = g_strdup(filename);
+    w->format = format;
+    w->colors = pipe.colors;
+    w->icc_type = icc_type;
+    w->icc_filename = g_strdup(icc_filename);
+    w->copy_metadata = copy_metadata;
+    w->metadata = metadata;
+    w->storage = storage;
+    w->storage_params = storage_params;
+    w->num = num;
+    w->total = total;
+
+    // release the pipe and the input first, push() blocks while the encoders are busy
+    dt_dev_pixelpipe_cleanup(&pipe);
+    dt_dev_cleanup(&dev);
+    dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+
+    dt_imageio_encoder_push(dt_imageio_encoder_get_current(), imgid, w->filename, _export_write, w,
+                            _export_write_free);
+    return 0;
+  }
+
   if(!ignore_exif)
   {
     int length;
@@ -994,6 +1150,7 @@ int dt_imageio_export_with_flags(const int32_t imgid, const char *filename,
     res = format->write_image(format_params, filename, outbuf, icc_type, icc_filename,
                               NULL, 0, imgid, num, total, &pipe);
 
+  dt_free_align(quantized);
   dt_dev_pixelpipe_cleanup(&pipe);
   dt_dev_cleanup(&dev);
   dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
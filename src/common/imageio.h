@@ -86,6 +86,10 @@ int dt_imageio_export_with_flags(const int32_t imgid, const char *filename,
                                  dt_imageio_module_storage_t *storage, dt_imageio_module_data_t *storage_params,
                                  int num, int total, dt_export_metadata_t *metadata);
 
+// whether dt_imageio_export() only queues the file on the export job's encoder, to be written later
+gboolean dt_imageio_export_in_background(struct dt_imageio_module_format_t *format,
+                                         struct dt_imageio_module_data_t *format_params);
+
 size_t dt_imageio_write_pos(int i, int j, int wd, int ht, float fwd, float fht,
                             dt_image_orientation_t orientation);
 
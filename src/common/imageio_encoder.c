@@ -0,0 +1,185 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/imageio_encoder.h"
+#include "common/dtpthread.h"
+
+typedef struct dt_imageio_encoder_task_t
+{
+  int id;
+  char *filename;
+  dt_imageio_encoder_callback_t callback;
+  void *data;
+  GDestroyNotify destroy;
+} dt_imageio_encoder_task_t;
+
+struct dt_imageio_encoder_t
+{
+  GMutex mutex;
+  GCond cond;
+  GQueue queue;       // tasks not started yet
+  int pending;        // queued or running
+  int depth;
+  int failed;
+  GList *failed_ids;
+  GHashTable *writing; // filenames of the running tasks
+  gboolean quit;
+  int nthreads;
+  pthread_t *threads;
+};
+
+static GPrivate _encoder_current;
+
+// first queued task whose file isn't being written by another thread, called with the mutex held
+static dt_imageio_encoder_task_t *_encoder_next(dt_imageio_encoder_t *enc)
+{
+  for(GList *l = enc->queue.head; l; l = g_list_next(l))
+  {
+    dt_imageio_encoder_task_t *task = (dt_imageio_encoder_task_t *)l->data;
+    if(!g_hash_table_contains(enc->writing, task->filename))
+    {
+      g_queue_delete_link(&enc->queue, l);
+      g_hash_table_add(enc->writing, task->filename);
+      return task;
+    }
+  }
+  return NULL;
+}
+
+static void *_encoder_thread(void *data)
+{
+  dt_imageio_encoder_t *enc = (dt_imageio_encoder_t *)data;
+  dt_pthread_setname("export encoder");
+
+  g_mutex_lock(&enc->mutex);
+  while(TRUE)
+  {
+    dt_imageio_encoder_task_t *task = _encoder_next(enc);
+    if(!task)
+    {
+      // tasks left in the queue wait for a file another thread is writing
+      if(enc->quit && g_queue_is_empty(&enc->queue)) break;
+      g_cond_wait(&enc->cond, &enc->mutex);
+      continue;
+    }
+    g_mutex_unlock(&enc->mutex);
+
+    const int res = task->callback(task->data);
+    if(task->destroy) task->destroy(task->data);
+
+    g_mutex_lock(&enc->mutex);
+    if(res)
+    {
+      enc->failed++;
+      enc->failed_ids = g_list_prepend(enc->failed_ids, GINT_TO_POINTER(task->id));
+    }
+    g_hash_table_remove(enc->writing, task->filename);
+    g_free(task->filename);
+    g_free(task);
+    enc->pending--;
+    g_cond_broadcast(&enc->cond);
+  }
+  g_mutex_unlock(&enc->mutex);
+  return NULL;
+}
+
+dt_imageio_encoder_t *dt_imageio_encoder_new(const int threads, const int depth)
+{
+  dt_imageio_encoder_t *enc = g_malloc0(sizeof(dt_imageio_encoder_t));
+  g_mutex_init(&enc->mutex);
+  g_cond_init(&enc->cond);
+  g_queue_init(&enc->queue);
+  enc->writing = g_hash_table_new(g_str_hash, g_str_equal);
+  enc->depth = MAX(depth, 1);
+  enc->nthreads = MAX(threads, 1);
+  enc->threads = g_malloc0(sizeof(pthread_t) * enc->nthreads);
+  for(int k = 0; k < enc->nthreads; k++)
+    if(dt_pthread_create(&enc->threads[k], _encoder_thread, enc))
+    {
+      // go on with the threads we got, callers write in place without any
+      enc->nthreads = k;
+      break;
+    }
+  if(enc->nthreads == 0)
+  {
+    g_hash_table_destroy(enc->writing);
+    g_free(enc->threads);
+    g_cond_clear(&enc->cond);
+    g_mutex_clear(&enc->mutex);
+    g_free(enc);
+    return NULL;
+  }
+  return enc;
+}
+
+void dt_imageio_encoder_push(dt_imageio_encoder_t *enc, const int id, const char *filename,
+                             dt_imageio_encoder_callback_t callback, void *data, GDestroyNotify destroy)
+{
+  dt_imageio_encoder_task_t *task = g_malloc(sizeof(dt_imageio_encoder_task_t));
+  task->id = id;
+  task->filename = g_strdup(filename);
+  task->callback = callback;
+  task->data = data;
+  task->destroy = destroy;
+
+  g_mutex_lock(&enc->mutex);
+  while(enc->pending >= enc->depth) g_cond_wait(&enc->cond, &enc->mutex);
+  enc->pending++;
+  g_queue_push_tail(&enc->queue, task);
+  g_cond_broadcast(&enc->cond);
+  g_mutex_unlock(&enc->mutex);
+}
+
+int dt_imageio_encoder_finish(dt_imageio_encoder_t *enc, GList **failed_ids)
+{
+  if(!enc) return 0;
+
+  g_mutex_lock(&enc->mutex);
+  enc->quit = TRUE;
+  g_cond_broadcast(&enc->cond);
+  g_mutex_unlock(&enc->mutex);
+
+  // the threads drain the queue before they leave
+  for(int k = 0; k < enc->nthreads; k++) pthread_join(enc->threads[k], NULL);
+
+  const int failed = enc->failed;
+  if(failed_ids)
+    *failed_ids = g_list_concat(enc->failed_ids, *failed_ids);
+  else
+    g_list_free(enc->failed_ids);
+  g_hash_table_destroy(enc->writing);
+  g_free(enc->threads);
+  g_cond_clear(&enc->cond);
+  g_mutex_clear(&enc->mutex);
+  g_free(enc);
+  return failed;
+}
+
+void dt_imageio_encoder_set_current(dt_imageio_encoder_t *enc)
+{
+  g_private_set(&_encoder_current, enc);
+}
+
+dt_imageio_encoder_t *dt_imageio_encoder_get_current(void)
+{
+  return (dt_imageio_encoder_t *)g_private_get(&_encoder_current);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
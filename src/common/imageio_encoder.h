@@ -0,0 +1,53 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <glib.h>
+
+/**
+ * a small pool of threads encoding and writing exported images, so the pixelpipe of the next
+ * image overlaps the compression and disk i/o of the previous one. at most depth images are
+ * queued or being written at any time, which bounds the memory held by finished buffers.
+ */
+typedef struct dt_imageio_encoder_t dt_imageio_encoder_t;
+
+/** runs on an encoder thread, returns 0 on success */
+typedef int (*dt_imageio_encoder_callback_t)(void *data);
+
+/** start an encoder running on up to threads threads, with room for depth pending images.
+ *  NULL if no thread could be started */
+dt_imageio_encoder_t *dt_imageio_encoder_new(int threads, int depth);
+
+/** queue a task, blocks while depth tasks are pending. destroy (may be NULL) frees data after the task ran.
+ *  id is reported back by finish() if the task fails. tasks with the same filename never run at the same
+ *  time, they run in the order they were pushed */
+void dt_imageio_encoder_push(dt_imageio_encoder_t *enc, const int id, const char *filename,
+                             dt_imageio_encoder_callback_t callback, void *data, GDestroyNotify destroy);
+
+/** wait for all pending tasks and stop the threads. returns the number of tasks that failed, their ids are
+ *  prepended to failed_ids if it is not NULL */
+int dt_imageio_encoder_finish(dt_imageio_encoder_t *enc, GList **failed_ids);
+
+/** exports from the calling thread are handed to enc from now on, NULL to write them in place again */
+void dt_imageio_encoder_set_current(dt_imageio_encoder_t *enc);
+dt_imageio_encoder_t *dt_imageio_encoder_get_current(void);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
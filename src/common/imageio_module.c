@@ -211,6 +211,11 @@ static int _default_storage_dimension(struct dt_imageio_module_storage_t *self,
 static void _default_storage_nop(struct dt_imageio_module_storage_t *self)
 {
 }
+/** Default implementation of flags module function, no storage flags */
+static int _default_storage_flags(struct dt_imageio_module_storage_t *self)
+{
+  return 0;
+}
 
 static int dt_imageio_load_module_storage(dt_imageio_module_storage_t *module, const char *libname,
                                           const char *plugin_name)
@@ -281,6 +286,9 @@ static int dt_imageio_load_module_storage(dt_imageio_module_storage_t *module, c
   if(!g_module_symbol(module->module, "ask_user_confirmation", (gpointer) & (module->ask_user_confirmation)))
     module->ask_user_confirmation = NULL;
 
+  if(!g_module_symbol(module->module, "flags", (gpointer) & (module->flags)))
+    module->flags = _default_storage_flags;
+
   module->init(module);
   return 0;
 error:
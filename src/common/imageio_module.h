@@ -30,9 +30,16 @@ typedef enum dt_imageio_format_flags_t
 {
   FORMAT_FLAGS_SUPPORT_XMP = 1,
   FORMAT_FLAGS_NO_TMPFILE = 2,
-  FORMAT_FLAGS_SUPPORT_LAYERS = 4
+  FORMAT_FLAGS_SUPPORT_LAYERS = 4,
+  FORMAT_FLAGS_SUPPORT_GRAY = 8 // gray pipes are written from the first channel only, pipe->colors == 1
 } dt_imageio_format_flags_t;
 
+/** Flag for the storage modules */
+typedef enum dt_imageio_storage_flags_t
+{
+  STORAGE_FLAGS_ASYNC_WRITE = 1 // store() leaves the file alone after export, it may be written in the background
+} dt_imageio_storage_flags_t;
+
 /**
  * defines the plugin structure for image import and export.
  *
@@ -21,9 +21,19 @@
 #endif
 
 #include "RawSpeed-API.h"
+#include "io/FileIOException.h"
 
+#include <cerrno>
+#include <limits>
+#include <map>
 #include <memory>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #define __STDC_LIMIT_MACROS
 
 extern "C" {
@@ -112,15 +122,89 @@ uint32_t dt_rawspeed_crop_dcraw_filters(uint32_t filters, uint32_t crop_x, uint3
   return ColorFilterArray::shiftDcrawFilter(filters, crop_x, crop_y);
 }
 
+// concurrent raw file reads per device: enough to keep an ssd or a network share busy,
+// few enough that a spinning disk doesn't seek between too many files
+#define DT_RAWSPEED_READS_PER_DEVICE 2
+
+#if defined(__unix__) || defined(__APPLE__)
+// readers per device, guarded by darktable.readFile_mutex
+static std::map<dev_t, int> _read_slots;
+static pthread_cond_t _read_slots_cond = PTHREAD_COND_INITIALIZER;
+
+class ReadSlot
+{
+  dev_t dev;
+
+public:
+  explicit ReadSlot(dev_t d) : dev(d)
+  {
+    dt_pthread_mutex_lock(&darktable.readFile_mutex);
+    while(_read_slots[dev] >= DT_RAWSPEED_READS_PER_DEVICE)
+      dt_pthread_cond_wait(&_read_slots_cond, &darktable.readFile_mutex);
+    _read_slots[dev]++;
+    dt_pthread_mutex_unlock(&darktable.readFile_mutex);
+  }
+  ~ReadSlot()
+  {
+    dt_pthread_mutex_lock(&darktable.readFile_mutex);
+    _read_slots[dev]--;
+    pthread_cond_broadcast(&_read_slots_cond);
+    dt_pthread_mutex_unlock(&darktable.readFile_mutex);
+  }
+};
+#endif
+
+// read the whole file into a rawspeed buffer. on unix the kernel is told up front that all of
+// it will be read sequentially, and the data comes in with large pread()s. other files on other
+// devices are read at the same time, the same device only admits a few readers.
+static std::unique_ptr<const Buffer> _rawspeed_read_file(const char *filename)
+{
+#if defined(__unix__) || defined(__APPLE__)
+  // closes the file on all ways out, ThrowFIE included
+  struct Fd
+  {
+    const int fd;
+    ~Fd() { if(fd >= 0) close(fd); }
+  } file = { open(filename, O_RDONLY) };
+  const int fd = file.fd;
+  if(fd < 0) ThrowFIE("Could not open file \"%s\".", filename);
+
+  struct stat st;
+  if(fstat(fd, &st)) ThrowFIE("Could not stat file \"%s\".", filename);
+  if(st.st_size <= 0) ThrowFIE("File is 0 bytes.");
+  if((uint64_t)st.st_size > std::numeric_limits<Buffer::size_type>::max())
+    ThrowFIE("File is too big (%zu bytes).", (size_t)st.st_size);
+  const size_t size = st.st_size;
+
+  ReadSlot slot(st.st_dev);
+
+#ifdef POSIX_FADV_SEQUENTIAL
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+#endif
+
+  auto dest = Buffer::Create(size);
+  size_t done = 0;
+  while(done < size)
+  {
+    const ssize_t got = pread(fd, dest.get() + done, size - done, done);
+    if(got < 0 && errno == EINTR) continue;
+    if(got <= 0) ThrowFIE("Could not read file \"%s\".", filename);
+    done += got;
+  }
+
+  return std::make_unique<Buffer>(std::move(dest), size);
+#else
+  FileReader f(filename);
+  return f.readFile();
+#endif
+}
+
 dt_imageio_retval_t dt_imageio_open_rawspeed(dt_image_t *img, const char *filename,
                                              dt_mipmap_buffer_t *mbuf)
 {
   if(!img->exif_inited) (void)dt_exif_read(img, filename);
 
-  char filen[PATH_MAX] = { 0 };
-  snprintf(filen, sizeof(filen), "%s", filename);
-  FileReader f(filen);
-
   std::unique_ptr<RawDecoder> d;
   std::unique_ptr<const Buffer> m;
 
@@ -128,9 +212,15 @@ dt_imageio_retval_t dt_imageio_open_rawspeed(dt_image_t *img, const char *filena
   {
     dt_rawspeed_load_meta();
 
-    dt_pthread_mutex_lock(&darktable.readFile_mutex);
-    m = f.readFile();
-    dt_pthread_mutex_unlock(&darktable.readFile_mutex);
+    dt_times_t start;
+    dt_get_times(&start);
+    m = _rawspeed_read_file(filename);
+    if(darktable.unmuted & DT_DEBUG_PERF)
+    {
+      const double elapsed = dt_get_wtime() - start.clock;
+      dt_print(DT_DEBUG_PERF, "[rawspeed] read %s: %.1f MiB in %.3f secs (%.1f MiB/s)\n", img->filename,
+               m->getSize() / (1024.0 * 1024.0), elapsed, m->getSize() / (1024.0 * 1024.0) / MAX(elapsed, 1e-6));
+    }
 
     RawParser t(m.get());
     d = t.getDecoder(meta);
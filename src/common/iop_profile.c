@@ -21,6 +21,7 @@
 
 #include "common/darktable.h"
 #include "common/iop_profile.h"
+#include "common/colorspaces_lut3d.h"
 #include "common/debug.h"
 #include "develop/imageop.h"
 #include "develop/imageop_math.h"
@@ -47,6 +48,30 @@
                       "tree-vectorize")
 #endif
 
+// run xform through its baked lut, rows leaving the lut domain take the exact transform
+static void _transform_lcms2_rows(const float *const image_in, float *const image_out, const int width,
+                                  const int height, cmsHTRANSFORM xform, const uint64_t key,
+                                  const cmsUInt32Number input_format)
+{
+  dt_colorspaces_lut3d_t *lut = dt_colorspaces_lut3d_get(key, DT_COLORSPACES_LUT3D_SIZE, input_format, xform, NULL);
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+    dt_omp_firstprivate(image_in, image_out, width, height, lut) \
+    shared(xform) \
+    schedule(static)
+#endif
+  for(int y = 0; y < height; y++)
+  {
+    const float *const in = image_in + (size_t)y * width * 4;
+    float *const out = image_out + (size_t)y * width * 4;
+    if(!lut || !dt_colorspaces_lut3d_apply(lut, in, out, width))
+      cmsDoTransform(xform, in, out, width);
+  }
+
+  dt_colorspaces_lut3d_release(lut);
+}
+
 static void _transform_from_to_rgb_lab_lcms2(const float *const image_in, float *const image_out, const int width,
                                              const int height, const dt_colorspaces_color_profile_type_t type,
                                              const char *filename, const int intent, const int direction)
@@ -109,18 +134,10 @@ static void _transform_from_to_rgb_lab_lcms2(const float *const image_in, float
 
   if(xform)
   {
-#ifdef _OPENMP
-#pragma omp parallel for default(none) \
-    dt_omp_firstprivate(image_in, image_out, width, height) \
-    shared(xform) \
-    schedule(static)
-#endif
-    for(int y = 0; y < height; y++)
-    {
-      const float *const in = image_in + y * width * 4;
-      float *const out = image_out + y * width * 4;
-      cmsDoTransform(xform, in, out, width);
-    }
+    uint64_t key = dt_colorspaces_lut3d_hash_profile(5381, input_profile);
+    key = dt_colorspaces_lut3d_hash_profile(key, output_profile);
+    key = dt_colorspaces_lut3d_hash_int(key, intent);
+    _transform_lcms2_rows(image_in, image_out, width, height, xform, key, input_format);
   }
   else
     fprintf(stderr, "[_transform_from_to_rgb_lab_lcms2] cannot create transform\n");
@@ -200,28 +217,22 @@ static void _transform_rgb_to_rgb_lcms2(const float *const image_in, float *cons
   output_profile = to_rgb_profile;
   output_format = TYPE_RGBA_FLT;
 
+  uint64_t key = 0;
   if(input_profile && output_profile)
+  {
     xform = cmsCreateTransform(input_profile, input_format, output_profile, output_format, intent, 0);
+    // the display profiles may change once the lock is released
+    key = dt_colorspaces_lut3d_hash_profile(5381, input_profile);
+    key = dt_colorspaces_lut3d_hash_profile(key, output_profile);
+    key = dt_colorspaces_lut3d_hash_int(key, intent);
+  }
 
   if(type_from == DT_COLORSPACE_DISPLAY || type_to == DT_COLORSPACE_DISPLAY || type_from == DT_COLORSPACE_DISPLAY2
      || type_to == DT_COLORSPACE_DISPLAY2)
     pthread_rwlock_unlock(&darktable.color_profiles->xprofile_lock);
 
   if(xform)
-  {
-#ifdef _OPENMP
-#pragma omp parallel for default(none) \
-    dt_omp_firstprivate(image_in, image_out, width, height) \
-    shared(xform) \
-    schedule(static)
-#endif
-    for(int y = 0; y < height; y++)
-    {
-      const float *const in = image_in + y * width * 4;
-      float *const out = image_out + y * width * 4;
-      cmsDoTransform(xform, in, out, width);
-    }
-  }
+    _transform_lcms2_rows(image_in, image_out, width, height, xform, key, input_format);
   else
     fprintf(stderr, "[_transform_rgb_to_rgb_lcms2] cannot create transform\n");
 
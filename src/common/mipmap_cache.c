@@ -27,6 +27,7 @@
 #include "common/imageio_jpeg.h"
 #include "common/imageio_module.h"
 #include "control/conf.h"
+#include "control/control.h"
 #include "control/jobs.h"
 #include "develop/imageop_math.h"
 
@@ -53,6 +54,8 @@
 #define DT_MIPMAP_CACHE_FILE_MAGIC 0xD71337
 #define DT_MIPMAP_CACHE_FILE_VERSION 23
 #define DT_MIPMAP_CACHE_DEFAULT_FILE_NAME "mipmaps"
+// full buffers evicted from mip_full and not packed yet, on top of the cache budget
+#define DT_MIPMAP_COMPACT_PENDING 2
 
 typedef enum dt_mipmap_buffer_dsc_flags
 {
@@ -85,6 +88,9 @@ struct dt_mipmap_buffer_dsc
   size_t size;
   dt_mipmap_buffer_dsc_flags flags;
   dt_colorspaces_color_profile_type_t color_space;
+  // layout of full buffers, lets eviction pack raw data without the image cache
+  dt_iop_buffer_type_t datatype;
+  uint32_t channels;
 
 #if __has_feature(address_sanitizer) || defined(__SANITIZE_ADDRESS__)
   // do not touch!
@@ -276,6 +282,8 @@ void *dt_mipmap_cache_alloc(dt_mipmap_buffer_t *buf, const dt_image_t *img)
   dsc->iscale = 1.0f;
   dsc->color_space = DT_COLORSPACE_NONE;
   dsc->flags = DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE;
+  dsc->datatype = img->buf_dsc.datatype;
+  dsc->channels = img->buf_dsc.channels;
   buf->buf = (uint8_t *)(dsc + 1);
 
   // fprintf(stderr, "full buffer allocating img %u %d x %d = %u bytes (%p)\n", img->id, img->width,
@@ -292,6 +300,268 @@ void *dt_mipmap_cache_alloc(dt_mipmap_buffer_t *buf, const dt_image_t *img)
   return dsc + 1;
 }
 
+// a uint16 raw buffer evicted from the full cache, every row packed to the
+// bits actually used by the sensor data. restored bit exact on the next get.
+typedef struct dt_mipmap_compact_t
+{
+  uint32_t imgid;
+  uint32_t width, height;
+  uint32_t bits;
+  size_t stride; // bytes per packed row
+  uint8_t *data;
+} dt_mipmap_compact_t;
+
+static void _compact_pack_row(uint8_t *out, const uint16_t *const in, const uint32_t width, const uint32_t bits)
+{
+  uint64_t acc = 0;
+  uint32_t fill = 0;
+  for(uint32_t i = 0; i < width; i++)
+  {
+    acc |= (uint64_t)in[i] << fill;
+    fill += bits;
+    for(; fill >= 8; fill -= 8, acc >>= 8) *out++ = acc & 0xff;
+  }
+  if(fill) *out = acc & 0xff;
+}
+
+static void _compact_unpack_row(uint16_t *const out, const uint8_t *in, const uint32_t width, const uint32_t bits)
+{
+  const uint64_t mask = (1u << bits) - 1;
+  uint64_t acc = 0;
+  uint32_t fill = 0;
+  for(uint32_t i = 0; i < width; i++)
+  {
+    for(; fill < bits; fill += 8) acc |= (uint64_t)*in++ << fill;
+    out[i] = acc & mask;
+    acc >>= bits;
+    fill -= bits;
+  }
+}
+
+static void _compact_free(dt_mipmap_compact_t *c)
+{
+  dt_free_align(c->data);
+  free(c);
+}
+
+// unlink the packed copy of imgid, if any. call with compact_lock held.
+static dt_mipmap_compact_t *_compact_steal(dt_mipmap_cache_t *cache, const uint32_t imgid)
+{
+  for(GList *iter = cache->compact; iter; iter = g_list_next(iter))
+  {
+    dt_mipmap_compact_t *c = (dt_mipmap_compact_t *)iter->data;
+    if(c->imgid == imgid)
+    {
+      cache->compact = g_list_delete_link(cache->compact, iter);
+      cache->compact_size -= c->stride * c->height;
+      return c;
+    }
+  }
+  return NULL;
+}
+
+// a full buffer detached from mip_full, waiting for the background job to pack it
+typedef struct dt_mipmap_detached_t
+{
+  uint32_t imgid;
+  struct dt_mipmap_buffer_dsc *dsc; // the cache entry's data, header and pixels
+} dt_mipmap_detached_t;
+
+static void _detached_free(dt_mipmap_detached_t *d)
+{
+  dt_free_align(d->dsc);
+  free(d);
+}
+
+static void _compact_drop(dt_mipmap_cache_t *cache, const uint32_t imgid)
+{
+  dt_mipmap_detached_t *d = NULL;
+  dt_pthread_mutex_lock(&cache->compact_lock);
+  dt_mipmap_compact_t *c = _compact_steal(cache, imgid);
+  for(GList *iter = cache->compact_pending; iter; iter = g_list_next(iter))
+    if(((dt_mipmap_detached_t *)iter->data)->imgid == imgid)
+    {
+      d = (dt_mipmap_detached_t *)iter->data;
+      cache->compact_pending = g_list_delete_link(cache->compact_pending, iter);
+      break;
+    }
+  dt_pthread_mutex_unlock(&cache->compact_lock);
+  if(c) _compact_free(c);
+  if(d) _detached_free(d);
+}
+
+// pack a detached full buffer and add it to the packed copies. runs without any cache lock held.
+static void _compact_store(dt_mipmap_cache_t *cache, const uint32_t imgid, const struct dt_mipmap_buffer_dsc *dsc)
+{
+  const uint32_t width = dsc->width;
+  const uint32_t height = dsc->height;
+  const uint16_t *const in = (const uint16_t *)(dsc + 1);
+  const size_t npixels = (size_t)width * height;
+
+  uint16_t maxval = 0;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(in, npixels) \
+  reduction(max : maxval) \
+  schedule(static)
+#endif
+  for(size_t k = 0; k < npixels; k++) maxval = MAX(maxval, in[k]);
+
+  uint32_t bits = 1;
+  while(bits < 16 && (maxval >> bits)) bits++;
+  // not worth the unpacking for the last couple of bits
+  if(bits > 14) return;
+
+  const size_t stride = ((size_t)width * bits + 7) / 8;
+  if(stride * height > cache->compact_quota) return;
+
+  dt_mipmap_compact_t *c = (dt_mipmap_compact_t *)malloc(sizeof(dt_mipmap_compact_t));
+  if(!c) return;
+  c->data = dt_alloc_align(64, stride * height);
+  if(!c->data)
+  {
+    free(c);
+    return;
+  }
+  c->imgid = imgid;
+  c->width = width;
+  c->height = height;
+  c->bits = bits;
+  c->stride = stride;
+
+  uint8_t *const out = c->data;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(in, out, width, height, bits, stride) \
+  schedule(static)
+#endif
+  for(uint32_t j = 0; j < height; j++)
+    _compact_pack_row(out + stride * j, in + (size_t)width * j, width, bits);
+
+  GList *evicted = NULL;
+  dt_pthread_mutex_lock(&cache->compact_lock);
+  dt_mipmap_compact_t *old = _compact_steal(cache, c->imgid);
+  if(old) evicted = g_list_prepend(evicted, old);
+  cache->compact = g_list_prepend(cache->compact, c);
+  cache->compact_size += stride * height;
+  while(cache->compact_size > cache->compact_quota)
+  {
+    GList *last = g_list_last(cache->compact);
+    dt_mipmap_compact_t *l = (dt_mipmap_compact_t *)last->data;
+    cache->compact = g_list_delete_link(cache->compact, last);
+    cache->compact_size -= l->stride * l->height;
+    evicted = g_list_prepend(evicted, l);
+  }
+  dt_pthread_mutex_unlock(&cache->compact_lock);
+  g_list_free_full(evicted, (GDestroyNotify)_compact_free);
+
+  dt_print(DT_DEBUG_CACHE, "[mipmap_cache] packed full buffer of image %" PRIu32 " to %u bits (%.1f MB)\n",
+           imgid, bits, stride * height / (1024.0 * 1024.0));
+}
+
+static int32_t _compact_job_run(dt_job_t *job)
+{
+  dt_mipmap_cache_t *cache = (dt_mipmap_cache_t *)dt_control_job_get_params(job);
+
+  // oldest first. there may be nothing left if _compact_drop() or an earlier job got to it first
+  while(TRUE)
+  {
+    dt_pthread_mutex_lock(&cache->compact_lock);
+    GList *last = g_list_last(cache->compact_pending);
+    dt_mipmap_detached_t *d = last ? (dt_mipmap_detached_t *)last->data : NULL;
+    if(last) cache->compact_pending = g_list_delete_link(cache->compact_pending, last);
+    dt_pthread_mutex_unlock(&cache->compact_lock);
+    if(!d) break;
+
+    if(cache->compact_quota) _compact_store(cache, d->imgid, d->dsc);
+    _detached_free(d);
+  }
+  return 0;
+}
+
+// called from the cleanup callback of mip_full, with its lock held. takes over the buffer of
+// a full raw that is worth packing and leaves the packing to a background job.
+// returns TRUE if the buffer is not the caller's to free any more.
+static gboolean _compact_detach(dt_mipmap_cache_t *cache, dt_cache_entry_t *entry)
+{
+  struct dt_mipmap_buffer_dsc *dsc = (struct dt_mipmap_buffer_dsc *)entry->data;
+  if(!cache->compact_quota || (void *)dsc == (void *)dt_mipmap_cache_static_dead_image) return FALSE;
+  if(dsc->width == 0 || dsc->height == 0 || dsc->datatype != TYPE_UINT16 || dsc->channels != 1) return FALSE;
+  // jobs would run right here, under the lock
+  if(!dt_control_running()) return FALSE;
+
+  dt_job_t *job = dt_control_job_create(&_compact_job_run, "pack full buffer");
+  if(!job) return FALSE;
+  dt_mipmap_detached_t *d = (dt_mipmap_detached_t *)malloc(sizeof(dt_mipmap_detached_t));
+  if(!d)
+  {
+    dt_control_job_dispose(job);
+    return FALSE;
+  }
+  d->imgid = get_imgid(entry->key);
+  d->dsc = dsc;
+
+  // the detached buffers are outside the cache budget, only keep a few of them around
+  dt_mipmap_detached_t *dropped = NULL;
+  dt_pthread_mutex_lock(&cache->compact_lock);
+  cache->compact_pending = g_list_prepend(cache->compact_pending, d);
+  if(g_list_length(cache->compact_pending) > DT_MIPMAP_COMPACT_PENDING)
+  {
+    GList *last = g_list_last(cache->compact_pending);
+    dropped = (dt_mipmap_detached_t *)last->data;
+    cache->compact_pending = g_list_delete_link(cache->compact_pending, last);
+  }
+  dt_pthread_mutex_unlock(&cache->compact_lock);
+  if(dropped) _detached_free(dropped);
+
+  dt_control_job_set_params(job, cache, NULL);
+  dt_control_add_job(darktable.control, DT_JOB_QUEUE_SYSTEM_BG, job);
+  return TRUE;
+}
+
+// fill the write locked full buffer from its packed copy. the image struct must still
+// carry what the loader found out, it is not written back.
+static gboolean _compact_restore(dt_mipmap_cache_t *cache, dt_mipmap_buffer_t *buf, const dt_image_t *img)
+{
+  if(!cache->compact_quota) return FALSE;
+
+  dt_pthread_mutex_lock(&cache->compact_lock);
+  dt_mipmap_compact_t *c = _compact_steal(cache, img->id);
+  dt_pthread_mutex_unlock(&cache->compact_lock);
+  if(!c) return FALSE;
+
+  if(img->loader == LOADER_UNKNOWN || img->buf_dsc.datatype != TYPE_UINT16 || img->buf_dsc.channels != 1
+     || img->width != c->width || img->height != c->height)
+  {
+    _compact_free(c);
+    return FALSE;
+  }
+
+  uint16_t *const out = (uint16_t *)dt_mipmap_cache_alloc(buf, img);
+  if(!out)
+  {
+    _compact_free(c);
+    return FALSE;
+  }
+
+  const uint8_t *const in = c->data;
+  const uint32_t width = c->width;
+  const uint32_t height = c->height;
+  const uint32_t bits = c->bits;
+  const size_t stride = c->stride;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(in, out, width, height, bits, stride) \
+  schedule(static)
+#endif
+  for(uint32_t j = 0; j < height; j++)
+    _compact_unpack_row(out + (size_t)width * j, in + stride * j, width, bits);
+
+  dt_print(DT_DEBUG_CACHE, "[mipmap_cache] unpacked full buffer of image %" PRIu32 "\n", c->imgid);
+  _compact_free(c);
+  return TRUE;
+}
+
 // callback for the cache backend to initialize payload pointers
 void dt_mipmap_cache_allocate_dynamic(void *data, dt_cache_entry_t *entry)
 {
@@ -330,6 +600,8 @@ void dt_mipmap_cache_allocate_dynamic(void *data, dt_cache_entry_t *entry)
     }
 
     dsc = entry->data;
+    dsc->datatype = TYPE_UNKNOWN;
+    dsc->channels = 0;
 
     if(mip <= DT_MIPMAP_F)
     {
@@ -501,6 +773,8 @@ write_error:
       }
     }
   }
+  else if(mip == DT_MIPMAP_FULL && _compact_detach(cache, entry))
+    return;
   dt_free_align(entry->data);
 }
 
@@ -523,6 +797,13 @@ void dt_mipmap_cache_init(dt_mipmap_cache_t *cache)
   const int64_t cache_memory = dt_conf_get_int64("cache_memory");
   const size_t max_mem = CLAMPS(cache_memory, 100u << 20, ((size_t)8) << 30);
 
+  // packed full buffers take their share of the same budget
+  dt_pthread_mutex_init(&cache->compact_lock, NULL);
+  cache->compact = NULL;
+  cache->compact_pending = NULL;
+  cache->compact_size = 0;
+  cache->compact_quota = dt_conf_get_bool("cache_full_compact") ? max_mem / 4 : 0;
+
   // Fixed sizes for the thumbnail mip levels, selected for coverage of most screen sizes
   int32_t mipsizes[DT_MIPMAP_F][2] = {
     { 180, 110 },             // mip0 - ~1/2 size previous one
@@ -566,7 +847,7 @@ void dt_mipmap_cache_init(dt_mipmap_cache_t *cache)
   cache->mip_full.stats_fetches = 0;
   cache->mip_full.stats_standin = 0;
 
-  dt_cache_init(&cache->mip_thumbs.cache, 0, max_mem);
+  dt_cache_init(&cache->mip_thumbs.cache, 0, max_mem - cache->compact_quota);
   dt_cache_set_allocate_callback(&cache->mip_thumbs.cache, dt_mipmap_cache_allocate_dynamic, cache);
   dt_cache_set_cleanup_callback(&cache->mip_thumbs.cache, dt_mipmap_cache_deallocate_dynamic, cache);
 
@@ -590,9 +871,17 @@ void dt_mipmap_cache_init(dt_mipmap_cache_t *cache)
 
 void dt_mipmap_cache_cleanup(dt_mipmap_cache_t *cache)
 {
+  // don't pack what is freed on the way out
+  cache->compact_quota = 0;
   dt_cache_cleanup(&cache->mip_thumbs.cache);
   dt_cache_cleanup(&cache->mip_full.cache);
   dt_cache_cleanup(&cache->mip_f.cache);
+  g_list_free_full(cache->compact, (GDestroyNotify)_compact_free);
+  cache->compact = NULL;
+  g_list_free_full(cache->compact_pending, (GDestroyNotify)_detached_free);
+  cache->compact_pending = NULL;
+  cache->compact_size = 0;
+  dt_pthread_mutex_destroy(&cache->compact_lock);
 }
 
 void dt_mipmap_cache_print(dt_mipmap_cache_t *cache)
@@ -768,7 +1057,10 @@ void dt_mipmap_cache_get_with_caller(
         buf->width = buf->height = 0;
         buf->iscale = 0.0f;
         buf->color_space = DT_COLORSPACE_NONE; // TODO: does the full buffer need to know this?
-        dt_imageio_retval_t ret = dt_imageio_open(&buffered_image, filename, buf); // TODO: color_space?
+        // an evicted raw may still be around bit packed, that is much cheaper than decoding the file
+        const gboolean restored = _compact_restore(cache, buf, &buffered_image);
+        dt_imageio_retval_t ret = restored ? DT_IMAGEIO_OK
+                                           : dt_imageio_open(&buffered_image, filename, buf); // TODO: color_space?
         // might have been reallocated:
         ASAN_UNPOISON_MEMORY_REGION(entry->data, dt_mipmap_buffer_dsc_size);
         dsc = (struct dt_mipmap_buffer_dsc *)buf->cache_entry->data;
@@ -786,7 +1078,7 @@ void dt_mipmap_cache_get_with_caller(
             dsc->color_space = DT_COLORSPACE_NONE;
           }
         }
-        else
+        else if(!restored)
         {
           // swap back new image data:
           dt_image_t *img = dt_image_cache_get(darktable.image_cache, imgid, 'w');
@@ -1000,6 +1292,8 @@ void dt_mipmap_cache_evict_at_size(dt_mipmap_cache_t *cache, const uint32_t imgi
   const uint32_t key = get_key(imgid, mip);
   // write thumbnail to disc if not existing there
   dt_cache_remove(&_get_cache(cache, mip)->cache, key);
+  // the full buffer was just packed on the way out, don't bring it back
+  if(mip == DT_MIPMAP_FULL) _compact_drop(cache, imgid);
 }
 
 void dt_mimap_cache_evict(dt_mipmap_cache_t *cache, const uint32_t imgid)
@@ -1158,7 +1452,7 @@ static void _init_8(uint8_t *buf, uint32_t *width, uint32_t *height, float *isca
   if(res)
   {
     // try the real thing: rawspeed + pixelpipe
-    dt_imageio_module_format_t format;
+    dt_imageio_module_format_t format = { 0 };
     _dummy_data_t dat;
     format.bpp = _bpp;
     format.write_image = _write_image;
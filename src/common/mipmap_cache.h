@@ -99,6 +99,13 @@ typedef struct dt_mipmap_cache_t
   dt_mipmap_cache_one_t mip_f;
   dt_mipmap_cache_one_t mip_full;
   char cachedir[PATH_MAX]; // cached sha1sum filename for faster access
+
+  // full raw buffers evicted from mip_full, kept bit packed (cache_full_compact)
+  dt_pthread_mutex_t compact_lock;
+  GList *compact;       // most recently evicted first
+  GList *compact_pending; // detached from mip_full and waiting to be packed, newest first
+  size_t compact_size;  // bytes held
+  size_t compact_quota; // 0 if disabled
 } dt_mipmap_cache_t;
 
 // dynamic memory allocation interface for imageio backend: a write locked
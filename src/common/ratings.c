@@ -110,6 +110,8 @@ static void _ratings_undo_data_free(gpointer data)
 
 static void _ratings_apply(GList *imgs, const int rating, GList **undo, const gboolean undo_on)
 {
+  // one transaction for all the image updates
+  dt_database_start_transaction(darktable.db);
   GList *images = imgs;
   while(images)
   {
@@ -127,6 +129,7 @@ static void _ratings_apply(GList *imgs, const int rating, GList **undo, const gb
 
     images = g_list_next(images);
   }
+  dt_database_release_transaction(darktable.db);
 }
 
 void dt_ratings_apply_on_list(const GList *img, const int rating, const gboolean undo_on)
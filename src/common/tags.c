@@ -123,6 +123,7 @@ static void _pop_undo(gpointer user_data, dt_undo_type_t type, dt_undo_data_t da
   {
     GList *list = (GList *)data;
 
+    dt_database_start_transaction(darktable.db);
     while(list)
     {
       dt_undo_tags_t *undotags = (dt_undo_tags_t *)list->data;
@@ -133,6 +134,7 @@ static void _pop_undo(gpointer user_data, dt_undo_type_t type, dt_undo_data_t da
       *imgs = g_list_prepend(*imgs, GINT_TO_POINTER(undotags->imgid));
       list = g_list_next(list);
     }
+    dt_database_release_transaction(darktable.db);
 
     dt_control_signal_raise(darktable.signals, DT_SIGNAL_TAG_CHANGED);
   }
@@ -341,34 +343,6 @@ gboolean dt_tag_exists(const char *name, guint *tagid)
   return FALSE;
 }
 
-static gboolean _tag_add_tags_to_list(GList **list, const GList *tags)
-{
-  const GList *t = tags;
-  gboolean res = FALSE;
-  while(t)
-  {
-    if(!g_list_find(*list, t->data))
-    {
-      *list = g_list_prepend(*list, t->data);
-      res = TRUE;
-    }
-    t = g_list_next(t);
-  }
-  return res;
-}
-
-static gboolean _tag_remove_tags_from_list(GList **list, const GList *tags)
-{
-  const GList *t = tags;
-  const int nb_ini = g_list_length(*list);
-  while(t)
-  {
-    *list = g_list_remove(*list, t->data);
-    t = g_list_next(t);
-  }
-  return (g_list_length(*list) != nb_ini);
-}
-
 typedef enum dt_tag_type_t
 {
   DT_TAG_TYPE_DT,
@@ -386,9 +360,127 @@ typedef enum dt_tag_actions_t
 
 static GList *_tag_get_tags(const gint imgid, const dt_tag_type_t type);
 
+// images handled per statement by the set-based attach and detach
+#define DT_TAG_CHUNK_SIZE 500
+
+// attach or detach tags to/from all imgs with one query, one insert or delete per chunk of images.
+// the undo records only the tags which actually changed on each image: before holds the detached ones,
+// after the attached ones. _pop_undo_execute() replays such a delta as it does the full lists.
+static gboolean _tag_execute_set(const GList *tags, const GList *imgs, GList **undo, const gboolean undo_on,
+                                 const gint action)
+{
+  gchar *tag_list = NULL;
+  for(const GList *t = tags; t; t = g_list_next(t))
+    tag_list = dt_util_dstrcat(tag_list, "%d,", GPOINTER_TO_INT(t->data));
+  if(!tag_list) return FALSE;
+  tag_list[strlen(tag_list) - 1] = '\0';
+
+  sqlite3_stmt *stmt;
+  gboolean res = FALSE;
+  const GList *images = imgs;
+  while(images)
+  {
+    gchar *img_list = NULL;
+    const GList *chunk = images;
+    for(int count = 0; images && count < DT_TAG_CHUNK_SIZE; images = g_list_next(images), count++)
+      img_list = dt_util_dstrcat(img_list, "%d,", GPOINTER_TO_INT(images->data));
+    img_list[strlen(img_list) - 1] = '\0';
+
+    // the links which already exist, imgid -> list of tagid
+    GHashTable *attached = g_hash_table_new(NULL, NULL);
+    gchar *query = g_strdup_printf("SELECT imgid, tagid FROM main.tagged_images"
+                                   "  WHERE imgid IN (%s) AND tagid IN (%s)", img_list, tag_list);
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+    while(sqlite3_step(stmt) == SQLITE_ROW)
+    {
+      gpointer key = GINT_TO_POINTER(sqlite3_column_int(stmt, 0));
+      GList *present = (GList *)g_hash_table_lookup(attached, key);
+      g_hash_table_insert(attached, key, g_list_prepend(present, GINT_TO_POINTER(sqlite3_column_int(stmt, 1))));
+    }
+    sqlite3_finalize(stmt);
+    g_free(query);
+
+    // new links go on top of the custom sort order, as a single attach did
+    sqlite3_int64 position = 0;
+    if(action == DT_TA_ATTACH)
+    {
+      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                  "SELECT (IFNULL(MAX(position),0) & 0xFFFFFFFF00000000) + (1 << 32)"
+                                  "  FROM main.tagged_images", -1, &stmt, NULL);
+      if(sqlite3_step(stmt) == SQLITE_ROW) position = sqlite3_column_int64(stmt, 0);
+      sqlite3_finalize(stmt);
+    }
+
+    gchar *values = NULL;
+    for(const GList *i = chunk; i != images; i = g_list_next(i))
+    {
+      const int image_id = GPOINTER_TO_INT(i->data);
+      GList *present = (GList *)g_hash_table_lookup(attached, i->data);
+      GList *delta = NULL;
+      for(const GList *t = tags; t; t = g_list_next(t))
+      {
+        const gboolean is_attached = g_list_find(present, t->data) != NULL;
+        if(is_attached == (action == DT_TA_ATTACH) || g_list_find(delta, t->data)) continue;
+        delta = g_list_prepend(delta, t->data);
+        if(action == DT_TA_ATTACH)
+          values = dt_util_dstrcat(values, "(%d,%d,%" PRId64 "),", image_id, GPOINTER_TO_INT(t->data),
+                                   (int64_t)position);
+      }
+      if(!delta) continue;
+
+      res = TRUE;
+      if(undo_on)
+      {
+        dt_undo_tags_t *undotags = (dt_undo_tags_t *)malloc(sizeof(dt_undo_tags_t));
+        undotags->imgid = image_id;
+        undotags->before = action == DT_TA_DETACH ? delta : NULL;
+        undotags->after = action == DT_TA_ATTACH ? delta : NULL;
+        *undo = g_list_prepend(*undo, undotags);
+      }
+      else
+        g_list_free(delta);
+    }
+
+    GHashTableIter it;
+    gpointer value;
+    g_hash_table_iter_init(&it, attached);
+    while(g_hash_table_iter_next(&it, NULL, &value)) g_list_free((GList *)value);
+    g_hash_table_destroy(attached);
+
+    if(action == DT_TA_ATTACH && values)
+    {
+      values[strlen(values) - 1] = '\0';
+      _bulk_add_tags(values);
+    }
+    else if(action == DT_TA_DETACH && res)
+    {
+      query = g_strdup_printf("DELETE FROM main.tagged_images WHERE imgid IN (%s) AND tagid IN (%s)",
+                              img_list, tag_list);
+      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+      sqlite3_step(stmt);
+      sqlite3_finalize(stmt);
+      g_free(query);
+    }
+    g_free(values);
+    g_free(img_list);
+  }
+  g_free(tag_list);
+
+  if(undo_on) *undo = g_list_reverse(*undo);
+  return res;
+}
+
 static gboolean _tag_execute(const GList *tags, const GList *imgs, GList **undo, const gboolean undo_on,
                              const gint action)
 {
+  dt_database_start_transaction(darktable.db);
+  if(action == DT_TA_ATTACH || action == DT_TA_DETACH)
+  {
+    const gboolean res = _tag_execute_set(tags, imgs, undo, undo_on, action);
+    dt_database_release_transaction(darktable.db);
+    return res;
+  }
+
   const GList *images = imgs;
   gboolean res = FALSE;
   while(images)
@@ -399,14 +491,6 @@ static gboolean _tag_execute(const GList *tags, const GList *imgs, GList **undo,
     undotags->before = _tag_get_tags(image_id, DT_TAG_TYPE_ALL);
     switch(action)
     {
-      case DT_TA_ATTACH:
-        undotags->after = g_list_copy(undotags->before);
-        if(_tag_add_tags_to_list(&undotags->after, tags)) res = TRUE;
-        break;
-      case DT_TA_DETACH:
-        undotags->after = g_list_copy(undotags->before);
-        if(_tag_remove_tags_from_list(&undotags->after, tags)) res = TRUE;
-        break;
       case DT_TA_SET:
         undotags->after = g_list_copy((GList *)tags);
         // preserve dt tags
@@ -432,6 +516,7 @@ static gboolean _tag_execute(const GList *tags, const GList *imgs, GList **undo,
 
     images = g_list_next(images);
   }
+  dt_database_release_transaction(darktable.db);
   return res;
 }
 
@@ -1039,29 +1124,19 @@ uint32_t dt_tag_get_suggestions(GList **result)
 
   dt_set_darktable_tags();
 
-  /* list tags and count */
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "INSERT INTO memory.taglist (id, count)"
-                              " SELECT S.tagid, COUNT(*)"
-                              "  FROM main.tagged_images AS S"
-                              "  WHERE S.tagid NOT IN memory.darktable_tags"
-                              "  GROUP BY S.tagid",
-                              -1, &stmt, NULL);
-  sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
-
   const uint32_t nb_selected = dt_selected_images_count();
   /* Now put all the bits together */
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
                               "SELECT T.name, T.id, MT.count, CT.imgnb, T.flags, T.synonyms"
-                              "  FROM memory.taglist MT"
-                              "  JOIN data.tags T ON MT.id = T.id"
+                              "  FROM memory.tag_usage MT"
+                              "  JOIN data.tags T ON MT.tagid = T.id"
                               "  LEFT JOIN (SELECT tagid, COUNT(DISTINCT imgid) AS imgnb"
                               "             FROM main.tagged_images"
                               "             WHERE imgid IN (SELECT imgid FROM main.selected_images)"
                               "             GROUP BY tagid) AS CT"
-                              "    ON CT.tagid = MT.id"
-                              "  WHERE T.id NOT IN (SELECT DISTINCT tagid"
+                              "    ON CT.tagid = MT.tagid"
+                              "  WHERE MT.count > 0 AND T.id NOT IN memory.darktable_tags"
+                              "  AND T.id NOT IN (SELECT DISTINCT tagid"
                               "                     FROM (SELECT TI.tagid, COUNT(DISTINCT SI.imgid) AS imgnb"
                               "                           FROM main.selected_images AS SI"
                               "                           JOIN main.tagged_images AS TI ON TI.imgid = SI.imgid"
@@ -1094,7 +1169,6 @@ uint32_t dt_tag_get_suggestions(GList **result)
   }
 
   sqlite3_finalize(stmt);
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM memory.taglist", NULL, NULL, NULL);
 
   return count;
 }
@@ -1107,20 +1181,24 @@ void dt_tag_count_tags_images(const gchar *keyword, int *tag_count, int *img_cou
 
   if(!keyword) return;
   gchar *keyword_expr = g_strdup_printf("%s|", keyword);
+  // '}' follows '|': the children of keyword are a range of the tag name index
+  gchar *keyword_end = g_strdup_printf("%s}", keyword);
 
   /* Only select tags that are equal or child to the one we are looking for once. */
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
                               "INSERT INTO memory.similar_tags (tagid)"
                               "  SELECT id"
                               "    FROM data.tags"
-                              "    WHERE name = ?1 OR SUBSTR(name, 1, LENGTH(?2)) = ?2",
+                              "    WHERE name = ?1 OR (name > ?2 AND name < ?3)",
                               -1, &stmt, NULL);
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, keyword, -1, SQLITE_TRANSIENT);
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 2, keyword_expr, -1, SQLITE_TRANSIENT);
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 3, keyword_end, -1, SQLITE_TRANSIENT);
   sqlite3_step(stmt);
   sqlite3_finalize(stmt);
 
   g_free(keyword_expr);
+  g_free(keyword_end);
 
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
                               "SELECT COUNT(DISTINCT tagid) FROM memory.similar_tags",
@@ -1149,20 +1227,23 @@ void dt_tag_get_tags_images(const gchar *keyword, GList **tag_list, GList **img_
 
   if(!keyword) return;
   gchar *keyword_expr = g_strdup_printf("%s|", keyword);
+  gchar *keyword_end = g_strdup_printf("%s}", keyword);
 
-/* Only select tags that are equal or child to the one we are looking for once. */
+  /* Only select tags that are equal or child to the one we are looking for once. */
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
                               "INSERT INTO memory.similar_tags (tagid)"
                               "  SELECT id"
                               "  FROM data.tags"
-                              "  WHERE name = ?1 OR SUBSTR(name, 1, LENGTH(?2)) = ?2",
+                              "  WHERE name = ?1 OR (name > ?2 AND name < ?3)",
                               -1, &stmt, NULL);
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, keyword, -1, SQLITE_TRANSIENT);
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 2, keyword_expr, -1, SQLITE_TRANSIENT);
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 3, keyword_end, -1, SQLITE_TRANSIENT);
   sqlite3_step(stmt);
   sqlite3_finalize(stmt);
 
   g_free(keyword_expr);
+  g_free(keyword_end);
 
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
                               "SELECT ST.tagid, T.name"
@@ -1213,13 +1294,10 @@ uint32_t dt_tag_images_count(gint tagid)
   sqlite3_stmt *stmt;
 
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT COUNT(DISTINCT imgid) AS imgnb"
-                              " FROM main.tagged_images"
-                              " WHERE tagid = ?1",
+                              "SELECT count FROM memory.tag_usage WHERE tagid = ?1",
                               -1, &stmt, NULL);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
-  sqlite3_step(stmt);
-  const uint32_t nb_images = sqlite3_column_int(stmt, 0);
+  const uint32_t nb_images = sqlite3_step(stmt) == SQLITE_ROW ? sqlite3_column_int(stmt, 0) : 0;
   sqlite3_finalize(stmt);
   return nb_images;
 }
@@ -1230,23 +1308,13 @@ uint32_t dt_tag_get_with_usage(GList **result)
 
   dt_set_darktable_tags();
 
-  /* Select tags that are similar to the keyword and are actually used to tag images*/
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "INSERT INTO memory.taglist (id, count)"
-                              "  SELECT tagid, COUNT(*)"
-                              "  FROM main.tagged_images"
-                              "  GROUP BY tagid",
-                              -1, &stmt, NULL);
-  sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
-
   const uint32_t nb_selected = dt_selected_images_count();
 
   /* Now put all the bits together */
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
                               "SELECT T.name, T.id, MT.count, CT.imgnb, T.flags, T.synonyms"
                               "  FROM data.tags T "
-                              "  LEFT JOIN memory.taglist MT ON MT.id = T.id "
+                              "  LEFT JOIN memory.tag_usage MT ON MT.tagid = T.id "
                               "  LEFT JOIN (SELECT tagid, COUNT(DISTINCT imgid) AS imgnb"
                               "             FROM main.tagged_images "
                               "             WHERE imgid IN (SELECT imgid FROM main.selected_images) GROUP BY tagid) AS CT "
@@ -1276,7 +1344,6 @@ uint32_t dt_tag_get_with_usage(GList **result)
   }
 
   sqlite3_finalize(stmt);
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM memory.taglist", NULL, NULL, NULL);
 
   return count;
 }
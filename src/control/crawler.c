@@ -27,13 +27,17 @@
 #include "common/database.h"
 #include "common/history.h"
 #include "common/image.h"
+#include "common/image_cache.h"
 #include "control/conf.h"
+#include "control/control.h"
 #include "crawler.h"
 #include "gui/gtk.h"
 #ifdef GDK_WINDOWING_QUARTZ
 #include "osx/osx.h"
 #endif
 
+// images checked between two looks at the job state
+#define DT_CRAWLER_CHUNK 256
 
 typedef enum dt_control_crawler_cols_t
 {
@@ -56,143 +60,219 @@ typedef struct dt_control_crawler_result_t
 } dt_control_crawler_result_t;
 
 
-GList *dt_control_crawler_run()
+typedef struct dt_control_crawler_entry_t
 {
-  sqlite3_stmt *stmt, *inner_stmt;
+  int id, version, flags, new_flags;
+  time_t timestamp;     // write timestamp from the db
+  time_t timestamp_xmp; // mtime of the xmp file if it is newer than the db entry
+  gchar *image_path, *xmp_path;
+} dt_control_crawler_entry_t;
+
+// the file system part of the crawler. it touches neither the db nor the gui so it can run in parallel.
+static void _crawler_check_files(dt_control_crawler_entry_t *entry, const gboolean look_for_xmp)
+{
+  const gchar *image_path = entry->image_path;
+  const int id = entry->id;
+
+  // if the image is missing we ignore it.
+  if(!g_file_test(image_path, G_FILE_TEST_EXISTS))
+  {
+    dt_print(DT_DEBUG_CONTROL, "[crawler] `%s' (id: %d) is missing.\n", image_path, id);
+    return;
+  }
+
+  // no need to look for xmp files if none get written anyway.
+  if(look_for_xmp)
+  {
+    // construct the xmp filename for this image
+    gchar xmp_path[PATH_MAX] = { 0 };
+    g_strlcpy(xmp_path, image_path, sizeof(xmp_path));
+    dt_image_path_append_version_no_db(entry->version, xmp_path, sizeof(xmp_path));
+    size_t len = strlen(xmp_path);
+    if(len + 4 >= PATH_MAX) return;
+    xmp_path[len++] = '.';
+    xmp_path[len++] = 'x';
+    xmp_path[len++] = 'm';
+    xmp_path[len++] = 'p';
+    xmp_path[len] = '\0';
+
+    struct stat statbuf;
+    // on Windows the encoding might not be UTF8
+    gchar *xmp_path_locale = g_locale_from_utf8(xmp_path, -1, NULL, NULL, NULL);
+    const int stat_res = stat(xmp_path_locale, &statbuf);
+    g_free(xmp_path_locale);
+    if(stat_res == -1) return; // TODO: shall we report these?
+
+    // step 1: check if the xmp is newer than our db entry
+    // FIXME: allow for a few seconds difference?
+    if(entry->timestamp < statbuf.st_mtime)
+    {
+      entry->timestamp_xmp = statbuf.st_mtime;
+      entry->xmp_path = g_strdup(xmp_path);
+      dt_print(DT_DEBUG_CONTROL, "[crawler] `%s' (id: %d) is a newer xmp file.\n", xmp_path, id);
+    }
+    // older timestamps are the case for all images after the db upgrade. better not report these
+    //       else if(timestamp > statbuf.st_mtime)
+    //         printf("`%s' (%d) has an older xmp file.\n", image_path, id);
+  }
+
+  // step 2: check if the image has associated files (.txt, .wav)
+  size_t len = strlen(image_path);
+  const char *c = image_path + len;
+  while((c > image_path) && (*c != '.')) c--;
+  len = c - image_path + 1;
+
+  char *extra_path = (char *)calloc(len + 3 + 1, sizeof(char));
+  g_strlcpy(extra_path, image_path, len + 1);
+
+  extra_path[len] = 't';
+  extra_path[len + 1] = 'x';
+  extra_path[len + 2] = 't';
+  gboolean has_txt = g_file_test(extra_path, G_FILE_TEST_EXISTS);
+
+  if(!has_txt)
+  {
+    extra_path[len] = 'T';
+    extra_path[len + 1] = 'X';
+    extra_path[len + 2] = 'T';
+    has_txt = g_file_test(extra_path, G_FILE_TEST_EXISTS);
+  }
+
+  extra_path[len] = 'w';
+  extra_path[len + 1] = 'a';
+  extra_path[len + 2] = 'v';
+  gboolean has_wav = g_file_test(extra_path, G_FILE_TEST_EXISTS);
+
+  if(!has_wav)
+  {
+    extra_path[len] = 'W';
+    extra_path[len + 1] = 'A';
+    extra_path[len + 2] = 'V';
+    has_wav = g_file_test(extra_path, G_FILE_TEST_EXISTS);
+  }
+
+  // TODO: decide if we want to remove the flag for images that lost their extra file. currently we do (the
+  // else cases)
+  if(has_txt)
+    entry->new_flags |= DT_IMAGE_HAS_TXT;
+  else
+    entry->new_flags &= ~DT_IMAGE_HAS_TXT;
+  if(has_wav)
+    entry->new_flags |= DT_IMAGE_HAS_WAV;
+  else
+    entry->new_flags &= ~DT_IMAGE_HAS_WAV;
+
+  free(extra_path);
+}
+
+GList *dt_control_crawler_run(dt_job_t *job)
+{
+  sqlite3_stmt *stmt;
   GList *result = NULL;
-  gboolean look_for_xmp = dt_conf_get_bool("write_sidecar_files");
+  const gboolean look_for_xmp = dt_conf_get_bool("write_sidecar_files");
+  const double start = dt_get_wtime();
 
+  GArray *entries = g_array_new(FALSE, TRUE, sizeof(dt_control_crawler_entry_t));
   sqlite3_prepare_v2(dt_database_get(darktable.db),
                      "SELECT i.id, write_timestamp, version, folder || '" G_DIR_SEPARATOR_S "' || filename, flags "
                      "FROM main.images i, main.film_rolls f ON i.film_id = f.id ORDER BY f.id, filename",
                      -1, &stmt, NULL);
-  sqlite3_prepare_v2(dt_database_get(darktable.db), "UPDATE main.images SET flags = ?1 WHERE id = ?2", -1,
-                     &inner_stmt, NULL);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    dt_control_crawler_entry_t entry = { 0 };
+    entry.id = sqlite3_column_int(stmt, 0);
+    entry.timestamp = sqlite3_column_int(stmt, 1);
+    entry.version = sqlite3_column_int(stmt, 2);
+    entry.image_path = g_strdup((char *)sqlite3_column_text(stmt, 3));
+    entry.flags = entry.new_flags = sqlite3_column_int(stmt, 4);
+    g_array_append_val(entries, entry);
+  }
+  sqlite3_finalize(stmt);
 
-  // let's wrap this into a transaction, it might make it a little faster.
-  sqlite3_exec(dt_database_get(darktable.db), "BEGIN TRANSACTION", NULL, NULL, NULL);
+  // the stat() calls dominate, and they are latency bound on network shares: check several images at once
+  dt_control_crawler_entry_t *const list = (dt_control_crawler_entry_t *)entries->data;
+  const int count = entries->len;
+  int checked = 0;
+  while(checked < count && !(job && dt_control_job_get_state(job) == DT_JOB_STATE_CANCELLED))
+  {
+    const int first = checked;
+    const int last = MIN(first + DT_CRAWLER_CHUNK, count);
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(list, first, last, look_for_xmp) \
+  schedule(dynamic, 16)
+#endif
+    for(int k = first; k < last; k++)
+      _crawler_check_files(list + k, look_for_xmp);
+    checked = last;
+  }
+  // nobody is waiting for the list of a cancelled run
+  const gboolean cancelled = checked < count;
 
-  while(sqlite3_step(stmt) == SQLITE_ROW)
+  for(int k = 0; k < count; k++)
   {
-    const int id = sqlite3_column_int(stmt, 0);
-    const time_t timestamp = sqlite3_column_int(stmt, 1);
-    const int version = sqlite3_column_int(stmt, 2);
-    const gchar *image_path = (char *)sqlite3_column_text(stmt, 3);
-    int flags = sqlite3_column_int(stmt, 4);
-
-    // if the image is missing we ignore it.
-    if(!g_file_test(image_path, G_FILE_TEST_EXISTS))
+    dt_control_crawler_entry_t *entry = list + k;
+    if(k >= checked)
     {
-      dt_print(DT_DEBUG_CONTROL, "[crawler] `%s' (id: %d) is missing.\n", image_path, id);
+      g_free(entry->image_path);
       continue;
     }
-
-    // no need to look for xmp files if none get written anyway.
-    if(look_for_xmp)
+    if(entry->flags != entry->new_flags)
     {
-      // construct the xmp filename for this image
-      gchar xmp_path[PATH_MAX] = { 0 };
-      g_strlcpy(xmp_path, image_path, sizeof(xmp_path));
-      dt_image_path_append_version_no_db(version, xmp_path, sizeof(xmp_path));
-      size_t len = strlen(xmp_path);
-      if(len + 4 >= PATH_MAX) continue;
-      xmp_path[len++] = '.';
-      xmp_path[len++] = 'x';
-      xmp_path[len++] = 'm';
-      xmp_path[len++] = 'p';
-      xmp_path[len] = '\0';
-
-      struct stat statbuf;
-      // on Windows the encoding might not be UTF8
-      gchar *xmp_path_locale = g_locale_from_utf8(xmp_path, -1, NULL, NULL, NULL);
-      const int stat_res = stat(xmp_path_locale, &statbuf);
-      g_free(xmp_path_locale);
-      if(stat_res == -1) continue; // TODO: shall we report these?
-
-      // step 1: check if the xmp is newer than our db entry
-      // FIXME: allow for a few seconds difference?
-      if(timestamp < statbuf.st_mtime)
+      // the user may have changed other flags since we read them, only touch the extra file bits and go
+      // through the image cache so it doesn't write the old ones back later
+      const int extra = DT_IMAGE_HAS_TXT | DT_IMAGE_HAS_WAV;
+      dt_image_t *img = dt_image_cache_get(darktable.image_cache, entry->id, 'w');
+      if(img)
       {
-        dt_control_crawler_result_t *item
-            = (dt_control_crawler_result_t *)malloc(sizeof(dt_control_crawler_result_t));
-        item->id = id;
-        item->timestamp_xmp = statbuf.st_mtime;
-        item->timestamp_db = timestamp;
-        item->image_path = g_strdup(image_path);
-        item->xmp_path = g_strdup(xmp_path);
-
-        result = g_list_append(result, item);
-        dt_print(DT_DEBUG_CONTROL, "[crawler] `%s' (id: %d) is a newer xmp file.\n", xmp_path, id);
+        img->flags = (img->flags & ~extra) | (entry->new_flags & extra);
+        dt_image_cache_write_release(darktable.image_cache, img, DT_IMAGE_CACHE_RELAXED);
       }
-      // older timestamps are the case for all images after the db upgrade. better not report these
-      //       else if(timestamp > statbuf.st_mtime)
-      //         printf("`%s' (%d) has an older xmp file.\n", image_path, id);
     }
 
-    // step 2: check if the image has associated files (.txt, .wav)
-    size_t len = strlen(image_path);
-    const char *c = image_path + len;
-    while((c > image_path) && (*c != '.')) c--;
-    len = c - image_path + 1;
-
-    char *extra_path = (char *)calloc(len + 3 + 1, sizeof(char));
-    g_strlcpy(extra_path, image_path, len + 1);
-
-    extra_path[len] = 't';
-    extra_path[len + 1] = 'x';
-    extra_path[len + 2] = 't';
-    gboolean has_txt = g_file_test(extra_path, G_FILE_TEST_EXISTS);
-
-    if(!has_txt)
-    {
-      extra_path[len] = 'T';
-      extra_path[len + 1] = 'X';
-      extra_path[len + 2] = 'T';
-      has_txt = g_file_test(extra_path, G_FILE_TEST_EXISTS);
-    }
-
-    extra_path[len] = 'w';
-    extra_path[len + 1] = 'a';
-    extra_path[len + 2] = 'v';
-    gboolean has_wav = g_file_test(extra_path, G_FILE_TEST_EXISTS);
-
-    if(!has_wav)
+    if(entry->xmp_path && !cancelled)
     {
-      extra_path[len] = 'W';
-      extra_path[len + 1] = 'A';
-      extra_path[len + 2] = 'V';
-      has_wav = g_file_test(extra_path, G_FILE_TEST_EXISTS);
+      dt_control_crawler_result_t *item
+          = (dt_control_crawler_result_t *)malloc(sizeof(dt_control_crawler_result_t));
+      item->id = entry->id;
+      item->timestamp_xmp = entry->timestamp_xmp;
+      item->timestamp_db = entry->timestamp;
+      item->image_path = entry->image_path;
+      item->xmp_path = entry->xmp_path;
+      result = g_list_prepend(result, item);
     }
-
-    // TODO: decide if we want to remove the flag for images that lost their extra file. currently we do (the
-    // else cases)
-    int new_flags = flags;
-    if(has_txt)
-      new_flags |= DT_IMAGE_HAS_TXT;
-    else
-      new_flags &= ~DT_IMAGE_HAS_TXT;
-    if(has_wav)
-      new_flags |= DT_IMAGE_HAS_WAV;
     else
-      new_flags &= ~DT_IMAGE_HAS_WAV;
-    if(flags != new_flags)
     {
-      sqlite3_bind_int(inner_stmt, 1, new_flags);
-      sqlite3_bind_int(inner_stmt, 2, id);
-      sqlite3_step(inner_stmt);
-      sqlite3_reset(inner_stmt);
-      sqlite3_clear_bindings(inner_stmt);
+      g_free(entry->image_path);
+      g_free(entry->xmp_path);
     }
-
-    free(extra_path);
   }
 
-  sqlite3_exec(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
+  g_array_free(entries, TRUE);
 
-  sqlite3_finalize(stmt);
-  sqlite3_finalize(inner_stmt);
+  dt_print(DT_DEBUG_PERF, "[crawler] checked %d images in %.3f secs\n", checked, dt_get_wtime() - start);
 
-  return result;
+  return g_list_reverse(result);
+}
+
+static gboolean _crawler_show_image_list(gpointer user_data)
+{
+  dt_control_crawler_show_image_list((GList *)user_data);
+  return FALSE;
+}
+
+static int32_t _crawler_job_run(dt_job_t *job)
+{
+  GList *images = dt_control_crawler_run(job);
+  // the popup has to be built by the gui thread
+  if(images) g_main_context_invoke(NULL, _crawler_show_image_list, images);
+  return 0;
+}
+
+void dt_control_crawler_run_job()
+{
+  dt_control_add_job(darktable.control, DT_JOB_QUEUE_SYSTEM_BG,
+                     dt_control_job_create(&_crawler_job_run, "crawl xmp sidecars"));
 }
 
 
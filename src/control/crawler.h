@@ -19,19 +19,23 @@
 #pragma once
 
 #include <glib.h>
+#include "control/jobs.h"
 
-/** this isn't a background job on purpose. it has to be really fast so it shouldn't
- *  require locking from image cache or anything like that.
- *  should we find out that we want to have a background job that crawls over all images
- *  we can maybe refactor this, but for now it's good the way it is.
+/** the crawler checks the file system without any locks, then updates the txt/wav flags of the
+ *  images it found changed through the image cache. it runs as a background job on startup so
+ *  that large libraries don't delay the gui, the popup shows up once it is done.
  */
 
 // this function iterates over ALL images from the database and checks whether
 // - the XMP file on disk is newer than the timestamp from db
 // - there is a .txt or .wav file associated with the image and mark so in the db
 //   or if such a file no longer exists
-// it returns the list of images with a (supposedly) updated xmp file to let the user decide
-GList *dt_control_crawler_run();
+// it returns the list of images with a (supposedly) updated xmp file to let the user decide.
+// job may be NULL, if it gets cancelled the images not checked yet are left alone and NULL is returned
+GList *dt_control_crawler_run(dt_job_t *job);
+
+// run the crawler as a background job and show the popup from the gui thread if anything was found
+void dt_control_crawler_run_job();
 
 // show a popup with the images, let the user decide what to do and free the list afterwards
 void dt_control_crawler_show_image_list(GList *images);
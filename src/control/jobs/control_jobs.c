@@ -25,6 +25,7 @@
 #include "common/image.h"
 #include "common/image_cache.h"
 #include "common/imageio.h"
+#include "common/imageio_encoder.h"
 #include "common/imageio_dng.h"
 #include "common/imageio_module.h"
 #include "common/mipmap_cache.h"
@@ -48,6 +49,10 @@
 #include "win/dtwin.h"
 #endif
 
+// threads encoding and writing finished exports, and how many images may wait for them
+#define DT_CONTROL_EXPORT_ENCODERS 2
+#define DT_CONTROL_EXPORT_ENCODER_DEPTH 2
+
 typedef struct dt_control_time_offset_t
 {
   long int offset;
@@ -597,6 +602,10 @@ static int32_t dt_control_delete_images_job_run(dt_job_t *job)
     snprintf(message, sizeof(message), ngettext("deleting %d image", "deleting %d images", total), total);
 
   dt_control_job_set_progress_message(job, message);
+
+  // pending sidecars must not reappear after they were deleted
+  dt_image_cache_flush_sidecars(darktable.image_cache);
+
   sqlite3_stmt *stmt;
   dt_collection_update(darktable.collection);
 
@@ -763,6 +772,26 @@ static int32_t dt_control_local_copy_images_job_run(dt_job_t *job)
   return 0;
 }
 
+static int32_t dt_control_compress_history_job_run(dt_job_t *job)
+{
+  dt_control_image_enumerator_t *params = (dt_control_image_enumerator_t *)dt_control_job_get_params(job);
+  const guint total = g_list_length(params->index);
+  char message[512] = { 0 };
+  snprintf(message, sizeof(message), ngettext("compressing history of %d image", "compressing history of %d images", total), total);
+  dt_control_job_set_progress_message(job, message);
+
+  const int missing = dt_history_compress_on_list_ext(params->index, job);
+
+  dt_collection_update_query(darktable.collection, DT_COLLECTION_CHANGE_RELOAD, g_list_copy(params->index));
+  dt_control_queue_redraw_center();
+
+  if(missing)
+    dt_control_log(ngettext("no history compression of %d image, see tag: darktable|problem|history-compress",
+                            "no history compression of %d images, see tag: darktable|problem|history-compress",
+                            missing), missing);
+  return 0;
+}
+
 static int32_t dt_control_refresh_exif_run(dt_job_t *job)
 {
   dt_control_image_enumerator_t *params = (dt_control_image_enumerator_t *)dt_control_job_get_params(job);
@@ -807,6 +836,25 @@ static int32_t dt_control_refresh_exif_run(dt_job_t *job)
   return 0;
 }
 
+static gboolean _export_tag_images(GList *imgs, const guint tagid, const guint etagid)
+{
+  gboolean tag_change = FALSE;
+  dt_database_start_transaction(darktable.db);
+  // remove 'changed' tag from the images
+  if(dt_tag_detach_images(tagid, imgs, FALSE))
+    tag_change = TRUE;
+  // make sure the 'exported' tag is set on the images
+  if(dt_tag_attach_images(etagid, imgs, FALSE))
+    tag_change = TRUE;
+  dt_database_release_transaction(darktable.db);
+
+  // register export timestamps in cache. this takes the image cache lock, keep it out of the transaction
+  for(const GList *i = imgs; i; i = g_list_next(i))
+    dt_image_cache_set_export_timestamp(darktable.image_cache, GPOINTER_TO_INT(i->data));
+
+  return tag_change;
+}
+
 static int32_t dt_control_export_job_run(dt_job_t *job)
 {
   dt_control_image_enumerator_t *params = (dt_control_image_enumerator_t *)dt_control_job_get_params(job);
@@ -819,6 +867,8 @@ static int32_t dt_control_export_job_run(dt_job_t *job)
   dt_imageio_module_data_t *sdata = settings->sdata;
 
   gboolean tag_change = FALSE;
+  // files the encoder threads failed to write
+  int failed = 0;
   // get a thread-safe fdata struct (one jpeg struct per thread etc):
   dt_imageio_module_data_t *fdata = mformat->get_params(mformat);
 
@@ -867,6 +917,16 @@ static int32_t dt_control_export_job_run(dt_job_t *job)
     metadata.list = g_list_remove(metadata.list, metadata.list->data);
   }
 
+  // write the files in the background while the next image is processed
+  dt_imageio_encoder_t *encoder = NULL;
+  if(mstorage->flags(mstorage) & STORAGE_FLAGS_ASYNC_WRITE)
+  {
+    encoder = dt_imageio_encoder_new(DT_CONTROL_EXPORT_ENCODERS, DT_CONTROL_EXPORT_ENCODER_DEPTH);
+    dt_imageio_encoder_set_current(encoder);
+  }
+
+  // images stored successfully, tagged once the export is over
+  GList *exported = NULL;
   while(t && dt_control_job_get_state(job) != DT_JOB_STATE_CANCELLED)
   {
     const int imgid = GPOINTER_TO_INT(t->data);
@@ -877,14 +937,6 @@ static int32_t dt_control_export_job_run(dt_job_t *job)
     snprintf(message, sizeof(message), _("exporting %d / %d to %s"), num, total, mstorage->name(mstorage));
     // update the message. initialize_store() might have changed the number of images
     dt_control_job_set_progress_message(job, message);
-    // remove 'changed' tag from image
-    if(dt_tag_detach(tagid, imgid, FALSE, FALSE))
-      tag_change = TRUE;
-    // make sure the 'exported' tag is set on the image
-    if(dt_tag_attach(etagid, imgid, FALSE, FALSE))
-      tag_change = TRUE;
-    // register export timestamp in cache
-    dt_image_cache_set_export_timestamp(darktable.image_cache, imgid);
     // check if image still exists:
     const dt_image_t *image = dt_image_cache_get(darktable.image_cache, (int32_t)imgid, 'r');
 
@@ -907,6 +959,8 @@ static int32_t dt_control_export_job_run(dt_job_t *job)
         if(mstorage->store(mstorage, sdata, imgid, mformat, fdata, num, total, settings->high_quality, settings->upscale,
                            settings->icc_type, settings->icc_filename, settings->icc_intent, &metadata) != 0)
           dt_control_job_cancel(job);
+        else
+          exported = g_list_prepend(exported, GINT_TO_POINTER(imgid));
       }
     }
 
@@ -918,6 +972,28 @@ static int32_t dt_control_export_job_run(dt_job_t *job)
     dt_control_job_set_progress(job, fraction);
   }
 
+  if(encoder)
+  {
+    dt_imageio_encoder_set_current(NULL);
+    // store() only queued the files, don't tag the images whose file could not be written
+    GList *failed_ids = NULL;
+    failed = dt_imageio_encoder_finish(encoder, &failed_ids);
+    if(failed)
+    {
+      dt_control_log(ngettext("%d exported image could not be written", "%d exported images could not be written",
+                              failed), failed);
+      for(GList *f = failed_ids; f; f = g_list_next(f)) exported = g_list_remove(exported, f->data);
+      g_list_free(failed_ids);
+    }
+  }
+
+  if(exported)
+  {
+    exported = g_list_reverse(exported);
+    tag_change = _export_tag_images(exported, tagid, etagid);
+    g_list_free(exported);
+  }
+
   g_list_free_full(metadata.list, g_free);
 
   if(mstorage->finalize_store)
@@ -932,7 +1008,7 @@ end:
   if(tag_change)
     dt_control_signal_raise(darktable.signals, DT_SIGNAL_TAG_CHANGED);
 
-  return 0;
+  return failed ? 1 : 0;
 }
 
 void dt_control_duplicate_images()
@@ -1214,6 +1290,14 @@ void dt_control_reset_local_copy_images()
                                                           FALSE));
 }
 
+void dt_control_compress_history()
+{
+  dt_control_add_job(darktable.control, DT_JOB_QUEUE_USER_FG,
+                     dt_control_generic_images_job_create(&dt_control_compress_history_job_run,
+                                                          N_("compress history"), 0, NULL, PROGRESS_CANCELLABLE,
+                                                          TRUE));
+}
+
 void dt_control_refresh_exif()
 {
   dt_control_add_job(darktable.control, DT_JOB_QUEUE_USER_FG,
@@ -48,6 +48,7 @@ void dt_control_export(GList *imgid_list, int max_width, int max_height, int for
 void dt_control_seed_denoise();
 void dt_control_denoise();
 void dt_control_refresh_exif();
+void dt_control_compress_history();
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
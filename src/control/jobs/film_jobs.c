@@ -17,7 +17,9 @@
 */
 #include "control/jobs/film_jobs.h"
 #include "common/darktable.h"
+#include "common/database.h"
 #include "common/film.h"
+#include <glib/gstdio.h>
 #include <stdlib.h>
 
 typedef struct dt_film_import1_t
@@ -133,11 +135,84 @@ int _film_filename_cmp(gchar *a, gchar *b)
   return ret;
 }
 
+// files read ahead of the importing thread, at most
+#define DT_FILM_IMPORT_LOOKAHEAD 64
+// bytes of each image read ahead, enough for the headers exiv2 and the loaders look at
+#define DT_FILM_IMPORT_PREFETCH_SIZE (512 * 1024)
+// images imported in one database transaction, and the longest such a transaction is held
+#define DT_FILM_IMPORT_BATCH_SIZE 64
+#define DT_FILM_IMPORT_BATCH_TIME 0.5
+
+typedef struct dt_film_import_prefetch_t
+{
+  gchar **files;
+  int count;
+  int next;          // next file to be claimed by a reader
+  int imported;      // files done by the importing thread
+  gboolean *ready;
+  gboolean stop;
+  dt_pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  // stage counters, protected by mutex
+  size_t bytes;
+  double read_time;
+} dt_film_import_prefetch_t;
+
+static size_t _film_import_read_file(const gchar *filename, char *buf, const size_t size)
+{
+  FILE *f = g_fopen(filename, "rb");
+  if(!f) return 0;
+  const size_t len = fread(buf, 1, size, f);
+  fclose(f);
+  return len;
+}
+
+/* the reader threads pull the beginning of every file and its sidecar into the page cache,
+   so that the importing thread, which has to parse them one by one while holding the
+   database, does not wait for the disk. */
+static void *_film_import_prefetch(void *arg)
+{
+  dt_film_import_prefetch_t *p = (dt_film_import_prefetch_t *)arg;
+  char *buf = g_malloc(DT_FILM_IMPORT_PREFETCH_SIZE);
+
+  while(TRUE)
+  {
+    dt_pthread_mutex_lock(&p->mutex);
+    while(!p->stop && p->next < p->count && p->next - p->imported >= DT_FILM_IMPORT_LOOKAHEAD)
+      dt_pthread_cond_wait(&p->cond, &p->mutex);
+    if(p->stop || p->next >= p->count)
+    {
+      dt_pthread_mutex_unlock(&p->mutex);
+      break;
+    }
+    const int i = p->next++;
+    dt_pthread_mutex_unlock(&p->mutex);
+
+    const double start = dt_get_wtime();
+    size_t bytes = _film_import_read_file(p->files[i], buf, DT_FILM_IMPORT_PREFETCH_SIZE);
+    gchar *xmp = g_strconcat(p->files[i], ".xmp", NULL);
+    bytes += _film_import_read_file(xmp, buf, DT_FILM_IMPORT_PREFETCH_SIZE);
+    g_free(xmp);
+    const double end = dt_get_wtime();
+
+    dt_pthread_mutex_lock(&p->mutex);
+    p->ready[i] = TRUE;
+    p->bytes += bytes;
+    p->read_time += end - start;
+    pthread_cond_broadcast(&p->cond);
+    dt_pthread_mutex_unlock(&p->mutex);
+  }
+
+  g_free(buf);
+  return NULL;
+}
+
 static void dt_film_import1(dt_job_t *job, dt_film_t *film)
 {
   gboolean recursive = dt_conf_get_bool("ui_last/import_recursive");
 
   /* first of all gather all images to import */
+  const double scan_start = dt_get_wtime();
   GList *images = NULL;
   images = _film_recursive_get_files(film->dirname, recursive, &images);
   if(g_list_length(images) == 0)
@@ -146,25 +221,58 @@ static void dt_film_import1(dt_job_t *job, dt_film_t *film)
     return;
   }
 
-  if(g_list_length(images) == 0)
-    return;
-
   /* we got ourself a list of images, lets sort and start import */
   images = g_list_sort(images, (GCompareFunc)_film_filename_cmp);
+  const double scan_end = dt_get_wtime();
+
   /* let's start import of images */
   gchar message[512] = { 0 };
   double fraction = 0;
-  guint total = g_list_length(images);
+  const int total = g_list_length(images);
   g_snprintf(message, sizeof(message) - 1, ngettext("importing %d image", "importing %d images", total), total);
   dt_control_job_set_progress_message(job, message);
 
-
-  /* loop thru the images and import to current film roll */
+  /* start the readers */
+  dt_film_import_prefetch_t prefetch = { 0 };
+  prefetch.files = g_malloc(sizeof(gchar *) * total);
+  prefetch.ready = g_malloc0(sizeof(gboolean) * total);
+  prefetch.count = total;
+  int k = 0;
+  for(GList *image = images; image; image = g_list_next(image)) prefetch.files[k++] = (gchar *)image->data;
+  dt_pthread_mutex_init(&prefetch.mutex, NULL);
+  pthread_cond_init(&prefetch.cond, NULL);
+
+  const int num_readers = CLAMP((int)dt_get_num_threads(), 1, 4);
+  pthread_t *readers = g_malloc(sizeof(pthread_t) * num_readers);
+  int started = 0;
+  for(int i = 0; i < num_readers; i++)
+    if(!dt_pthread_create(&readers[started], _film_import_prefetch, &prefetch)) started++;
+
+  /* loop thru the images and import to current film roll. this thread is the only one
+     writing, images are committed in batches instead of one transaction per statement. */
+  const double import_start = dt_get_wtime();
+  double batch_start = import_start;
+  double wait_time = 0.0;
+  int batch = 0;
   dt_film_t *cfr = film;
-  GList *image = g_list_first(images);
-  do
+  dt_database_start_transaction(darktable.db);
+  for(int i = 0; i < total; i++)
   {
-    gchar *cdn = g_path_get_dirname((const gchar *)image->data);
+    const gchar *filename = prefetch.files[i];
+
+    // wait for the readers, if none could be started import straight from the disk
+    if(started)
+    {
+      const double wait_start = dt_get_wtime();
+      dt_pthread_mutex_lock(&prefetch.mutex);
+      prefetch.imported = i;
+      pthread_cond_broadcast(&prefetch.cond);
+      while(!prefetch.ready[i]) dt_pthread_cond_wait(&prefetch.cond, &prefetch.mutex);
+      dt_pthread_mutex_unlock(&prefetch.mutex);
+      wait_time += dt_get_wtime() - wait_start;
+    }
+
+    gchar *cdn = g_path_get_dirname(filename);
 
     /* check if we need to initialize a new filmroll */
     if(!cfr || g_strcmp0(cfr->dirname, cdn) != 0)
@@ -189,14 +297,48 @@ static void dt_film_import1(dt_job_t *job, dt_film_t *film)
     g_free(cdn);
 
     /* import image */
-    dt_image_import(cfr->id, (const gchar *)image->data, FALSE);
+    dt_image_import(cfr->id, filename, FALSE);
+
+    /* give other threads a chance to get to the database now and then */
+    const double now = dt_get_wtime();
+    if(++batch >= DT_FILM_IMPORT_BATCH_SIZE || now - batch_start > DT_FILM_IMPORT_BATCH_TIME)
+    {
+      dt_database_yield_transaction(darktable.db);
+      batch = 0;
+      batch_start = now;
+    }
 
     fraction += 1.0 / total;
     dt_control_job_set_progress(job, fraction);
+  }
+  dt_database_release_transaction(darktable.db);
+  const double import_end = dt_get_wtime();
 
+  dt_pthread_mutex_lock(&prefetch.mutex);
+  prefetch.stop = TRUE;
+  pthread_cond_broadcast(&prefetch.cond);
+  dt_pthread_mutex_unlock(&prefetch.mutex);
+  for(int i = 0; i < started; i++) pthread_join(readers[i], NULL);
 
-  } while((image = g_list_next(image)) != NULL);
+  if(darktable.unmuted & DT_DEBUG_PERF)
+  {
+    const double scan = MAX(scan_end - scan_start, 1e-6);
+    const double import = MAX(import_end - import_start, 1e-6);
+    dt_print(DT_DEBUG_PERF, "[film_import] scan: %d files in %.3f secs (%.1f files/s)\n", total, scan, total / scan);
+    dt_print(DT_DEBUG_PERF,
+             "[film_import] read ahead: %d threads, %.1f MiB, %.3f secs busy (%.1f files/s)\n",
+             started, prefetch.bytes / (1024.0 * 1024.0), prefetch.read_time,
+             started ? total / MAX(prefetch.read_time / started, 1e-6) : 0.0);
+    dt_print(DT_DEBUG_PERF,
+             "[film_import] import: %d files in %.3f secs (%.1f files/s), %.3f secs waiting for reads\n",
+             total, import, total / import, wait_time);
+  }
 
+  pthread_cond_destroy(&prefetch.cond);
+  dt_pthread_mutex_destroy(&prefetch.mutex);
+  g_free(readers);
+  g_free(prefetch.ready);
+  g_free(prefetch.files);
   g_list_free_full(images, g_free);
 
   // only redraw at the end, to not spam the cpu with exposure events
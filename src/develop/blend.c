@@ -57,95 +57,6 @@ static inline void _PX_COPY(const float *src, float *dst)
   dst[2] = src[2];
 }
 
-static inline float _blendif_factor(dt_iop_colorspace_type_t cst, const float *input, const float *output,
-                                    const unsigned int blendif, const float *parameters,
-                                    const unsigned int mask_mode, const unsigned int mask_combine,
-                                    const dt_iop_order_iccprofile_info_t *work_profile)
-{
-  float result = 1.0f;
-  float scaled[DEVELOP_BLENDIF_SIZE] = { 0.5f };
-  unsigned int channel_mask = 0;
-
-  if(!(mask_mode & DEVELOP_MASK_CONDITIONAL)) return (mask_combine & DEVELOP_COMBINE_INCL) ? 0.0f : 1.0f;
-
-  switch(cst)
-  {
-    case iop_cs_Lab:
-      scaled[DEVELOP_BLENDIF_L_in] = clamp_range_f(input[0] / 100.0f, 0.0f, 1.0f); // L scaled to 0..1
-      scaled[DEVELOP_BLENDIF_A_in]
-          = clamp_range_f((input[1] + 128.0f) / 256.0f, 0.0f, 1.0f); // a scaled to 0..1
-      scaled[DEVELOP_BLENDIF_B_in]
-          = clamp_range_f((input[2] + 128.0f) / 256.0f, 0.0f, 1.0f); // b scaled to 0..1
-      scaled[DEVELOP_BLENDIF_L_out] = clamp_range_f(output[0] / 100.0f, 0.0f, 1.0f); // L scaled to 0..1
-      scaled[DEVELOP_BLENDIF_A_out]
-          = clamp_range_f((output[1] + 128.0f) / 256.0f, 0.0f, 1.0f); // a scaled to 0..1
-      scaled[DEVELOP_BLENDIF_B_out]
-          = clamp_range_f((output[2] + 128.0f)/256.0f, 0.0f, 1.0f); // b scaled to 0..1
-      channel_mask = DEVELOP_BLENDIF_Lab_MASK;
-      break;
-    case iop_cs_rgb:
-      if(work_profile == NULL)
-        scaled[DEVELOP_BLENDIF_GRAY_in] = clamp_range_f(0.3f * input[0] + 0.59f * input[1] 
-                                                        + 0.11f * input[2], 0.0f, 1.0f);
-      else
-        scaled[DEVELOP_BLENDIF_GRAY_in] = clamp_range_f(dt_ioppr_get_rgb_matrix_luminance(input,
-                                                            work_profile->matrix_in), 0.0f, 1.0f);
-
-      scaled[DEVELOP_BLENDIF_RED_in] = clamp_range_f(input[0], 0.0f, 1.0f);   // Red
-      scaled[DEVELOP_BLENDIF_GREEN_in] = clamp_range_f(input[1], 0.0f, 1.0f); // Green
-      scaled[DEVELOP_BLENDIF_BLUE_in] = clamp_range_f(input[2], 0.0f, 1.0f);  // Blue
-
-      if(work_profile == NULL)
-        scaled[DEVELOP_BLENDIF_GRAY_out] = clamp_range_f(0.3f * output[0] + 0.59f * output[1]
-                                                         + 0.11f * output[2], 0.0f, 1.0f);
-      else
-        scaled[DEVELOP_BLENDIF_GRAY_out] = clamp_range_f(dt_ioppr_get_rgb_matrix_luminance(output,
-                                                             work_profile->matrix_in), 0.0f, 1.0f);
-
-      scaled[DEVELOP_BLENDIF_RED_out] = clamp_range_f(output[0], 0.0f, 1.0f);   // Red
-      scaled[DEVELOP_BLENDIF_GREEN_out] = clamp_range_f(output[1], 0.0f, 1.0f); // Green
-      scaled[DEVELOP_BLENDIF_BLUE_out] = clamp_range_f(output[2], 0.0f, 1.0f);  // Blue
-      channel_mask = DEVELOP_BLENDIF_RGB_MASK;
-
-      break;
-    default:
-      return (mask_combine & DEVELOP_COMBINE_INCL) ? 0.0f : 1.0f; // not implemented for other color spaces
-  }
-
-  for(int ch = 0; ch <= DEVELOP_BLENDIF_MAX; ch++)
-  {
-    if((channel_mask & (1 << ch)) == 0) continue; // skip blendif channels not used in this color space
-
-    if((blendif & (1 << ch)) == 0) // deal with channels where sliders span the whole range
-    {
-      result *= !(blendif & (1 << (ch + 16))) == !(mask_combine & DEVELOP_COMBINE_INCL) ? 1.0f : 0.0f;
-      continue;
-    }
-
-    if(result <= 0.000001f) break; // no need to continue if we are already at or close to zero
-
-    float factor;
-
-    if(scaled[ch] >= parameters[4 * ch + 1] && scaled[ch] <= parameters[4 * ch + 2])
-      factor = 1.0f;
-    else if(scaled[ch] > parameters[4 * ch + 0] && scaled[ch] < parameters[4 * ch + 1]) 
-      factor = (scaled[ch] - parameters[4 * ch + 0]) 
-                      / fmaxf(0.01f, parameters[4 * ch + 1] - parameters[4 * ch + 0]); 
-    else if(scaled[ch] > parameters[4 * ch + 2] && scaled[ch] < parameters[4 * ch + 3]) 
-      factor = 1.0f - (scaled[ch] - parameters[4 * ch + 2])
-                      / fmaxf(0.01f, parameters[4 * ch + 3] - parameters[4 * ch + 2]); 
-    else
-      factor = 0.0f;
-
-    if((blendif & (1 << (ch + 16))) != 0)
-      factor = 1.0f - factor; // inverted channel?
-
-    result *= ((mask_combine & DEVELOP_COMBINE_INCL) ? 1.0f - factor : factor);
-  }
-
-  return (mask_combine & DEVELOP_COMBINE_INCL) ? 1.0f - result : result;
-}
-
 static inline void _blend_colorspace_channel_range(dt_iop_colorspace_type_t cst, float *min, float *max)
 {
   switch(cst)
@@ -193,25 +104,188 @@ static inline void _blend_noop(const _blend_buffer_desc_t *bd, const float *a, f
   for(size_t i = 0, j = 0; j < bd->stride; i++, j += bd->ch)
   {
     for(int k = 0; k < bd->bch; k++) b[j + k] =clamp_range_f(a[j+k], min ? min[k] : -INFINITY, max ? max[k] : INFINITY);
-    if(bd->cst != iop_cs_RAW) b[j + 3] = mask[i];
+    if(bd->cst != iop_cs_RAW && bd->ch == 4) b[j + 3] = mask[i];
   }
 }
 
-/* generate blend mask */
+// the parametric mask is computed on blocks of pixels so that each blendif channel can be scaled
+// and evaluated in tight, vectorizable loops instead of per pixel with all the branching on
+// colorspace and channel selection.
+#define BLEND_BLOCK_SIZE 64
+
+/* scale one blendif channel of a block of pixels to 0..1. channels without a conversion in the
+ * given colorspace read as 0, like the per-pixel code did. */
+static inline void _blendif_scale_channel(const dt_iop_colorspace_type_t cst, const int channel,
+                                          const float *const restrict input, const float *const restrict output,
+                                          const size_t ch, const size_t n, float *const restrict scaled,
+                                          const dt_iop_order_iccprofile_info_t *const work_profile)
+{
+  // channels 0..3 and 8..11 look at the module input, 4..7 and 12..15 at its output
+  const float *const restrict px = (channel & 4) ? output : input;
+  const int c = channel & 3;
+
+  if(channel >= 8 || (cst != iop_cs_Lab && cst != iop_cs_rgb) || (cst == iop_cs_Lab && c == 3))
+  {
+    memset(scaled, 0, sizeof(float) * n);
+    return;
+  }
+
+  if(ch == 1)
+  {
+    // gray buffer: L, gray and r, g, b all read the one channel, a and b are neutral
+    const gboolean chroma = (cst == iop_cs_Lab && c != 0);
+    const float scale = (cst == iop_cs_Lab) ? 1.0f / 100.0f : 1.0f;
+#ifdef _OPENMP
+#pragma omp simd aligned(scaled:64)
+#endif
+    for(size_t i = 0; i < n; i++)
+      scaled[i] = chroma ? 0.5f : clamp_range_f(px[i] * scale, 0.0f, 1.0f);
+    return;
+  }
+
+  if(cst == iop_cs_Lab)
+  {
+    if(c == 0)
+    {
+#ifdef _OPENMP
+#pragma omp simd aligned(scaled:64)
+#endif
+      for(size_t i = 0; i < n; i++)
+        scaled[i] = clamp_range_f(px[i * ch] / 100.0f, 0.0f, 1.0f); // L scaled to 0..1
+    }
+    else
+    {
+#ifdef _OPENMP
+#pragma omp simd aligned(scaled:64)
+#endif
+      for(size_t i = 0; i < n; i++)
+        scaled[i] = clamp_range_f((px[i * ch + c] + 128.0f) / 256.0f, 0.0f, 1.0f); // a, b scaled to 0..1
+    }
+  }
+  else if(c == 0)
+  {
+    // gray
+    const float w0 = work_profile ? work_profile->matrix_in[3] : 0.3f;
+    const float w1 = work_profile ? work_profile->matrix_in[4] : 0.59f;
+    const float w2 = work_profile ? work_profile->matrix_in[5] : 0.11f;
+#ifdef _OPENMP
+#pragma omp simd aligned(scaled:64)
+#endif
+    for(size_t i = 0; i < n; i++)
+      scaled[i] = clamp_range_f(w0 * px[i * ch] + w1 * px[i * ch + 1] + w2 * px[i * ch + 2], 0.0f, 1.0f);
+  }
+  else
+  {
+    // red, green, blue
+#ifdef _OPENMP
+#pragma omp simd aligned(scaled:64)
+#endif
+    for(size_t i = 0; i < n; i++)
+      scaled[i] = clamp_range_f(px[i * ch + c - 1], 0.0f, 1.0f);
+  }
+}
+
+/* multiply the factor of one blendif channel into the running result of a block */
+static inline void _blendif_combine_channel(const float *const restrict scaled, float *const restrict result,
+                                            const size_t n, const float *const parameters,
+                                            const gboolean invert, const gboolean incl)
+{
+  const float p0 = parameters[0];
+  const float p1 = parameters[1];
+  const float p2 = parameters[2];
+  const float p3 = parameters[3];
+  const float rise = 1.0f / fmaxf(0.01f, p1 - p0);
+  const float fall = 1.0f / fmaxf(0.01f, p3 - p2);
+
+#ifdef _OPENMP
+#pragma omp simd aligned(scaled, result:64)
+#endif
+  for(size_t i = 0; i < n; i++)
+  {
+    const float s = scaled[i];
+    float factor;
+
+    if(s >= p1 && s <= p2)
+      factor = 1.0f;
+    else if(s > p0 && s < p1)
+      factor = (s - p0) * rise;
+    else if(s > p2 && s < p3)
+      factor = 1.0f - (s - p2) * fall;
+    else
+      factor = 0.0f;
+
+    if(invert) factor = 1.0f - factor; // inverted channel?
+
+    result[i] *= incl ? 1.0f - factor : factor;
+  }
+}
+
+/* generate blend mask: combine the drawn mask already in mask[] with the parametric one and apply
+ * the global opacity */
 static void _blend_make_mask(const _blend_buffer_desc_t *bd, const unsigned int blendif,
                              const float *blendif_parameters, const unsigned int mask_mode,
                              const unsigned int mask_combine, const float gopacity, const float *a, const float *b,
                              float *mask, const dt_iop_order_iccprofile_info_t *const work_profile)
 {
-  for(size_t i = 0, j = 0; j < bd->stride; i++, j += bd->ch)
+  const gboolean incl = (mask_combine & DEVELOP_COMBINE_INCL) != 0;
+  const gboolean inv = (mask_combine & DEVELOP_COMBINE_INV) != 0;
+  const size_t width = bd->stride / bd->ch;
+
+  unsigned int channel_mask = 0;
+  if(mask_mode & DEVELOP_MASK_CONDITIONAL)
+  {
+    if(bd->cst == iop_cs_Lab)
+      channel_mask = DEVELOP_BLENDIF_Lab_MASK;
+    else if(bd->cst == iop_cs_rgb)
+      channel_mask = DEVELOP_BLENDIF_RGB_MASK; // not implemented for other color spaces
+  }
+
+  // channels where sliders span the whole range contribute a constant factor
+  float constant = 1.0f;
+  unsigned int active = 0;
+  for(int c = 0; c <= DEVELOP_BLENDIF_MAX; c++)
   {
-    float form = mask[i];
-    float conditional = _blendif_factor(bd->cst, &a[j], &b[j], blendif, blendif_parameters, mask_mode,
-                                        mask_combine, work_profile);
-    float opacity = (mask_combine & DEVELOP_COMBINE_INCL)
-                     ? 1.0f - (1.0f - form) * (1.0f - conditional) : form * conditional;
-    opacity = (mask_combine & DEVELOP_COMBINE_INV) ? 1.0f - opacity : opacity;
-    mask[i] = opacity * gopacity;
+    if((channel_mask & (1 << c)) == 0) continue; // skip blendif channels not used in this color space
+
+    if(blendif & (1 << c))
+      active |= 1 << c;
+    else
+      constant *= !(blendif & (1 << (c + 16))) == !incl ? 1.0f : 0.0f;
+  }
+
+  float result[BLEND_BLOCK_SIZE] DT_ALIGNED_ARRAY;
+  float scaled[BLEND_BLOCK_SIZE] DT_ALIGNED_ARRAY;
+
+  for(size_t x0 = 0; x0 < width; x0 += BLEND_BLOCK_SIZE)
+  {
+    const size_t n = MIN(BLEND_BLOCK_SIZE, width - x0);
+    const float *const in = a + x0 * bd->ch;
+    const float *const out = b + x0 * bd->ch;
+    float *const m = mask + x0;
+
+    for(size_t i = 0; i < n; i++) result[i] = constant;
+
+    if(constant > 0.0f)
+      for(int c = 0; c <= DEVELOP_BLENDIF_MAX; c++)
+      {
+        if((active & (1 << c)) == 0) continue;
+        _blendif_scale_channel(bd->cst, c, in, out, bd->ch, n, scaled, work_profile);
+        _blendif_combine_channel(scaled, result, n, blendif_parameters + 4 * c, (blendif & (1 << (c + 16))) != 0,
+                                 incl);
+      }
+
+    const float fallback = incl ? 0.0f : 1.0f;
+#ifdef _OPENMP
+#pragma omp simd aligned(result:64)
+#endif
+    for(size_t i = 0; i < n; i++)
+    {
+      const float form = m[i];
+      const float conditional = channel_mask ? (incl ? 1.0f - result[i] : result[i]) : fallback;
+      float opacity = incl ? 1.0f - (1.0f - form) * (1.0f - conditional) : form * conditional;
+      opacity = inv ? 1.0f - opacity : opacity;
+      m[i] = opacity * gopacity;
+    }
   }
 }
 
@@ -221,7 +295,16 @@ static void _blend_normal_unbounded(const _blend_buffer_desc_t *bd, const float
   float max[4] = { 0 }, min[4] = { 0 };
   _blend_colorspace_channel_range(bd->cst, min, max);
 
-  if(bd->cst == iop_cs_Lab)
+  if(bd->ch == 1)
+  {
+    // single channel buffers (raw, or a gray export pipe with an rgb or Lab colorspace)
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+    for(size_t i = 0; i < bd->stride; i++)
+      b[i] = a[i] * (1.0f - mask[i]) + b[i] * mask[i];
+  }
+  else if(bd->cst == iop_cs_Lab)
     for(size_t i = 0, j = 0; j < bd->stride; i++, j += bd->ch)
     {
       float local_opacity = mask[i];
@@ -234,7 +317,7 @@ static void _blend_normal_unbounded(const _blend_buffer_desc_t *bd, const float
       tb[2] = ta[2] * (1.0f - local_opacity) + tb[2] * local_opacity;
 
       _blend_Lab_rescale(tb, &b[j]);
-      b[j + 3] = local_opacity;
+      if(bd->ch == 4) b[j + 3] = local_opacity;
     }
   else if(bd->cst == iop_cs_rgb)
     for(size_t i = 0, j = 0; j < bd->stride; i++, j += bd->ch)
@@ -244,7 +327,7 @@ static void _blend_normal_unbounded(const _blend_buffer_desc_t *bd, const float
       for(int k = 0; k < bd->bch; k++)
         b[j + k] = a[j + k] * (1.0f - local_opacity) + b[j + k] * local_opacity;
 
-      b[j + 3] = local_opacity;
+      if(bd->ch == 4) b[j + 3] = local_opacity;
     }
   else
     for(size_t i = 0, j = 0; j < bd->stride; i++, j += bd->ch)
@@ -295,7 +378,7 @@ static void _blend_multiply(const _blend_buffer_desc_t *bd, const float *a, floa
       }
 
       _blend_Lab_rescale(tb, &b[j]);
-      b[j + 3] = local_opacity;
+      if(bd->ch == 4) b[j + 3] = local_opacity;
     }
   }
   else if(bd->cst == iop_cs_rgb)
@@ -307,7 +390,7 @@ static void _blend_multiply(const _blend_buffer_desc_t *bd, const float *a, floa
         b[j + k] = clamp_range_f(
             a[j + k] * (1.0f - local_opacity) + (a[j + k] * b[j + k]) * local_opacity, min[k], max[k]);
 
-      b[j + 3] = local_opacity;
+      if(bd->ch == 4) b[j + 3] = local_opacity;
     }
   }
   else
@@ -342,7 +425,7 @@ static void _blend_average(const _blend_buffer_desc_t *bd, const float *a, float
       tb[2] = clamp_range_f(ta[2] * (1.0f - local_opacity) + (ta[2] + tb[2]) / 2.0f * local_opacity, min[2], max[2]);
 
       _blend_Lab_rescale(tb, &b[j]);
-      b[j + 3] = local_opacity;
+      if(bd->ch == 4) b[j + 3] = local_opacity;
     }
   }
   else if(bd->cst == iop_cs_rgb)
@@ -354,7 +437,7 @@ static void _blend_average(const _blend_buffer_desc_t *bd, const float *a, float
         b[j + k] =clamp_range_f(
             a[j + k] * (1.0f - local_opacity) + (a[j + k] + b[j + k]) / 2.0f * local_opacity, min[k], max[k]);
 
-      b[j + 3] = local_opacity;
+      if(bd->ch == 4) b[j + 3] = local_opacity;
     }
   }
   else
@@ -389,7 +472,7 @@ static void _blend_add(const _blend_buffer_desc_t *bd, const float *a, float *b,
       tb[2] = clamp_range_f(ta[2] * (1.0f - local_opacity) + (ta[2] + tb[2]) * local_opacity, min[2], max[2]);
 
       _blend_Lab_rescale(tb, &b[j]);
-      b[j + 3] = local_opacity;
+      if(bd->ch == 4) b[j + 3] = local_opacity;
     }
   }
   else if(bd->cst == iop_cs_rgb)
@@ -400,7 +483,7 @@ static void _blend_add(const _blend_buffer_desc_t *bd, const float *a, float *b,
       for(int k = 0; k < bd->bch; k++)
         b[j + k] =clamp_range_f(
             a[j + k] * (1.0f - local_opacity) + (a[j + k] + b[j + k]) * local_opacity, min[k], max[k]);
-      b[j + 3] = local_opacity;
+      if(bd->ch == 4) b[j + 3] = local_opacity;
     }
   }
   else /* if(bd->cst == iop_cs_RAW) */
@@ -434,7 +517,7 @@ static void _blend_substract(const _blend_buffer_desc_t *bd, const float *a, flo
                                 + ((tb[k] + ta[k]) - (fabsf(min[k] + max[k]))) * local_opacity,  min[k], max[k]);
 
       _blend_Lab_rescale(tb, &b[j]);
-      b[j + 3] = local_opacity;
+      if(bd->ch == 4) b[j + 3] = local_opacity;
     }
   }
   else if(bd->cst == iop_cs_rgb)
@@ -445,7 +528,7 @@ static void _blend_substract(const _blend_buffer_desc_t *bd, const float *a, flo
       for(int k = 0; k < bd->bch; k++)
         b[j + k] =clamp_range_f(a[j + k] * (1.0f - local_opacity)
                                 +((b[j + k]+a[j + k]) - (fabsf(min[k] + max[k]))) * local_opacity, min[k], max[k]);
-      b[j + 3] = local_opacity;
+      if(bd->ch == 4) b[j + 3] = local_opacity;
     }
   }
   else /* if(bd->cst == iop_cs_RAW) */
@@ -485,7 +568,7 @@ static void _blend_difference2(const _blend_buffer_desc_t *bd, const float *a, f
       tb[2] = 0.0f;
 
       _blend_Lab_rescale(tb, &b[j]);
-      b[j + 3] = local_opacity;
+      if(bd->ch == 4) b[j + 3] = local_opacity;
     }
   }
   else if(bd->cst == iop_cs_rgb)
@@ -504,7 +587,7 @@ static void _blend_difference2(const _blend_buffer_desc_t *bd, const float *a, f
                    - fabsf(min[k]);
       }
 
-      b[j + 3] = local_opacity;
+      if(bd->ch == 4) b[j + 3] = local_opacity;
     }
   }
   else
@@ -544,7 +627,7 @@ static void _blend_Lab_lightness(const _blend_buffer_desc_t *bd, const float *a,
       tb[2] = ta[2];
 
       _blend_Lab_rescale(tb, &b[j]);
-      b[j + 3] = local_opacity;
+      if(bd->ch == 4) b[j + 3] = local_opacity;
     }
   }
   else
@@ -569,7 +652,7 @@ static void _blend_Lab_a(const _blend_buffer_desc_t *bd, const float *a, float *
       tb[2] = ta[2];
 
       _blend_Lab_rescale(tb, &b[j]);
-      b[j + 3] = local_opacity;
+      if(bd->ch == 4) b[j + 3] = local_opacity;
     }
   }
   else
@@ -594,7 +677,7 @@ static void _blend_Lab_b(const _blend_buffer_desc_t *bd, const float *a, float *
       tb[2] = ta[2] * (1.0f - local_opacity) + tb[2] * local_opacity;
 
       _blend_Lab_rescale(tb, &b[j]);
-      b[j + 3] = local_opacity;
+      if(bd->ch == 4) b[j + 3] = local_opacity;
     }
   }
   else
@@ -619,7 +702,7 @@ static void _blend_Lab_color(const _blend_buffer_desc_t *bd, const float *a, flo
       tb[2] = ta[2] * (1.0f - local_opacity) + tb[2] * local_opacity;
 
       _blend_Lab_rescale(tb, &b[j]);
-      b[j + 3] = local_opacity;
+      if(bd->ch == 4) b[j + 3] = local_opacity;
     }
   }
   else
@@ -639,7 +722,7 @@ static void _blend_RGB_R(const _blend_buffer_desc_t *bd, const float *a, float *
       b[j + 0] = a[j + 0] * (1.0f - local_opacity) + b[j + 0] * local_opacity;
       b[j + 1] = a[j + 1];
       b[j + 2] = a[j + 2];
-      b[j + 3] = local_opacity;
+      if(bd->ch == 4) b[j + 3] = local_opacity;
     }
   }
   else
@@ -659,7 +742,7 @@ static void _blend_RGB_G(const _blend_buffer_desc_t *bd, const float *a, float *
       b[j + 0] = a[j + 0];
       b[j + 1] = a[j + 1] * (1.0f - local_opacity) + b[j + 1] * local_opacity;
       b[j + 2] = a[j + 2];
-      b[j + 3] = local_opacity;
+      if(bd->ch == 4) b[j + 3] = local_opacity;
     }
   }
   else
@@ -679,7 +762,7 @@ static void _blend_RGB_B(const _blend_buffer_desc_t *bd, const float *a, float *
       b[j + 0] = a[j + 0];
       b[j + 1] = a[j + 1];
       b[j + 2] = a[j + 2] * (1.0f - local_opacity) + b[j + 2] * local_opacity;
-      b[j + 3] = local_opacity;
+      if(bd->ch == 4) b[j + 3] = local_opacity;
     }
   }
   else
@@ -839,7 +922,7 @@ static void display_channel(const _blend_buffer_desc_t *bd, const float *a, floa
       break;
   }
 
-  if(bd->cst != iop_cs_rgb)
+  if(bd->cst != iop_cs_rgb && bd->ch == 4)
     for(size_t i = 0, j = 0; j < bd->stride; i++, j += bd->ch)
       b[j + 3] = mask[i];
 }
@@ -897,6 +980,17 @@ _blend_row_func *dt_develop_choose_blend_func(const unsigned int blend_mode)
   return blend;
 }
 
+gboolean dt_develop_blend_is_passthrough(const struct dt_dev_pixelpipe_iop_t *piece)
+{
+  const dt_develop_blend_params_t *const d = (const dt_develop_blend_params_t *const)piece->blendop_data;
+
+  // a uniform normal blend at full opacity just hands through the module output. we still have to run
+  // if the alpha channel is used to show a mask or if someone wants our mask as raster mask.
+  return d && d->mask_mode == DEVELOP_MASK_ENABLED && d->blend_mode == DEVELOP_BLEND_NORMAL2
+         && d->opacity >= 100.0f && piece->pipe->mask_display == DT_DEV_PIXELPIPE_DISPLAY_NONE
+         && !piece->pipe->store_all_raster_masks && !dt_iop_is_raster_mask_used(piece->module, 0);
+}
+
 void dt_develop_blend_process(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
                               const void *const ivoid, void *const ovoid, const struct dt_iop_roi_t *const roi_in,
                               const struct dt_iop_roi_t *const roi_out)
@@ -908,6 +1002,13 @@ void dt_develop_blend_process(struct dt_iop_module_t *self, struct dt_dev_pixelp
 
   if(!d) return;
 
+  if(dt_develop_blend_is_passthrough(piece))
+  {
+    // don't leave the mask of an earlier run behind
+    g_hash_table_remove(piece->raster_masks, GINT_TO_POINTER(0));
+    return;
+  }
+
   const unsigned int mask_mode = d->mask_mode;
   // check if blend is disabled
   if(!(mask_mode & DEVELOP_MASK_ENABLED))
@@ -947,7 +1048,8 @@ void dt_develop_blend_process(struct dt_iop_module_t *self, struct dt_dev_pixelp
   const gboolean suppress_mask = self->suppress_mask && self->dev->gui_attached && (self == self->dev->gui_module)
                               && (piece->pipe == self->dev->pipe) && (mask_mode & DEVELOP_MASK_MASK_CONDITIONAL);
   const gboolean rois_equal = (iwidth == owidth || iheight == oheight || xoffs == 0 || yoffs == 0);
-  const gboolean mask_feather = d->feathering_radius >= 0.1f;
+  // the guided filter needs a color guide, gray buffers are not feathered
+  const gboolean mask_feather = d->feathering_radius >= 0.1f && ch >= 3;
   const gboolean mask_blur = d->blur_radius >= 0.1f;
   const gboolean mask_tone_curve = fabsf(d->contrast) >= 0.01f || fabsf(d->brightness) >= 0.01f;
   // get the clipped opacity value  0 - 1
@@ -962,6 +1064,9 @@ void dt_develop_blend_process(struct dt_iop_module_t *self, struct dt_dev_pixelp
   }
 
   float *const mask = _mask;
+  // without feathering, blurring or a tone curve the parametric mask of a row only depends on that
+  // row, so it is computed right before blending it while the pixels are still in cache.
+  gboolean fuse_mask = FALSE;
 
   if(mask_mode == DEVELOP_MASK_ENABLED || suppress_mask)
   {
@@ -1059,22 +1164,27 @@ void dt_develop_blend_process(struct dt_iop_module_t *self, struct dt_dev_pixelp
       for(size_t i = 0; i < buffsize; i++)
         mask[i] = fill;
     }
+    fuse_mask = !mask_feather && !mask_blur && !(mask_tone_curve && opacity > 1e-4f);
+
     // get parametric mask (if any) and apply global opacity
+    if(!fuse_mask)
+    {
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-    dt_omp_firstprivate(bch, ch, cst, d, oheight, opacity, ivoid, iwidth, \
-                        mask, owidth, ovoid, work_profile, xoffs, yoffs)
+      dt_omp_firstprivate(bch, ch, cst, d, oheight, opacity, ivoid, iwidth, \
+                          mask, owidth, ovoid, work_profile, xoffs, yoffs)
 #endif
-    for(size_t y = 0; y < oheight; y++)
-    {
-      size_t iindex = ((y + yoffs) * iwidth + xoffs) * ch;
-      size_t oindex = y * owidth * ch;
-      _blend_buffer_desc_t bd = { .cst = cst, .stride = (size_t)owidth * ch, .ch = ch, .bch = bch };
-      float *in = (float *)ivoid + iindex;
-      float *out = (float *)ovoid + oindex;
-      float *m = mask + y * owidth;
-      _blend_make_mask(&bd, d->blendif, d->blendif_parameters, d->mask_mode, d->mask_combine, opacity, in, out, m,
-                       work_profile);
+      for(size_t y = 0; y < oheight; y++)
+      {
+        size_t iindex = ((y + yoffs) * iwidth + xoffs) * ch;
+        size_t oindex = y * owidth * ch;
+        _blend_buffer_desc_t bd = { .cst = cst, .stride = (size_t)owidth * ch, .ch = ch, .bch = bch };
+        float *in = (float *)ivoid + iindex;
+        float *out = (float *)ovoid + oindex;
+        float *m = mask + y * owidth;
+        _blend_make_mask(&bd, d->blendif, d->blendif_parameters, d->mask_mode, d->mask_combine, opacity, in, out,
+                         m, work_profile);
+      }
     }
 
     if(mask_feather)
@@ -1177,25 +1287,33 @@ void dt_develop_blend_process(struct dt_iop_module_t *self, struct dt_dev_pixelp
   // now apply blending with per-pixel opacity value as defined in mask
   // select the blend operator
   _blend_row_func *const blend = dt_develop_choose_blend_func(d->blend_mode);
-  _blend_buffer_desc_t bd = { .cst = cst, .stride = (size_t)owidth * 4, .ch = (size_t)ch, .bch = bch };
+  _blend_buffer_desc_t bd = { .cst = cst, .stride = (size_t)owidth * ch, .ch = (size_t)ch, .bch = bch };
+  // the colorspace specific paths of the blend operators expect 4 channels, a gray buffer is blended
+  // channel by channel like raw data
+  _blend_buffer_desc_t bd_blend = bd;
+  if(ch == 1) bd_blend.cst = iop_cs_RAW;
 #ifdef _OPENMP
 #pragma omp parallel for default(none)                                                                            \
-  dt_omp_firstprivate(ch, blend, cst, ivoid, iwidth, mask, \
-                      mask_display, oheight, ovoid, owidth, \
-                      request_mask_display, work_profile, xoffs, yoffs, bd)
+  dt_omp_firstprivate(ch, blend, cst, d, fuse_mask, ivoid, iwidth, mask, \
+                      mask_display, oheight, opacity, ovoid, owidth, \
+                      request_mask_display, work_profile, xoffs, yoffs, bd, bd_blend)
 #endif
   for(size_t y = 0; y < oheight; y++)
   {
-    size_t iindex = ((y + yoffs) * iwidth + xoffs) * 4;
-    size_t oindex = y * owidth * 4;
+    size_t iindex = ((y + yoffs) * iwidth + xoffs) * ch;
+    size_t oindex = y * owidth * ch;
     float *in = (float *)ivoid + iindex;
     float *out = (float *)ovoid + oindex;
     float *m = mask + y * owidth;
 
-    if(request_mask_display & DT_DEV_PIXELPIPE_DISPLAY_ANY)
+    if(fuse_mask)
+      _blend_make_mask(&bd, d->blendif, d->blendif_parameters, d->mask_mode, d->mask_combine, opacity, in, out, m,
+                       work_profile);
+
+    if((request_mask_display & DT_DEV_PIXELPIPE_DISPLAY_ANY) && ch == 4)
       display_channel(&bd, in, out, m, request_mask_display, work_profile);
     else
-      blend(&bd, in, out, m);
+      blend(&bd_blend, in, out, m);
 
     if((mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) && cst != iop_cs_RAW && ch == 4)
       for(size_t j = 0; j < (size_t)owidth * 4; j += 4)
@@ -249,6 +249,8 @@ typedef struct dt_iop_gui_blend_data_t
 void dt_develop_blend_process(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
                               const void *const i, void *const o, const struct dt_iop_roi_t *const roi_in,
                               const struct dt_iop_roi_t *const roi_out);
+// returns TRUE if blending would leave the module output unchanged, so no colorspace conversion is needed
+gboolean dt_develop_blend_is_passthrough(const struct dt_dev_pixelpipe_iop_t *piece);
 // get blend version
 int dt_develop_blend_version(void);
 
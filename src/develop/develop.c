@@ -1495,7 +1495,7 @@ static void _dev_merge_history(dt_develop_t *dev, const int imgid)
                                   "UPDATE memory.history SET num=?1 WHERE rowid=?2", -1, &stmt, NULL);
 
       // let's wrap this into a transaction, it might make it a little faster.
-      sqlite3_exec(dt_database_get(darktable.db), "BEGIN TRANSACTION", NULL, NULL, NULL);
+      dt_database_start_transaction(darktable.db);
       for(GList *r = rowids; r; r = g_list_next(r))
       {
         DT_DEBUG_SQLITE3_CLEAR_BINDINGS(stmt);
@@ -1508,7 +1508,7 @@ static void _dev_merge_history(dt_develop_t *dev, const int imgid)
 
         v++;
       }
-      sqlite3_exec(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
+      dt_database_release_transaction(darktable.db);
       g_list_free(rowids);
     }
 
@@ -2232,37 +2232,47 @@ int dt_dev_distort_backtransform(dt_develop_t *dev, float *points, size_t points
   return dt_dev_distort_backtransform_plus(dev, dev->preview_pipe, 0.0f, DT_DEV_TRANSFORM_DIR_ALL, points, points_count);
 }
 
+// does the given (distorting) piece take part in a transform in transf_direction relative to iop_order?
+static inline gboolean _dev_distort_piece_active(const dt_develop_t *dev, const dt_dev_pixelpipe_iop_t *piece,
+                                                 const double iop_order, const int transf_direction)
+{
+  const dt_iop_module_t *module = piece->module;
+  return piece->enabled && ((transf_direction == DT_DEV_TRANSFORM_DIR_ALL)
+                            || (transf_direction == DT_DEV_TRANSFORM_DIR_FORW_INCL && module->iop_order >= iop_order)
+                            || (transf_direction == DT_DEV_TRANSFORM_DIR_FORW_EXCL && module->iop_order > iop_order)
+                            || (transf_direction == DT_DEV_TRANSFORM_DIR_BACK_INCL && module->iop_order <= iop_order)
+                            || (transf_direction == DT_DEV_TRANSFORM_DIR_BACK_EXCL && module->iop_order < iop_order))
+         && !(dev->gui_module && dev->gui_module->operation_tags_filter() & module->operation_tags());
+}
+
+// the pipe keeps a compiled list of its distorting pieces (see dt_dev_pixelpipe_create_nodes), so we only
+// visit the few modules which can actually move points instead of walking the whole module list.
 int dt_dev_distort_transform_plus(dt_develop_t *dev, dt_dev_pixelpipe_t *pipe, const double iop_order, const int transf_direction,
                                   float *points, size_t points_count)
 {
   dt_pthread_mutex_lock(&dev->history_mutex);
-  GList *modules = pipe->iop;
-  GList *pieces = pipe->nodes;
-  while(modules)
+  // modules without pieces: the pipe isn't set up (yet), nothing can be transformed
+  if(pipe->iop && !pipe->nodes)
   {
-    if(!pieces)
-    {
-      dt_pthread_mutex_unlock(&dev->history_mutex);
-      return 0;
-    }
-    dt_iop_module_t *module = (dt_iop_module_t *)(modules->data);
-    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)(pieces->data);
-    if(piece->enabled && ((transf_direction == DT_DEV_TRANSFORM_DIR_ALL)
-                          || (transf_direction == DT_DEV_TRANSFORM_DIR_FORW_INCL && module->iop_order >= iop_order)
-                          || (transf_direction == DT_DEV_TRANSFORM_DIR_FORW_EXCL && module->iop_order > iop_order)
-                          || (transf_direction == DT_DEV_TRANSFORM_DIR_BACK_INCL && module->iop_order <= iop_order)
-                          || (transf_direction == DT_DEV_TRANSFORM_DIR_BACK_EXCL && module->iop_order < iop_order)) &&
-      !(dev->gui_module && dev->gui_module->operation_tags_filter() & module->operation_tags()))
-    {
-      module->distort_transform(module, piece, points, points_count);
-    }
-    modules = g_list_next(modules);
-    pieces = g_list_next(pieces);
+    dt_pthread_mutex_unlock(&dev->history_mutex);
+    return 0;
+  }
+  for(int k = 0; k < pipe->distort_count; k++)
+  {
+    dt_dev_pixelpipe_iop_t *piece = pipe->distort_pieces[k];
+    if(_dev_distort_piece_active(dev, piece, iop_order, transf_direction))
+      piece->module->distort_transform(piece->module, piece, points, points_count);
   }
   if ((dev->preview_downsampling != 1.0f) && (transf_direction == DT_DEV_TRANSFORM_DIR_ALL
                         || transf_direction == DT_DEV_TRANSFORM_DIR_FORW_EXCL
                         || transf_direction == DT_DEV_TRANSFORM_DIR_FORW_INCL))
-    for(size_t idx=0; idx < 2 * points_count; idx++) points[idx] *= dev->preview_downsampling;
+  {
+    const float scale = dev->preview_downsampling;
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+    for(size_t idx = 0; idx < 2 * points_count; idx++) points[idx] *= scale;
+  }
 
   dt_pthread_mutex_unlock(&dev->history_mutex);
   return 1;
@@ -2271,33 +2281,27 @@ int dt_dev_distort_backtransform_plus(dt_develop_t *dev, dt_dev_pixelpipe_t *pip
                                       float *points, size_t points_count)
 {
   dt_pthread_mutex_lock(&dev->history_mutex);
+  if(pipe->iop && !pipe->nodes)
+  {
+    dt_pthread_mutex_unlock(&dev->history_mutex);
+    return 0;
+  }
   if ((dev->preview_downsampling != 1.0f) && (transf_direction == DT_DEV_TRANSFORM_DIR_ALL
     || transf_direction == DT_DEV_TRANSFORM_DIR_FORW_EXCL
     || transf_direction == DT_DEV_TRANSFORM_DIR_FORW_INCL))
-      for(size_t idx=0; idx < 2 * points_count; idx++) points[idx] /= dev->preview_downsampling;
+  {
+    const float scale = dev->preview_downsampling;
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+    for(size_t idx = 0; idx < 2 * points_count; idx++) points[idx] /= scale;
+  }
 
-  GList *modules = pipe->iop;
-  GList *pieces = pipe->nodes;
-  while(modules)
+  for(int k = pipe->distort_count - 1; k >= 0; k--)
   {
-    if(!pieces)
-    {
-      dt_pthread_mutex_unlock(&dev->history_mutex);
-      return 0;
-    }
-    dt_iop_module_t *module = (dt_iop_module_t *)(modules->data);
-    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)(pieces->data);
-    if(piece->enabled && ((transf_direction == DT_DEV_TRANSFORM_DIR_ALL)
-                          || (transf_direction == DT_DEV_TRANSFORM_DIR_FORW_INCL && module->iop_order >= iop_order)
-                          || (transf_direction == DT_DEV_TRANSFORM_DIR_FORW_EXCL && module->iop_order > iop_order)
-                          || (transf_direction == DT_DEV_TRANSFORM_DIR_BACK_INCL && module->iop_order <= iop_order)
-                          || (transf_direction == DT_DEV_TRANSFORM_DIR_BACK_EXCL && module->iop_order < iop_order)) &&
-      !(dev->gui_module && dev->gui_module->operation_tags_filter() & module->operation_tags()))
-    {
-      module->distort_backtransform(module, piece, points, points_count);
-    }
-    modules = g_list_previous(modules);
-    pieces = g_list_previous(pieces);
+    dt_dev_pixelpipe_iop_t *piece = pipe->distort_pieces[k];
+    if(_dev_distort_piece_active(dev, piece, iop_order, transf_direction))
+      piece->module->distort_backtransform(piece->module, piece, points, points_count);
   }
   dt_pthread_mutex_unlock(&dev->history_mutex);
   return 1;
@@ -21,6 +21,9 @@
 #include "develop/pixelpipe_hb.h"
 #include "libs/lib.h"
 #include <stdlib.h>
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
 
 
 // TODO: make cache global (needs to be thread safe then)
@@ -35,8 +38,21 @@
 int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, size_t size)
 {
   cache->entries = entries;
+  cache->variant_data = NULL;
+  cache->variant_size = 0;
+  cache->variant_hash = -1;
+  cache->variant_cst = -1;
+  cache->half_entries = 0;
+  cache->half_data = NULL;
+  cache->half_size = NULL;
+  cache->half_fill = NULL;
+  cache->half_dsc = NULL;
+  cache->half_basichash = NULL;
+  cache->half_hash = NULL;
+  cache->half_used = NULL;
   cache->data = (void **)calloc(entries, sizeof(void *));
   cache->size = (size_t *)calloc(entries, sizeof(size_t));
+  cache->fill = (size_t *)calloc(entries, sizeof(size_t));
   cache->dsc = (dt_iop_buffer_dsc_t *)calloc(entries, sizeof(dt_iop_buffer_dsc_t));
 #ifdef _DEBUG
   memset(cache->dsc, 0x2c, sizeof(dt_iop_buffer_dsc_t) * entries);
@@ -79,15 +95,51 @@ alloc_memory_fail:
   return 0;
 }
 
+int dt_dev_pixelpipe_cache_init_half(dt_dev_pixelpipe_cache_t *cache, int entries)
+{
+  cache->half_data = (uint16_t **)calloc(entries, sizeof(uint16_t *));
+  cache->half_size = (size_t *)calloc(entries, sizeof(size_t));
+  cache->half_fill = (size_t *)calloc(entries, sizeof(size_t));
+  cache->half_dsc = (dt_iop_buffer_dsc_t *)calloc(entries, sizeof(dt_iop_buffer_dsc_t));
+  cache->half_basichash = (uint64_t *)calloc(entries, sizeof(uint64_t));
+  cache->half_hash = (uint64_t *)calloc(entries, sizeof(uint64_t));
+  cache->half_used = (int32_t *)calloc(entries, sizeof(int32_t));
+  if(!cache->half_data || !cache->half_size || !cache->half_fill || !cache->half_dsc || !cache->half_basichash
+     || !cache->half_hash || !cache->half_used)
+    return 0;
+  // buffers are allocated when lines are evicted
+  for(int k = 0; k < entries; k++)
+  {
+    cache->half_basichash[k] = -1;
+    cache->half_hash[k] = -1;
+  }
+  cache->half_entries = entries;
+  return 1;
+}
+
 void dt_dev_pixelpipe_cache_cleanup(dt_dev_pixelpipe_cache_t *cache)
 {
   for(int k = 0; k < cache->entries; k++) dt_free_align(cache->data[k]);
+  dt_free_align(cache->variant_data);
+  cache->variant_data = NULL;
+  cache->variant_size = 0;
   free(cache->data);
   free(cache->dsc);
   free(cache->basichash);
   free(cache->hash);
   free(cache->used);
   free(cache->size);
+  free(cache->fill);
+  if(cache->half_data)
+    for(int k = 0; k < cache->half_entries; k++) dt_free_align(cache->half_data[k]);
+  free(cache->half_data);
+  free(cache->half_size);
+  free(cache->half_fill);
+  free(cache->half_dsc);
+  free(cache->half_basichash);
+  free(cache->half_hash);
+  free(cache->half_used);
+  cache->half_entries = 0;
 }
 
 uint64_t dt_dev_pixelpipe_cache_basichash(int imgid, struct dt_dev_pixelpipe_t *pipe, int module)
@@ -171,9 +223,171 @@ int dt_dev_pixelpipe_cache_available(dt_dev_pixelpipe_cache_t *cache, const uint
   // search for hash in cache
   for(int32_t k = 0; k < cache->entries; k++)
     if(cache->hash[k] == hash) return 1;
+  for(int32_t k = 0; k < cache->half_entries; k++)
+    if(cache->half_hash[k] == hash) return 1;
+  return 0;
+}
+
+typedef union _cache_fp32_t
+{
+  uint32_t u;
+  float f;
+} _cache_fp32_t;
+
+// round to nearest even, saturating to the largest half instead of inf so modules don't choke on it.
+// from https://gist.github.com/rygorous/2156668
+static inline uint16_t _float_to_half(const float f)
+{
+  static const _cache_fp32_t f32infty = { 255u << 23 };
+  // 65520 is where rounding would reach inf, everything from there on saturates to 65504
+  static const _cache_fp32_t f16max = { 0x477ff000u };
+  static const _cache_fp32_t denorm_magic = { ((127 - 15) + (23 - 10) + 1) << 23 };
+  _cache_fp32_t in = { .f = f };
+  const uint32_t sign = in.u & 0x80000000u;
+  in.u ^= sign;
+  uint16_t o;
+  if(in.u >= f16max.u)
+    o = (in.u > f32infty.u) ? (0x7e00 | ((in.u >> 13) & 0x3ff)) : 0x7bff; // NaN stays NaN, quieted like F16C
+  else if(in.u < (113u << 23))
+  {
+    // denormal
+    in.f += denorm_magic.f;
+    o = in.u - denorm_magic.u;
+  }
+  else
+  {
+    const uint32_t mant_odd = (in.u >> 13) & 1;
+    in.u += ((uint32_t)(15 - 127) << 23) + 0xfff;
+    in.u += mant_odd;
+    o = in.u >> 13;
+  }
+  return o | (sign >> 16);
+}
+
+static inline float _half_to_float(const uint16_t h)
+{
+  static const _cache_fp32_t magic = { 113 << 23 };
+  static const uint32_t shifted_exp = 0x7c00 << 13;
+  _cache_fp32_t o;
+  o.u = (h & 0x7fff) << 13;
+  const uint32_t exp = shifted_exp & o.u;
+  o.u += (127 - 15) << 23;
+  if(exp == shifted_exp)
+    o.u += (128 - 16) << 23;
+  else if(exp == 0)
+  {
+    o.u += 1 << 23;
+    o.f -= magic.f;
+  }
+  o.u |= (h & 0x8000) << 16;
+  return o.f;
+}
+
+static void _half_pack(uint16_t *const out, const float *const in, const size_t n)
+{
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(in, out, n) \
+  schedule(static)
+#endif
+  for(size_t k = 0; k < n / 4; k++)
+  {
+#if defined(__F16C__)
+    // saturate like _float_to_half(). min/max return their second operand if one is NaN, so NaN stays NaN
+    const __m128 v = _mm_max_ps(_mm_set1_ps(-65504.0f), _mm_min_ps(_mm_set1_ps(65504.0f), _mm_loadu_ps(in + 4 * k)));
+    _mm_storel_epi64((__m128i *)(out + 4 * k), _mm_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT));
+#else
+    for(int c = 0; c < 4; c++) out[4 * k + c] = _float_to_half(in[4 * k + c]);
+#endif
+  }
+  for(size_t k = n & ~(size_t)3; k < n; k++) out[k] = _float_to_half(in[k]);
+}
+
+static void _half_unpack(float *const out, const uint16_t *const in, const size_t n)
+{
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(in, out, n) \
+  schedule(static)
+#endif
+  for(size_t k = 0; k < n / 4; k++)
+  {
+#if defined(__F16C__)
+    _mm_storeu_ps(out + 4 * k, _mm_cvtph_ps(_mm_loadl_epi64((const __m128i *)(in + 4 * k))));
+#else
+    for(int c = 0; c < 4; c++) out[4 * k + c] = _half_to_float(in[4 * k + c]);
+#endif
+  }
+  for(size_t k = n & ~(size_t)3; k < n; k++) out[k] = _half_to_float(in[k]);
+}
+
+// keep a half float copy of float line k, which is about to be overwritten.
+// only rgba lines: raw input before demosaic (1 channel) would lose its sensor values
+static void _half_spill(dt_dev_pixelpipe_cache_t *cache, const int k)
+{
+  if(!cache->half_entries || cache->hash[k] == (uint64_t)-1 || !cache->fill[k]
+     || cache->dsc[k].datatype != TYPE_FLOAT || cache->dsc[k].channels != 4)
+    return;
+
+  int max_used = -1, max = 0;
+  for(int j = 0; j < cache->half_entries; j++)
+  {
+    if(cache->half_hash[j] == cache->hash[k] && cache->half_fill[j] == cache->fill[k])
+    {
+      // still there from an earlier eviction, the float line was restored from it
+      cache->half_used[j] = 0;
+      return;
+    }
+    if(cache->half_used[j] > max_used)
+    {
+      max_used = cache->half_used[j];
+      max = j;
+    }
+    cache->half_used[j]++;
+  }
+
+  const size_t n = cache->fill[k] / sizeof(float);
+  if(cache->half_size[max] < n * sizeof(uint16_t))
+  {
+    dt_free_align(cache->half_data[max]);
+    cache->half_data[max] = (uint16_t *)dt_alloc_align(64, n * sizeof(uint16_t));
+    cache->half_size[max] = cache->half_data[max] ? n * sizeof(uint16_t) : 0;
+  }
+  if(!cache->half_data[max])
+  {
+    cache->half_hash[max] = cache->half_basichash[max] = -1;
+    return;
+  }
+
+  ASAN_UNPOISON_MEMORY_REGION(cache->data[k], cache->fill[k]);
+  _half_pack(cache->half_data[max], (const float *)cache->data[k], n);
+  cache->half_fill[max] = cache->fill[k];
+  cache->half_dsc[max] = cache->dsc[k];
+  cache->half_basichash[max] = cache->basichash[k];
+  cache->half_hash[max] = cache->hash[k];
+  cache->half_used[max] = 0;
+}
+
+// fill float line k from a half float copy of hash, returns 0 if there is none
+static int _half_restore(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash, const size_t size, const int k)
+{
+  for(int j = 0; j < cache->half_entries; j++)
+  {
+    if(cache->half_hash[j] != hash || cache->half_fill[j] != size) continue;
+    _half_unpack((float *)cache->data[k], cache->half_data[j], size / sizeof(float));
+    cache->dsc[k] = cache->half_dsc[j];
+    cache->half_used[j] = 0;
+    return 1;
+  }
   return 0;
 }
 
+static void _half_drop(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash)
+{
+  for(int j = 0; j < cache->half_entries; j++)
+    if(cache->half_hash[j] == hash) cache->half_hash[j] = cache->half_basichash[j] = -1;
+}
+
 int dt_dev_pixelpipe_cache_get_important(dt_dev_pixelpipe_cache_t *cache, const uint64_t basichash,
                                          const uint64_t hash, const size_t size,
                                          void **data, dt_iop_buffer_dsc_t **dsc)
@@ -220,6 +434,7 @@ int dt_dev_pixelpipe_cache_get_weighted(dt_dev_pixelpipe_cache_t *cache, const u
     // kill LRU entry
     // printf("[pixelpipe_cache_get] hash not found, returning slot %d/%d age %d\n", max, cache->entries,
     // weight);
+    _half_spill(cache, max);
     if(cache->size[max] < size)
     {
       dt_free_align(cache->data[max]);
@@ -239,6 +454,8 @@ int dt_dev_pixelpipe_cache_get_weighted(dt_dev_pixelpipe_cache_t *cache, const u
     cache->basichash[max] = basichash;
     cache->hash[max] = hash;
     cache->used[max] = weight;
+    cache->fill[max] = size;
+    if(_half_restore(cache, hash, size, max)) return 0;
     cache->misses++;
     return 1;
   }
@@ -246,8 +463,38 @@ int dt_dev_pixelpipe_cache_get_weighted(dt_dev_pixelpipe_cache_t *cache, const u
     return 0;
 }
 
+int dt_dev_pixelpipe_cache_get_variant(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash, const int cst,
+                                       const size_t size, void **data)
+{
+  if(cache->variant_data && cache->variant_hash == hash && cache->variant_cst == cst
+     && cache->variant_size >= size)
+  {
+    *data = cache->variant_data;
+    return 0;
+  }
+
+  if(cache->variant_size < size)
+  {
+    dt_free_align(cache->variant_data);
+    cache->variant_data = dt_alloc_align(64, size);
+    cache->variant_size = cache->variant_data ? size : 0;
+  }
+  cache->variant_hash = cache->variant_data ? hash : -1;
+  cache->variant_cst = cst;
+  *data = cache->variant_data;
+  return 1;
+}
+
+void dt_dev_pixelpipe_cache_invalidate_variant(dt_dev_pixelpipe_cache_t *cache)
+{
+  cache->variant_hash = -1;
+  cache->variant_cst = -1;
+}
+
 void dt_dev_pixelpipe_cache_flush(dt_dev_pixelpipe_cache_t *cache)
 {
+  dt_dev_pixelpipe_cache_invalidate_variant(cache);
+  for(int k = 0; k < cache->half_entries; k++) cache->half_hash[k] = cache->half_basichash[k] = -1;
   for(int k = 0; k < cache->entries; k++)
   {
     cache->basichash[k] = -1;
@@ -259,6 +506,9 @@ void dt_dev_pixelpipe_cache_flush(dt_dev_pixelpipe_cache_t *cache)
 
 void dt_dev_pixelpipe_cache_flush_all_but(dt_dev_pixelpipe_cache_t *cache, uint64_t basichash)
 {
+  dt_dev_pixelpipe_cache_invalidate_variant(cache);
+  for(int k = 0; k < cache->half_entries; k++)
+    if(cache->half_basichash[k] != basichash) cache->half_hash[k] = cache->half_basichash[k] = -1;
   for(int k = 0; k < cache->entries; k++)
   {
     if (cache->basichash[k] == basichash)
@@ -282,6 +532,7 @@ void dt_dev_pixelpipe_cache_invalidate(dt_dev_pixelpipe_cache_t *cache, void *da
   for(int k = 0; k < cache->entries; k++)
     if(cache->data[k] == data)
     {
+      _half_drop(cache, cache->hash[k]);
       cache->basichash[k] = -1;
       cache->hash[k] = -1;
       ASAN_POISON_MEMORY_REGION(cache->data[k], cache->size[k]);
@@ -296,6 +547,9 @@ void dt_dev_pixelpipe_cache_print(dt_dev_pixelpipe_cache_t *cache)
     printf("used %d by %" PRIu64 " (%" PRIu64 ")", cache->used[k], cache->hash[k], cache->basichash[k]);
     printf("\n");
   }
+  for(int k = 0; k < cache->half_entries; k++)
+    printf("pixelpipe half cacheline %d used %d by %" PRIu64 " (%" PRIu64 ")\n", k, cache->half_used[k],
+           cache->half_hash[k], cache->half_basichash[k]);
   printf("cache hit rate so far: %.3f\n", (cache->queries - cache->misses) / (float)cache->queries);
 }
 
@@ -39,6 +39,21 @@ typedef struct dt_dev_pixelpipe_cache_t
   uint64_t *basichash;
   uint64_t *hash;
   int32_t *used;
+  // one colorspace converted copy of a cache line, so module inputs don't have to be converted in place
+  void *variant_data;
+  size_t variant_size;
+  uint64_t variant_hash;
+  int variant_cst;
+  // float lines evicted from above, kept as half floats (optional, see dt_dev_pixelpipe_cache_init_half)
+  int32_t half_entries;
+  uint16_t **half_data;
+  size_t *half_size;  // allocated bytes
+  size_t *half_fill;  // bytes of the float line it holds
+  struct dt_iop_buffer_dsc_t *half_dsc;
+  uint64_t *half_basichash;
+  uint64_t *half_hash;
+  int32_t *half_used;
+  size_t *fill;       // bytes last requested for each float line
   // profiling:
   uint64_t queries;
   uint64_t misses;
@@ -49,6 +64,10 @@ typedef struct dt_dev_pixelpipe_cache_t
 */
 int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, size_t size);
 void dt_dev_pixelpipe_cache_cleanup(dt_dev_pixelpipe_cache_t *cache);
+/** keep a half float copy of up to entries rgba float lines when they are evicted. a later miss on such a line
+  * is served by converting it back, at half float precision. only meant for pipes that don't need full
+  * precision (preview). \param[out] returns 0 if fail to allocate. */
+int dt_dev_pixelpipe_cache_init_half(dt_dev_pixelpipe_cache_t *cache, int entries);
 
 /** creates a hopefully unique hash from the complete module stack up to the module-th. */
 uint64_t dt_dev_pixelpipe_cache_basichash(int imgid, struct dt_dev_pixelpipe_t *pipe, int module);
@@ -74,6 +93,15 @@ int dt_dev_pixelpipe_cache_get_weighted(dt_dev_pixelpipe_cache_t *cache, const u
                                         const uint64_t hash, const size_t size,
                                         void **data, struct dt_iop_buffer_dsc_t **dsc, int weight);
 
+/** returns a buffer of at least size bytes to hold the cache line `hash` converted to colorspace cst.
+  * returns 0 if the buffer already contains this conversion and 1 if it has to be (re)filled by the caller.
+  * returns 1 and sets *data to NULL if no memory is available. */
+int dt_dev_pixelpipe_cache_get_variant(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash, const int cst,
+                                       const size_t size, void **data);
+
+/** drops the converted copy, e.g. because filling it failed. */
+void dt_dev_pixelpipe_cache_invalidate_variant(dt_dev_pixelpipe_cache_t *cache);
+
 /** test availability of a cache line without destroying another, if it is not found. */
 int dt_dev_pixelpipe_cache_available(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash);
 
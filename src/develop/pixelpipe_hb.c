@@ -124,7 +124,11 @@ int dt_dev_pixelpipe_init_dummy(dt_dev_pixelpipe_t *pipe, int32_t width, int32_t
 int dt_dev_pixelpipe_init_preview(dt_dev_pixelpipe_t *pipe)
 {
   // don't know which buffer size we're going to need, set to 0 (will be alloced on demand)
-  const int res = dt_dev_pixelpipe_init_cached(pipe, 0, 8);
+  // with half float copies of evicted lines, 4 float + 4 half lines hold as many steps as 8 float lines
+  // in the memory of 6
+  const gboolean half = dt_conf_get_bool("plugins/darkroom/pixelpipe_cache_half");
+  const int res = dt_dev_pixelpipe_init_cached(pipe, 0, half ? 4 : 8);
+  if(res && half) dt_dev_pixelpipe_cache_init_half(&pipe->cache, 4);
   pipe->type = DT_DEV_PIXELPIPE_PREVIEW;
   return res;
 }
@@ -132,7 +136,10 @@ int dt_dev_pixelpipe_init_preview(dt_dev_pixelpipe_t *pipe)
 int dt_dev_pixelpipe_init_preview2(dt_dev_pixelpipe_t *pipe)
 {
   // don't know which buffer size we're going to need, set to 0 (will be alloced on demand)
-  const int res = dt_dev_pixelpipe_init_cached(pipe, 0, 5);
+  const gboolean half = dt_conf_get_bool("plugins/darkroom/pixelpipe_cache_half");
+  // 3 float + 2 half lines, the memory of 4 float lines
+  const int res = dt_dev_pixelpipe_init_cached(pipe, 0, half ? 3 : 5);
+  if(res && half) dt_dev_pixelpipe_cache_init_half(&pipe->cache, 2);
   pipe->type = DT_DEV_PIXELPIPE_PREVIEW2;
   return res;
 }
@@ -151,6 +158,8 @@ int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t
   pipe->processed_width = pipe->backbuf_width = pipe->iwidth = 0;
   pipe->processed_height = pipe->backbuf_height = pipe->iheight = 0;
   pipe->nodes = NULL;
+  pipe->distort_pieces = NULL;
+  pipe->distort_count = 0;
   pipe->backbuf_size = size;
   if(!dt_dev_pixelpipe_cache_init(&(pipe->cache), entries, pipe->backbuf_size)) return 0;
   pipe->cache_obsolete = 0;
@@ -254,6 +263,9 @@ void dt_dev_pixelpipe_cleanup_nodes(dt_dev_pixelpipe_t *pipe)
   }
   g_list_free(pipe->nodes);
   pipe->nodes = NULL;
+  free(pipe->distort_pieces);
+  pipe->distort_pieces = NULL;
+  pipe->distort_count = 0;
   // also cleanup iop here
   if(pipe->iop)
   {
@@ -266,6 +278,31 @@ void dt_dev_pixelpipe_cleanup_nodes(dt_dev_pixelpipe_t *pipe)
   dt_pthread_mutex_unlock(&pipe->busy_mutex);	// safe for others to mess with the pipe now
 }
 
+// collect the pieces of all modules that may move points. whether they are enabled is only known
+// after commit_params, so this is checked again when transforming.
+static void _pixelpipe_compile_distort_chain(dt_dev_pixelpipe_t *pipe)
+{
+  free(pipe->distort_pieces);
+  pipe->distort_pieces = NULL;
+  pipe->distort_count = 0;
+
+  int count = 0;
+  for(const GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+  {
+    const dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    if(piece->module->operation_tags() & IOP_TAG_DISTORT) count++;
+  }
+  if(count == 0) return;
+
+  pipe->distort_pieces = (dt_dev_pixelpipe_iop_t **)malloc(sizeof(dt_dev_pixelpipe_iop_t *) * count);
+  for(const GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    if(piece->module->operation_tags() & IOP_TAG_DISTORT)
+      pipe->distort_pieces[pipe->distort_count++] = piece;
+  }
+}
+
 void dt_dev_pixelpipe_create_nodes(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
 {
   dt_pthread_mutex_lock(&pipe->busy_mutex); // block until pipe is idle
@@ -306,6 +343,7 @@ void dt_dev_pixelpipe_create_nodes(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
     pipe->nodes = g_list_append(pipe->nodes, piece);
     modules = g_list_next(modules);
   }
+  _pixelpipe_compile_distort_chain(pipe);
   dt_pthread_mutex_unlock(&pipe->busy_mutex); // safe for others to use/mess with the pipe now
 }
 
@@ -768,23 +806,70 @@ static gboolean _transform_for_blend(const dt_iop_module_t *const self, const dt
   const dt_develop_blend_params_t *const d = (const dt_develop_blend_params_t *)piece->blendop_data;
 
   if(d) // check only if blend is active
-    if((self->flags() & IOP_FLAGS_SUPPORTS_BLENDING) && (d->mask_mode != DEVELOP_MASK_DISABLED))
+    if((self->flags() & IOP_FLAGS_SUPPORTS_BLENDING) && (d->mask_mode != DEVELOP_MASK_DISABLED)
+       && !dt_develop_blend_is_passthrough(piece))
       return TRUE;
 
   return FALSE;
 }
 
+// darkroom pipes re-run the same modules on the same cached input all the time, so they keep a colorspace
+// converted copy of the module input instead of converting the cached buffer back and forth on every run.
+// export and thumbnail pipes run each module once and convert in place to save memory.
+static inline gboolean _pixelpipe_keeps_converted_input(const dt_dev_pixelpipe_t *pipe)
+{
+  return !(pipe->type & (DT_DEV_PIXELPIPE_EXPORT | DT_DEV_PIXELPIPE_THUMBNAIL));
+}
+
+// returns the module input in colorspace cst_to and stores the colorspace actually reached in *cst.
+static float *_pixelpipe_input_to_cst(dt_dev_pixelpipe_t *pipe, dt_iop_module_t *module, float *input,
+                                      dt_iop_buffer_dsc_t *input_format, const dt_iop_roi_t *roi_in,
+                                      const uint64_t input_hash, const int cst_to, const int ch, int *cst)
+{
+  const dt_iop_order_iccprofile_info_t *const work_profile = dt_ioppr_get_pipe_work_profile_info(pipe);
+  void *converted = NULL;
+
+  if(input_format->cst != cst_to && _pixelpipe_keeps_converted_input(pipe))
+  {
+    const size_t size = dt_iop_buffer_dsc_to_bpp(input_format) * roi_in->width * roi_in->height;
+    if(!dt_dev_pixelpipe_cache_get_variant(&pipe->cache, input_hash, cst_to, size, &converted))
+    {
+      *cst = cst_to;
+      return (float *)converted;
+    }
+  }
+
+  if(converted)
+  {
+    dt_ioppr_transform_image_colorspace(module, input, converted, roi_in->width, roi_in->height,
+                                        input_format->cst, cst_to, cst, ch, work_profile);
+    if(*cst == cst_to) return (float *)converted;
+
+    dt_dev_pixelpipe_cache_invalidate_variant(&pipe->cache);
+    *cst = input_format->cst;
+    return input;
+  }
+
+  // convert in place, the cache line then holds the converted buffer
+  dt_ioppr_transform_image_colorspace(module, input, input, roi_in->width, roi_in->height, input_format->cst,
+                                      cst_to, &input_format->cst, ch, work_profile);
+  *cst = input_format->cst;
+  return input;
+}
+
 static int pixelpipe_process_on_CPU(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev,
-                                    float *input, dt_iop_buffer_dsc_t *input_format, const dt_iop_roi_t *roi_in,
+                                    float *input, dt_iop_buffer_dsc_t *input_format, const uint64_t input_hash,
+                                    const dt_iop_roi_t *roi_in,
                                     void **output, dt_iop_buffer_dsc_t **out_format, const dt_iop_roi_t *roi_out,
                                     dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece,
                                     dt_develop_tiling_t *tiling, dt_pixelpipe_flow_t *pixelpipe_flow)
 {
   // transform to module input colorspace
   int ch = piece->colors;
-  dt_ioppr_transform_image_colorspace(module, input, input, roi_in->width, roi_in->height, input_format->cst,
-                                      module->input_colorspace(module, pipe, piece), &input_format->cst,
-                                      ch, dt_ioppr_get_pipe_work_profile_info(pipe));
+  int module_input_cst = input_format->cst;
+  float *module_input = _pixelpipe_input_to_cst(pipe, module, input, input_format, roi_in, input_hash,
+                                                module->input_colorspace(module, pipe, piece), ch,
+                                                &module_input_cst);
 
   if(dt_atomic_get_int(&pipe->shutdown))
     return 1;
@@ -797,12 +882,12 @@ static int pixelpipe_process_on_CPU(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev,
                                           MAX(roi_in->height, roi_out->height), MAX(in_bpp, bpp),
                                           tiling->factor, tiling->overhead))
   {
-    module->process_tiling(module, piece, input, *output, roi_in, roi_out, in_bpp);
+    module->process_tiling(module, piece, module_input, *output, roi_in, roi_out, in_bpp);
     *pixelpipe_flow |= (PIXELPIPE_FLOW_PROCESSED_ON_CPU | PIXELPIPE_FLOW_PROCESSED_WITH_TILING);
   }
   else
   {
-    module->process(module, piece, input, *output, roi_in, roi_out);
+    module->process(module, piece, module_input, *output, roi_in, roi_out);
     *pixelpipe_flow |= (PIXELPIPE_FLOW_PROCESSED_ON_CPU);
     *pixelpipe_flow &= ~(PIXELPIPE_FLOW_PROCESSED_WITH_TILING);
   }
@@ -817,8 +902,8 @@ static int pixelpipe_process_on_CPU(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev,
   if(dev->gui_attached && pipe == dev->preview_pipe && module == dev->gui_module
      && module->request_color_pick != DT_REQUEST_COLORPICK_OFF && strcmp(module->op, "colorout"))
   {
-    pixelpipe_picker(module, &piece->dsc_in, (float *)input, roi_in, module->picked_color,
-                     module->picked_color_min, module->picked_color_max, input_format->cst, PIXELPIPE_PICKER_INPUT);
+    pixelpipe_picker(module, &piece->dsc_in, module_input, roi_in, module->picked_color,
+                     module->picked_color_min, module->picked_color_max, module_input_cst, PIXELPIPE_PICKER_INPUT);
     pixelpipe_picker(module, &pipe->dsc, (float *)(*output), roi_out, module->picked_output_color,
                      module->picked_output_color_min, module->picked_output_color_max,
                      pipe->dsc.cst, PIXELPIPE_PICKER_OUTPUT);
@@ -828,21 +913,27 @@ static int pixelpipe_process_on_CPU(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev,
   if(dt_atomic_get_int(&pipe->shutdown))
     return 1;
   // blend needs input/output images with default colorspace
+  float *blend_input = module_input;
   if(_transform_for_blend(module, piece))
   {
-    dt_ioppr_transform_image_colorspace(module, input, input, roi_in->width, roi_in->height, input_format->cst,
-                                        module->blend_colorspace(module, pipe, piece), &input_format->cst,
-                                        ch, dt_ioppr_get_pipe_work_profile_info(pipe));
+    const int blend_cst = module->blend_colorspace(module, pipe, piece);
+    int blend_input_cst = module_input_cst;
+    // the untouched input might already be in the blend colorspace
+    if(module_input != input && input_format->cst == blend_cst)
+      blend_input = input;
+    else if(module_input_cst != blend_cst)
+      blend_input = _pixelpipe_input_to_cst(pipe, module, input, input_format, roi_in, input_hash, blend_cst, ch,
+                                            &blend_input_cst);
 
     dt_ioppr_transform_image_colorspace(module, *output, *output, roi_out->width, roi_out->height, pipe->dsc.cst,
-                                        module->blend_colorspace(module, pipe, piece), &pipe->dsc.cst, 
+                                        blend_cst, &pipe->dsc.cst,
                                         ch, dt_ioppr_get_pipe_work_profile_info(pipe));
   }
 
   if(dt_atomic_get_int(&pipe->shutdown))
     return 1;
   /* process blending on CPU */
-  dt_develop_blend_process(module, piece, input, *output, roi_in, roi_out);
+  dt_develop_blend_process(module, piece, blend_input, *output, roi_in, roi_out);
   *pixelpipe_flow |= (PIXELPIPE_FLOW_BLENDED_ON_CPU);
 
   return 0; //no errors
@@ -1055,7 +1146,11 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
     if(dt_atomic_get_int(&pipe->shutdown))
       return 1;
   
-    if (pixelpipe_process_on_CPU(pipe, dev, input, input_format,  &roi_in, output, out_format,
+    // identifies the input buffer for the colorspace converted copy kept in the cache
+    const uint64_t input_hash = _pixelpipe_keeps_converted_input(pipe)
+                                    ? dt_dev_pixelpipe_cache_hash(pipe->image.id, &roi_in, pipe, pos - 1) : 0;
+
+    if (pixelpipe_process_on_CPU(pipe, dev, input, input_format, input_hash, &roi_in, output, out_format,
                                  roi_out, module, piece, &tiling, &pixelpipe_flow))                                                                          
       return 1;
 
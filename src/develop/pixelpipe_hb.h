@@ -107,6 +107,10 @@ typedef struct dt_dev_pixelpipe_t
   dt_iop_buffer_dsc_t dsc;
   // instances of pixelpipe, stored in GList of dt_dev_pixelpipe_iop_t
   GList *nodes;
+  // the subset of nodes belonging to distorting modules, in pipe order. compiled once per
+  // node list so that point (back)transforms don't have to walk the whole pipe.
+  dt_dev_pixelpipe_iop_t **distort_pieces;
+  int distort_count;
   // event flag
   dt_dev_pixelpipe_change_t changed;
   // backbuffer (output)
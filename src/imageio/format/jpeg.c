@@ -35,6 +35,7 @@
 #undef HAVE_STDLIB_H
 #undef HAVE_STDDEF_H
 #include <jpeglib.h>
+#include <jerror.h>
 #undef HAVE_STDLIB_H
 #undef HAVE_STDDEF_H
 
@@ -281,92 +282,301 @@ read_icc_profile (j_decompress_ptr cinfo,
 #undef MAX_SEQ_NO
 
 
-int write_image(dt_imageio_module_data_t *jpg_tmp, const char *filename, const void *in_tmp,
-                dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
-                void *exif, int exif_len, int imgid, int num, int total, struct dt_dev_pixelpipe_t *pipe)
+// the encoder settings, shared by the serial and the banded path
+static void _jpeg_setup(j_compress_ptr cinfo, const dt_imageio_jpeg_t *jpg, const int height, const gboolean gray)
 {
-  dt_imageio_jpeg_t *jpg = (dt_imageio_jpeg_t *)jpg_tmp;
-  const uint8_t *in = (const uint8_t *)in_tmp;
+  cinfo->image_width = jpg->global.width;
+  cinfo->image_height = height;
+  cinfo->input_components = gray ? 1 : 3;
+  cinfo->in_color_space = gray ? JCS_GRAYSCALE : JCS_RGB;
+  jpeg_set_defaults(cinfo);
+  jpeg_set_quality(cinfo, jpg->quality, TRUE);
+  if(jpg->quality > 90) cinfo->comp_info[0].v_samp_factor = 1;
+  if(jpg->quality > 92) cinfo->comp_info[0].h_samp_factor = 1;
+  if(jpg->quality > 95) cinfo->dct_method = JDCT_FLOAT;
+  if(jpg->quality < 50) cinfo->dct_method = JDCT_IFAST;
+  if(jpg->quality < 80) cinfo->smoothing_factor = 20;
+  if(jpg->quality < 60) cinfo->smoothing_factor = 40;
+  if(jpg->quality < 40) cinfo->smoothing_factor = 60;
+  cinfo->optimize_coding = 1;
+
+  // according to specs density_unit = 0, X_density = 1, Y_density = 1 should be fine and valid since it
+  // describes an image with unknown unit and square pixels.
+  // however, some applications (like the Telekom cloud thingy) seem to be confused by that, so let's set
+  // these calues to the same as stored in exiv :/
+  const int resolution = dt_conf_get_int("metadata/resolution");
+  if(resolution > 0)
+  {
+    cinfo->density_unit = 1;
+    cinfo->X_density = resolution;
+    cinfo->Y_density = resolution;
+  }
+  else
+  {
+    cinfo->density_unit = 0;
+    cinfo->X_density = 1;
+    cinfo->Y_density = 1;
+  }
+}
+
+static void _jpeg_write_rows(j_compress_ptr cinfo, const uint8_t *in, const int width)
+{
+  const int components = cinfo->input_components;
+  uint8_t *row = dt_alloc_align(64, (size_t)components * width * sizeof(uint8_t));
+  while(cinfo->next_scanline < cinfo->image_height)
+  {
+    JSAMPROW tmp[1];
+    const uint8_t *buf = in + (size_t)cinfo->next_scanline * width * 4;
+    for(int i = 0; i < width; i++)
+      for(int k = 0; k < components; k++)
+        row[components * i + k] = buf[4 * i + k];
+
+    tmp[0] = row;
+    jpeg_write_scanlines(cinfo, tmp, 1);
+  }
+  dt_free_align(row);
+}
+
+// rows of at least this many pixels are encoded in bands on all cores
+#define DT_JPEG_BAND_MIN_ROWS 128
+
+// one horizontal band encoded to memory
+typedef struct _jpeg_band_t
+{
+  struct jpeg_destination_mgr pub;
+  JOCTET *buf;
+  size_t size;
+  int fail;
+} _jpeg_band_t;
+
+static void _band_init_destination(j_compress_ptr cinfo)
+{
+}
+
+static boolean _band_empty_output_buffer(j_compress_ptr cinfo)
+{
+  // the whole buffer is full when libjpeg calls this, grow it
+  _jpeg_band_t *band = (_jpeg_band_t *)cinfo->dest;
+  JOCTET *buf = realloc(band->buf, 2 * band->size);
+  if(!buf)
+  {
+    band->fail = 1;
+    cinfo->err->msg_code = JERR_OUT_OF_MEMORY;
+    cinfo->err->error_exit((j_common_ptr)cinfo);
+  }
+  band->buf = buf;
+  band->pub.next_output_byte = buf + band->size;
+  band->pub.free_in_buffer = band->size;
+  band->size *= 2;
+  return TRUE;
+}
+
+static void _band_term_destination(j_compress_ptr cinfo)
+{
+}
+
+// encode rows [y0, y0 + rows) as a jpeg of its own, with a restart marker after every row of MCUs.
+// all bands use the standard huffman tables, so their entropy coded segments fit together.
+static int _jpeg_compress_band(const dt_imageio_jpeg_t *jpg, const uint8_t *in, const int y0, const int rows,
+                               const gboolean gray, const JOCTET *icc, const unsigned int icc_len,
+                               _jpeg_band_t *band)
+{
+  struct jpeg_compress_struct cinfo;
   struct dt_imageio_jpeg_error_mgr jerr;
 
-  jpg->cinfo.err = jpeg_std_error(&jerr.pub);
+  band->size = MAX((size_t)jpg->global.width * rows, 4096);
+  band->buf = malloc(band->size);
+  if(!band->buf) return 1;
+  band->pub.init_destination = _band_init_destination;
+  band->pub.empty_output_buffer = _band_empty_output_buffer;
+  band->pub.term_destination = _band_term_destination;
+  band->pub.next_output_byte = band->buf;
+  band->pub.free_in_buffer = band->size;
+
+  cinfo.err = jpeg_std_error(&jerr.pub);
   jerr.pub.error_exit = dt_imageio_jpeg_error_exit;
   if(setjmp(jerr.setjmp_buffer))
   {
-    jpeg_destroy_compress(&(jpg->cinfo));
+    jpeg_destroy_compress(&cinfo);
     return 1;
   }
-  jpeg_create_compress(&(jpg->cinfo));
-  FILE *f = g_fopen(filename, "wb");
-  if(!f) return 1;
-  jpeg_stdio_dest(&(jpg->cinfo), f);
+  jpeg_create_compress(&cinfo);
+  cinfo.dest = &band->pub;
+
+  _jpeg_setup(&cinfo, jpg, rows, gray);
+  cinfo.optimize_coding = 0;
+  cinfo.restart_in_rows = 1;
+
+  jpeg_start_compress(&cinfo, TRUE);
+  if(icc) write_icc_profile(&cinfo, icc, icc_len);
+  _jpeg_write_rows(&cinfo, in + (size_t)4 * y0 * jpg->global.width, jpg->global.width);
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+  return band->fail;
+}
+
+// offset of the entropy coded data behind the SOS header, or 0. the frame height is set to
+// height on the way, if given.
+static size_t _jpeg_scan_start(JOCTET *buf, const size_t len, const int height)
+{
+  size_t pos = 2; // SOI
+  while(pos + 4 <= len && buf[pos] == 0xFF)
+  {
+    const int marker = buf[pos + 1];
+    const size_t seglen = ((size_t)buf[pos + 2] << 8) | buf[pos + 3];
+    if(marker == 0xC0 && height > 0 && pos + 7 <= len)
+    {
+      buf[pos + 5] = (height >> 8) & 0xff;
+      buf[pos + 6] = height & 0xff;
+    }
+    pos += 2 + seglen;
+    if(marker == 0xDA) return pos;
+  }
+  return 0;
+}
 
-  jpg->cinfo.image_width = jpg->global.width;
-  jpg->cinfo.image_height = jpg->global.height;
-  jpg->cinfo.input_components = 3;
-  jpg->cinfo.in_color_space = JCS_RGB;
-  jpeg_set_defaults(&(jpg->cinfo));
-  jpeg_set_quality(&(jpg->cinfo), jpg->quality, TRUE);
-  if(jpg->quality > 90) jpg->cinfo.comp_info[0].v_samp_factor = 1;
-  if(jpg->quality > 92) jpg->cinfo.comp_info[0].h_samp_factor = 1;
-  if(jpg->quality > 95) jpg->cinfo.dct_method = JDCT_FLOAT;
-  if(jpg->quality < 50) jpg->cinfo.dct_method = JDCT_IFAST;
-  if(jpg->quality < 80) jpg->cinfo.smoothing_factor = 20;
-  if(jpg->quality < 60) jpg->cinfo.smoothing_factor = 40;
-  if(jpg->quality < 40) jpg->cinfo.smoothing_factor = 60;
-  jpg->cinfo.optimize_coding = 1;
+/* Encode horizontal bands on all cores and splice them to one baseline jpeg. The restart
+ * interval is one row of MCUs and bands start on MCU rows, so every band begins right after
+ * a restart marker: the DC predictions start over there and the scan of band k continues the
+ * scan of band k-1 once its restart markers are renumbered. Only the standard huffman tables
+ * can be shared, optimize_coding is off in this mode. */
+static int _jpeg_write_banded(const dt_imageio_jpeg_t *jpg, const uint8_t *in, const gboolean gray,
+                              const JOCTET *icc, const unsigned int icc_len, const int band_rows,
+                              const int mcu_rows, FILE *f)
+{
+  const int height = jpg->global.height;
+  const int nbands = (height + band_rows - 1) / band_rows;
+  _jpeg_band_t *bands = calloc(nbands, sizeof(_jpeg_band_t));
+  if(!bands) return 1;
+  int fail = 0;
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(jpg, in, gray, icc, icc_len, band_rows, height, nbands, bands) \
+  reduction(|:fail) schedule(dynamic)
+#endif
+  for(int k = 0; k < nbands; k++)
+  {
+    const int y0 = k * band_rows;
+    fail |= _jpeg_compress_band(jpg, in, y0, MIN(band_rows, height - y0), gray, k == 0 ? icc : NULL,
+                                icc_len, bands + k);
+  }
 
-  // according to specs density_unit = 0, X_density = 1, Y_density = 1 should be fine and valid since it
-  // describes an image with unknown unit and square pixels.
-  // however, some applications (like the Telekom cloud thingy) seem to be confused by that, so let's set
-  // these calues to the same as stored in exiv :/
-  const int resolution = dt_conf_get_int("metadata/resolution");
-  if(resolution > 0)
+  for(int k = 0; !fail && k < nbands; k++)
   {
-    jpg->cinfo.density_unit = 1;
-    jpg->cinfo.X_density = resolution;
-    jpg->cinfo.Y_density = resolution;
+    JOCTET *buf = bands[k].buf;
+    const size_t len = bands[k].size - bands[k].pub.free_in_buffer;
+    const size_t start = _jpeg_scan_start(buf, len, k == 0 ? height : 0);
+    if(!start || len < start + 2)
+    {
+      fail = 1;
+      break;
+    }
+
+    // restart intervals before this band, the marker in front of it closes the last one
+    const int intervals = k * band_rows / mcu_rows;
+    if(k == 0)
+      fail |= fwrite(buf, 1, start, f) != start;
+    else
+    {
+      const JOCTET rst[2] = { 0xFF, 0xD0 + (intervals - 1) % 8 };
+      fail |= fwrite(rst, 1, 2, f) != 2;
+    }
+
+    // the data ends with EOI, markers inside are renumbered to continue the count
+    const size_t end = len - 2;
+    for(size_t p = start; p + 1 < end; p++)
+      if(buf[p] == 0xFF && buf[p + 1] >= 0xD0 && buf[p + 1] <= 0xD7)
+      {
+        buf[p + 1] = 0xD0 + (buf[p + 1] - 0xD0 + intervals) % 8;
+        p++;
+      }
+    fail |= fwrite(buf + start, 1, end - start, f) != end - start;
   }
-  else
+
+  if(!fail)
   {
-    jpg->cinfo.density_unit = 0;
-    jpg->cinfo.X_density = 1;
-    jpg->cinfo.Y_density = 1;
+    const JOCTET eoi[2] = { 0xFF, 0xD9 };
+    fail = fwrite(eoi, 1, 2, f) != 2;
   }
 
-  jpeg_start_compress(&(jpg->cinfo), TRUE);
+  for(int k = 0; k < nbands; k++) free(bands[k].buf);
+  free(bands);
+  return fail;
+}
 
+int write_image(dt_imageio_module_data_t *jpg_tmp, const char *filename, const void *in_tmp,
+                dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                void *exif, int exif_len, int imgid, int num, int total, struct dt_dev_pixelpipe_t *pipe)
+{
+  dt_imageio_jpeg_t *jpg = (dt_imageio_jpeg_t *)jpg_tmp;
+  const uint8_t *in = (const uint8_t *)in_tmp;
+  struct dt_imageio_jpeg_error_mgr jerr;
+  const gboolean gray = pipe && pipe->colors == 1;
+
+  unsigned char *icc = NULL;
+  uint32_t icc_len = 0;
   if(imgid > 0)
   {
-    cmsHPROFILE out_profile = dt_colorspaces_get_output_profile(imgid, over_type, over_filename)->profile;
-    uint32_t len = 0;
-    cmsSaveProfileToMem(out_profile, 0, &len);
-    if(len > 0)
+    cmsHPROFILE rgb_profile = dt_colorspaces_get_output_profile(imgid, over_type, over_filename)->profile;
+    cmsHPROFILE gray_profile = gray ? dt_colorspaces_create_gray_profile(rgb_profile) : NULL;
+    cmsHPROFILE out_profile = gray ? gray_profile : rgb_profile;
+    if(out_profile) cmsSaveProfileToMem(out_profile, 0, &icc_len);
+    if(icc_len > 0)
     {
-      unsigned char *buf = malloc(len * sizeof(unsigned char));
-      cmsSaveProfileToMem(out_profile, buf, &len);
-      write_icc_profile(&(jpg->cinfo), buf, len);
-      free(buf);
+      icc = malloc(icc_len * sizeof(unsigned char));
+      if(icc) cmsSaveProfileToMem(out_profile, icc, &icc_len);
     }
+    dt_colorspaces_cleanup_profile(gray_profile);
   }
 
-  uint8_t *row = dt_alloc_align(64, (size_t)3 * jpg->global.width * sizeof(uint8_t));
-  const uint8_t *buf;
-  while(jpg->cinfo.next_scanline < jpg->cinfo.image_height)
+  FILE *f = g_fopen(filename, "wb");
+  if(!f)
   {
-    JSAMPROW tmp[1];
-    buf = in + (size_t)jpg->cinfo.next_scanline * jpg->cinfo.image_width * 4;
-    for(int i = 0; i < jpg->global.width; i++)
-      for(int k = 0; k < 3; k++)
-        row[3 * i + k] = pipe->colors > 1 ? buf[4 * i + k] : buf[4 * i];
-        
-    tmp[0] = row;
-    jpeg_write_scanlines(&(jpg->cinfo), tmp, 1);
+    free(icc);
+    return 1;
+  }
+
+  jpg->cinfo.err = jpeg_std_error(&jerr.pub);
+  jerr.pub.error_exit = dt_imageio_jpeg_error_exit;
+  if(setjmp(jerr.setjmp_buffer))
+  {
+    jpeg_destroy_compress(&(jpg->cinfo));
+    fclose(f);
+    free(icc);
+    return 1;
+  }
+  jpeg_create_compress(&(jpg->cinfo));
+  jpeg_stdio_dest(&(jpg->cinfo), f);
+  _jpeg_setup(&(jpg->cinfo), jpg, jpg->global.height, gray);
+
+  // bands have to start on a row of MCUs, and input smoothing would look across their borders
+  int mcu_rows = 0;
+  for(int c = 0; c < jpg->cinfo.num_components; c++)
+    mcu_rows = MAX(mcu_rows, DCTSIZE * jpg->cinfo.comp_info[c].v_samp_factor);
+  const int threads = dt_get_num_threads();
+  const int band_rows = MAX(DT_JPEG_BAND_MIN_ROWS, (jpg->global.height + threads - 1) / threads);
+  const int band_rows_mcu = (band_rows + mcu_rows - 1) / mcu_rows * mcu_rows;
+
+  if(dt_conf_get_bool("plugins/imageio/format/jpeg/parallel") && jpg->cinfo.smoothing_factor == 0
+     && threads > 1 && jpg->global.height > band_rows_mcu)
+  {
+    jpeg_destroy_compress(&(jpg->cinfo));
+    const int res = _jpeg_write_banded(jpg, in, gray, icc, icc_len, band_rows_mcu, mcu_rows, f);
+    fclose(f);
+    free(icc);
+    if(res) return 1;
+  }
+  else
+  {
+    jpeg_start_compress(&(jpg->cinfo), TRUE);
+    if(icc) write_icc_profile(&(jpg->cinfo), icc, icc_len);
+    _jpeg_write_rows(&(jpg->cinfo), in, jpg->global.width);
+    jpeg_finish_compress(&(jpg->cinfo));
+    jpeg_destroy_compress(&(jpg->cinfo));
+    fclose(f);
+    free(icc);
   }
-  jpeg_finish_compress(&(jpg->cinfo));
-  dt_free_align(row);
-  jpeg_destroy_compress(&(jpg->cinfo));
-  fclose(f);
 
   dt_exif_write_blob(exif, exif_len, filename, 1);
 
@@ -527,7 +737,7 @@ const char *extension(dt_imageio_module_data_t *data)
 
 int flags(dt_imageio_module_data_t *data)
 {
-  return FORMAT_FLAGS_SUPPORT_XMP;
+  return FORMAT_FLAGS_SUPPORT_XMP | FORMAT_FLAGS_SUPPORT_GRAY;
 }
 
 void init(dt_imageio_module_format_t *self)
@@ -32,6 +32,7 @@
 #include "common/imageio.h"
 #include "common/imageio_module.h"
 #include "control/conf.h"
+#include "develop/pixelpipe_hb.h"
 #include "imageio/format/imageio_format_api.h"
 
 DT_MODULE(3)
@@ -117,14 +118,242 @@ static void PNGwriteRawProfile(png_struct *ping, png_info *ping_info, char *prof
   png_free(ping, text);
 }
 
+// rows are filtered and deflated in blocks of about this size on all cores, pigz style
+#define DT_PNG_BLOCK_BYTES (256 * 1024)
+// the compressed stream is split in IDAT chunks of this size
+#define DT_PNG_IDAT_BYTES (1024 * 1024)
+// deflate looks back this far, each block is primed with the data before it
+#define DT_PNG_WINDOW 32768
+
+static inline int _png_paeth(const int a, const int b, const int c)
+{
+  const int p = a + b - c;
+  const int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+  return (pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c);
+}
+
+static inline uint8_t _png_filter_byte(const int filter, const uint8_t *row, const uint8_t *prev, const size_t i,
+                                       const int bpp)
+{
+  const int x = row[i];
+  const int a = i >= (size_t)bpp ? row[i - bpp] : 0;
+  const int b = prev[i];
+  const int c = i >= (size_t)bpp ? prev[i - bpp] : 0;
+  switch(filter)
+  {
+    case PNG_FILTER_VALUE_SUB:
+      return x - a;
+    case PNG_FILTER_VALUE_UP:
+      return x - b;
+    case PNG_FILTER_VALUE_AVG:
+      return x - ((a + b) >> 1);
+    case PNG_FILTER_VALUE_PAETH:
+      return x - _png_paeth(a, b, c);
+    default:
+      return x;
+  }
+}
+
+// filter one row with the filter libpng's heuristic picks: the smallest sum of the bytes as signed values
+static void _png_filter_row(uint8_t *out, const uint8_t *row, const uint8_t *prev, const size_t rowbytes,
+                            const int bpp)
+{
+  int best = PNG_FILTER_VALUE_NONE;
+  uint64_t best_sum = UINT64_MAX;
+  for(int filter = PNG_FILTER_VALUE_NONE; filter <= PNG_FILTER_VALUE_PAETH; filter++)
+  {
+    uint64_t sum = 0;
+    for(size_t i = 0; i < rowbytes && sum < best_sum; i++)
+      sum += abs((int8_t)_png_filter_byte(filter, row, prev, i, bpp));
+    if(sum < best_sum)
+    {
+      best_sum = sum;
+      best = filter;
+    }
+  }
+
+  out[0] = best;
+  for(size_t i = 0; i < rowbytes; i++) out[i + 1] = _png_filter_byte(best, row, prev, i, bpp);
+}
+
+// pack row y to big endian samples without the padding channel
+static void _png_pack_row(uint8_t *out, const void *ivoid, const int y, const int width, const int bits,
+                          const int channels)
+{
+  if(bits > 8)
+  {
+    // 16 bit samples are stored most significant byte first
+    const uint16_t *in = (const uint16_t *)ivoid + (size_t)4 * y * width;
+    for(int x = 0; x < width; x++)
+      for(int c = 0; c < channels; c++, out += 2)
+      {
+        out[0] = in[4 * x + c] >> 8;
+        out[1] = in[4 * x + c] & 0xff;
+      }
+  }
+  else
+  {
+    const uint8_t *in = (const uint8_t *)ivoid + (size_t)4 * y * width;
+    for(int x = 0; x < width; x++)
+      for(int c = 0; c < channels; c++) *out++ = in[4 * x + c];
+  }
+}
+
+/* Compress the image to a complete zlib stream for the IDAT chunks. libpng deflates in one
+ * stream on one thread, which dominates the export of large 16 bit files. Here the filtered
+ * rows are cut in blocks deflated in parallel, each primed with the 32k before it and ended on a
+ * byte boundary by a sync flush, so the blocks concatenate to one ordinary deflate stream.
+ * every block packs and filters its own rows and the ones its window reaches back to, so only
+ * the compressed stream is held for the whole image. */
+static uint8_t *_png_compress(const void *ivoid, const int width, const int height, const int bits,
+                              const int channels, const int level, size_t *out_len)
+{
+  const int bpp = channels * bits / 8;
+  const size_t rowbytes = (size_t)width * bpp;
+  const size_t stride = rowbytes + 1;
+  const size_t total = stride * height;
+  const int rows_per_block = CLAMP(DT_PNG_BLOCK_BYTES / stride, 1, (size_t)height);
+  const int nblocks = (height + rows_per_block - 1) / rows_per_block;
+  // rows before a block the deflate window reaches into
+  const int window_rows = (DT_PNG_WINDOW + stride - 1) / stride;
+
+  uint8_t **block = calloc(nblocks, sizeof(uint8_t *));
+  size_t *block_len = calloc(nblocks, sizeof(size_t));
+  uLong *block_adler = calloc(nblocks, sizeof(uLong));
+  uint8_t *res = NULL;
+  int fail = !block || !block_len || !block_adler;
+  if(fail) goto exit;
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(ivoid, block, block_len, block_adler, nblocks, rows_per_block, window_rows, width, height, \
+                      bits, channels, bpp, rowbytes, stride, level) \
+  reduction(|:fail) schedule(dynamic)
+#endif
+  for(int k = 0; k < nblocks; k++)
+  {
+    const int y0 = rows_per_block * k;
+    const int y1 = MIN(y0 + rows_per_block, height);
+    const int yw = MAX(y0 - window_rows, 0);
+    const gboolean last = k == nblocks - 1;
+
+    // rows yw-1 (zeros above the image) to y1-1 packed, rows yw to y1-1 filtered
+    uint8_t *packed = malloc(rowbytes * (y1 - yw + 1));
+    uint8_t *filtered = malloc(stride * (y1 - yw));
+    if(!packed || !filtered)
+    {
+      free(packed);
+      free(filtered);
+      fail = 1;
+      continue;
+    }
+    if(yw == 0)
+      memset(packed, 0, rowbytes);
+    else
+      _png_pack_row(packed, ivoid, yw - 1, width, bits, channels);
+    for(int y = yw; y < y1; y++)
+    {
+      _png_pack_row(packed + rowbytes * (y - yw + 1), ivoid, y, width, bits, channels);
+      _png_filter_row(filtered + stride * (y - yw), packed + rowbytes * (y - yw + 1), packed + rowbytes * (y - yw),
+                      rowbytes, bpp);
+    }
+    free(packed);
+
+    const uint8_t *const data = filtered + stride * (y0 - yw);
+    const size_t len = stride * (y1 - y0);
+
+    z_stream zs = { 0 };
+    if(deflateInit2(&zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+      free(filtered);
+      fail = 1;
+      continue;
+    }
+    if(y0 > 0)
+    {
+      const size_t dict = MIN(stride * (y0 - yw), DT_PNG_WINDOW);
+      deflateSetDictionary(&zs, data - dict, dict);
+    }
+
+    // room for the incompressible case plus the flush markers
+    const size_t bound = deflateBound(&zs, len) + 16;
+    uint8_t *out = malloc(bound);
+    if(out)
+    {
+      zs.next_in = (uint8_t *)data;
+      zs.avail_in = len;
+      zs.next_out = out;
+      zs.avail_out = bound;
+      const int ret = deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+      if((last && ret == Z_STREAM_END) || (!last && ret == Z_OK && zs.avail_in == 0))
+      {
+        block[k] = out;
+        block_len[k] = bound - zs.avail_out;
+        block_adler[k] = adler32(adler32(0L, Z_NULL, 0), data, len);
+      }
+      else
+        free(out);
+    }
+    deflateEnd(&zs);
+    free(filtered);
+    if(!block[k]) fail = 1;
+  }
+  if(fail) goto exit;
+
+  // zlib header, the blocks, and the adler32 of all the data
+  size_t len = 2 + 4;
+  for(int k = 0; k < nblocks; k++) len += block_len[k];
+  res = malloc(len);
+  if(!res) goto exit;
+
+  const int flevel = level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3;
+  res[0] = 0x78;
+  res[1] = flevel << 6;
+  res[1] += 31 - (res[0] * 256 + res[1]) % 31;
+
+  size_t pos = 2;
+  uLong adler = adler32(0L, Z_NULL, 0);
+  for(int k = 0; k < nblocks; k++)
+  {
+    memcpy(res + pos, block[k], block_len[k]);
+    pos += block_len[k];
+    const size_t block_bytes = MIN(stride * rows_per_block, total - stride * rows_per_block * k);
+    adler = adler32_combine(adler, block_adler[k], block_bytes);
+  }
+  res[pos++] = (adler >> 24) & 0xff;
+  res[pos++] = (adler >> 16) & 0xff;
+  res[pos++] = (adler >> 8) & 0xff;
+  res[pos++] = adler & 0xff;
+  *out_len = pos;
+
+exit:
+  if(block)
+    for(int k = 0; k < nblocks; k++) free(block[k]);
+  free(block);
+  free(block_len);
+  free(block_adler);
+  return res;
+}
+
 int write_image(dt_imageio_module_data_t *p_tmp, const char *filename, const void *ivoid,
                 dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
                 void *exif, int exif_len, int imgid, int num, int total, struct dt_dev_pixelpipe_t *pipe)
 {
   dt_imageio_png_t *p = (dt_imageio_png_t *)p_tmp;
   const int width = p->global.width, height = p->global.height;
+  const gboolean gray = pipe && pipe->colors == 1;
+
+  // libpng only sees the finished image data, compressed on all cores
+  size_t idat_len = 0;
+  uint8_t *idat = _png_compress(ivoid, width, height, p->bpp, gray ? 1 : 3, p->compression, &idat_len);
+  if(!idat) return 1;
+
   FILE *f = g_fopen(filename, "wb");
-  if(!f) return 1;
+  if(!f)
+  {
+    free(idat);
+    return 1;
+  }
 
   png_structp png_ptr;
   png_infop info_ptr;
@@ -133,6 +362,7 @@ int write_image(dt_imageio_module_data_t *p_tmp, const char *filename, const voi
   if(!png_ptr)
   {
     fclose(f);
+    free(idat);
     return 1;
   }
 
@@ -140,6 +370,7 @@ int write_image(dt_imageio_module_data_t *p_tmp, const char *filename, const voi
   if(!info_ptr)
   {
     fclose(f);
+    free(idat);
     png_destroy_write_struct(&png_ptr, NULL);
     return 1;
   }
@@ -147,30 +378,26 @@ int write_image(dt_imageio_module_data_t *p_tmp, const char *filename, const voi
   if(setjmp(png_jmpbuf(png_ptr)))
   {
     fclose(f);
+    free(idat);
     png_destroy_write_struct(&png_ptr, &info_ptr);
     return 1;
   }
 
   png_init_io(png_ptr, f);
 
-  png_set_compression_level(png_ptr, p->compression);
-  png_set_compression_mem_level(png_ptr, 8);
-  png_set_compression_strategy(png_ptr, Z_DEFAULT_STRATEGY);
-  png_set_compression_window_bits(png_ptr, 15);
-  png_set_compression_method(png_ptr, 8);
-  png_set_compression_buffer_size(png_ptr, 8192);
-
-  png_set_IHDR(png_ptr, info_ptr, width, height, p->bpp, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
-               PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+  png_set_IHDR(png_ptr, info_ptr, width, height, p->bpp, gray ? PNG_COLOR_TYPE_GRAY : PNG_COLOR_TYPE_RGB,
+               PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
 
   // metadata has to be written before the pixels
 
   // embed icc profile
   if(imgid > 0)
   {
-    cmsHPROFILE out_profile = dt_colorspaces_get_output_profile(imgid, over_type, over_filename)->profile;
+    cmsHPROFILE rgb_profile = dt_colorspaces_get_output_profile(imgid, over_type, over_filename)->profile;
+    cmsHPROFILE gray_profile = gray ? dt_colorspaces_create_gray_profile(rgb_profile) : NULL;
+    cmsHPROFILE out_profile = gray ? gray_profile : rgb_profile;
     uint32_t len = 0;
-    cmsSaveProfileToMem(out_profile, 0, &len);
+    if(out_profile) cmsSaveProfileToMem(out_profile, 0, &len);
     if(len > 0)
     {
       char *buf = malloc(len * sizeof(char));
@@ -187,6 +414,7 @@ int write_image(dt_imageio_module_data_t *p_tmp, const char *filename, const voi
                    len);
       free(buf);
     }
+    dt_colorspaces_cleanup_profile(gray_profile);
   }
 
   // write exif data
@@ -194,30 +422,14 @@ int write_image(dt_imageio_module_data_t *p_tmp, const char *filename, const voi
 
   png_write_info(png_ptr, info_ptr);
 
-  /*
-   * Get rid of filler (OR ALPHA) bytes, pack XRGB/RGBX/ARGB/RGBA into
-   * RGB (4 channels -> 3 channels). The second parameter is not used.
-   */
-  png_set_filler(png_ptr, 0, PNG_FILLER_AFTER);
-
-  png_bytep *row_pointers = dt_alloc_align(64, (size_t)height * sizeof(png_bytep));
-
-  if(p->bpp > 8)
-  {
-    /* swap bytes of 16 bit files to most significant bit first */
-    png_set_swap(png_ptr);
-
-    for(unsigned i = 0; i < height; i++)
-      row_pointers[i] = (png_bytep)((uint16_t *)ivoid + (size_t)4 * i * width);
-  }
-  else
-    for(unsigned i = 0; i < height; i++) row_pointers[i] = (uint8_t *)ivoid + (size_t)4 * i * width;
+  // the zlib stream is ready, hand it over in chunks of reasonable size and close the file
+  for(size_t off = 0; off < idat_len; off += DT_PNG_IDAT_BYTES)
+    png_write_chunk(png_ptr, (png_bytep) "IDAT", idat + off, MIN(DT_PNG_IDAT_BYTES, idat_len - off));
+  png_write_chunk(png_ptr, (png_bytep) "IEND", NULL, 0);
 
-  png_write_image(png_ptr, row_pointers);
-  dt_free_align(row_pointers);
-  png_write_end(png_ptr, info_ptr);
   png_destroy_write_struct(&png_ptr, &info_ptr);
   fclose(f);
+  free(idat);
   return 0;
 }
 
@@ -546,7 +758,7 @@ void gui_reset(dt_imageio_module_format_t *self)
 
 int flags(dt_imageio_module_data_t *data)
 {
-  return FORMAT_FLAGS_SUPPORT_XMP;
+  return FORMAT_FLAGS_SUPPORT_XMP | FORMAT_FLAGS_SUPPORT_GRAY;
 }
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
@@ -30,6 +30,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <tiffio.h>
+#include <zlib.h>
 
 #define CLAMP_FLT(A) ((A) > (0.0f) ? ((A) < (1.0f) ? (A) : (1.0f)) : (0.0f))
 
@@ -37,6 +38,9 @@
 // but at least GIMP can't open TIFF files where not all layers have the same format.
 #define MASKS_USE_SAME_FORMAT
 
+// deflated strips are compressed in parallel, this much raw data each keeps the ratio of one stream
+#define DT_TIFF_STRIP_BYTES (512 * 1024)
+
 DT_MODULE(3)
 
 typedef struct dt_imageio_tiff_t
@@ -58,6 +62,115 @@ typedef struct dt_imageio_tiff_gui_t
 } dt_imageio_tiff_gui_t;
 
 
+// pack row y of the 4 channel buffer to layers samples per pixel, in file (little endian) byte order,
+// and apply the predictor the way libtiff's encoder would. tmp holds one packed row.
+static void _pack_row(uint8_t *out, uint8_t *tmp, const void *in_void, const int y, const int width,
+                      const int layers, const int bpp, const gboolean predictor)
+{
+  const size_t n = (size_t)width * layers;
+
+  if(bpp == 32)
+  {
+    const float *in = (const float *)in_void + (size_t)4 * y * width;
+    float *row = (float *)out;
+    for(int x = 0; x < width; x++) memcpy(row + (size_t)layers * x, in + (size_t)4 * x, layers * sizeof(float));
+
+    if(!predictor)
+    {
+      if(G_BYTE_ORDER == G_BIG_ENDIAN)
+        for(size_t k = 0; k < n; k++) ((uint32_t *)row)[k] = GUINT32_SWAP_LE_BE(((uint32_t *)row)[k]);
+      return;
+    }
+
+    // floating point predictor: split the samples in byte planes, most significant first,
+    // then difference the bytes along the row
+    memcpy(tmp, out, 4 * n);
+    for(size_t k = 0; k < n; k++)
+      for(int b = 0; b < 4; b++)
+        out[(G_BYTE_ORDER == G_BIG_ENDIAN ? b : 3 - b) * n + k] = tmp[4 * k + b];
+    for(size_t k = 4 * n - 1; k >= (size_t)layers; k--) out[k] -= out[k - layers];
+  }
+  else if(bpp == 16)
+  {
+    const uint16_t *in = (const uint16_t *)in_void + (size_t)4 * y * width;
+    uint16_t *row = (uint16_t *)out;
+    for(int x = 0; x < width; x++)
+      memcpy(row + (size_t)layers * x, in + (size_t)4 * x, layers * sizeof(uint16_t));
+    if(predictor)
+      for(size_t k = n - 1; k >= (size_t)layers; k--) row[k] -= row[k - layers];
+    if(G_BYTE_ORDER == G_BIG_ENDIAN)
+      for(size_t k = 0; k < n; k++) row[k] = GUINT16_SWAP_LE_BE(row[k]);
+  }
+  else
+  {
+    const uint8_t *in = (const uint8_t *)in_void + (size_t)4 * y * width;
+    for(int x = 0; x < width; x++) memcpy(out + (size_t)layers * x, in + (size_t)4 * x, layers);
+    if(predictor)
+      for(size_t k = n - 1; k >= (size_t)layers; k--) out[k] -= out[k - layers];
+  }
+}
+
+// libtiff deflates strip after strip on one thread. compress them on all cores instead and
+// hand them over raw, the strips stay plain adobe deflate streams any reader can decode.
+static int _write_deflate_strips(TIFF *tif, const dt_imageio_tiff_t *d, const void *in_void, const int layers,
+                                 const uint32_t rowsperstrip)
+{
+  const int width = d->global.width;
+  const int height = d->global.height;
+  const int bpp = d->bpp;
+  const int level = d->compresslevel;
+  const gboolean predictor = d->compress == 2;
+  const size_t rowsize = (size_t)width * layers * bpp / 8;
+  const int nstrips = (height + rowsperstrip - 1) / rowsperstrip;
+
+  uint8_t **strip = calloc(nstrips, sizeof(uint8_t *));
+  uLongf *strip_len = calloc(nstrips, sizeof(uLongf));
+  int fail = !strip || !strip_len;
+
+  if(!fail)
+  {
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(strip, strip_len, in_void, width, height, layers, bpp, level, predictor, rowsize, \
+                      rowsperstrip, nstrips) \
+  reduction(|:fail) schedule(dynamic)
+#endif
+    for(int s = 0; s < nstrips; s++)
+    {
+      const int y0 = s * rowsperstrip;
+      const int rows = MIN(rowsperstrip, height - y0);
+      const size_t size = rowsize * rows;
+      uLongf len = compressBound(size);
+      uint8_t *raw = malloc(size + rowsize);
+      uint8_t *z = malloc(len);
+
+      if(raw && z)
+      {
+        for(int r = 0; r < rows; r++)
+          _pack_row(raw + rowsize * r, raw + size, in_void, y0 + r, width, layers, bpp, predictor);
+        if(compress2(z, &len, raw, size, level) == Z_OK)
+        {
+          strip[s] = z;
+          strip_len[s] = len;
+          z = NULL;
+        }
+      }
+      if(!strip[s]) fail = 1;
+      free(raw);
+      free(z);
+    }
+  }
+
+  for(int s = 0; !fail && s < nstrips; s++)
+    if(TIFFWriteRawStrip(tif, s, strip[s], strip_len[s]) == -1) fail = 1;
+
+  if(strip)
+    for(int s = 0; s < nstrips; s++) free(strip[s]);
+  free(strip);
+  free(strip_len);
+  return fail;
+}
+
 int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const void *in_void,
                 dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
                 void *exif, int exif_len, int imgid, int num, int total, dt_dev_pixelpipe_t *pipe)
@@ -78,22 +191,6 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
 #endif
   int rc = 1; // default to error
 
-  if(imgid > 0)
-  {
-    cmsHPROFILE out_profile = dt_colorspaces_get_output_profile(imgid, over_type, over_filename)->profile;
-    cmsSaveProfileToMem(out_profile, 0, &profile_len);
-    if(profile_len > 0)
-    {
-      profile = malloc(profile_len);
-      if(!profile)
-      {
-        rc = 1;
-        goto exit;
-      }
-      cmsSaveProfileToMem(out_profile, profile, &profile_len);
-    }
-  }
-
   int n_pages = 1;
   // Create little endian tiff image
 #ifdef _WIN32
@@ -138,10 +235,6 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
   }
 
   TIFFSetField(tif, TIFFTAG_FILLORDER, (uint16_t)FILLORDER_MSB2LSB);
-  if(profile != NULL)
-  {
-    TIFFSetField(tif, TIFFTAG_ICCPROFILE, (uint32_t)profile_len, profile);
-  }
 
 /* Howto check for a grayscale image?
    We test every pixel for differences between the rgb channels using specific thresholds
@@ -156,7 +249,8 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
   if(dt_conf_key_exists("plugins/imageio/format/tiff/shortfile"))
     shortmode = dt_conf_get_int("plugins/imageio/format/tiff/shortfile");
     
-  if(pipe->colors == 1 && shortmode)
+  // gray pipes hand over L in the first channel only
+  if(pipe && pipe->colors == 1)
   {
     layers = 1;
     goto checkdone;
@@ -216,6 +310,27 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
   if(layers == 1)
     dt_control_log(_("will export as a grayscale image"));
 
+  if(imgid > 0)
+  {
+    cmsHPROFILE rgb_profile = dt_colorspaces_get_output_profile(imgid, over_type, over_filename)->profile;
+    cmsHPROFILE gray_profile = layers == 1 ? dt_colorspaces_create_gray_profile(rgb_profile) : NULL;
+    cmsHPROFILE out_profile = layers == 1 ? gray_profile : rgb_profile;
+    if(out_profile) cmsSaveProfileToMem(out_profile, 0, &profile_len);
+    if(profile_len > 0)
+    {
+      profile = malloc(profile_len);
+      if(!profile)
+      {
+        dt_colorspaces_cleanup_profile(gray_profile);
+        rc = 1;
+        goto exit;
+      }
+      cmsSaveProfileToMem(out_profile, profile, &profile_len);
+      TIFFSetField(tif, TIFFTAG_ICCPROFILE, (uint32_t)profile_len, profile);
+    }
+    dt_colorspaces_cleanup_profile(gray_profile);
+  }
+
   TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, (uint16_t)layers);
   TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, (uint16_t)d->bpp);
   TIFFSetField(tif, TIFFTAG_SAMPLEFORMAT, (uint16_t)(d->bpp == 32 ? SAMPLEFORMAT_IEEEFP : SAMPLEFORMAT_UINT));
@@ -226,8 +341,13 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
   else
     TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, (uint16_t)PHOTOMETRIC_MINISBLACK);
 
+  const size_t rowsize = (d->global.width * layers) * d->bpp / 8;
+  // compressed strips are deflated in parallel, give each one enough rows to compress well
+  const uint32_t rowsperstrip = d->compress > 0 ? CLAMP(DT_TIFF_STRIP_BYTES / rowsize, 1, (size_t)d->global.height)
+                                                : TIFFDefaultStripSize(tif, 0);
+
   TIFFSetField(tif, TIFFTAG_PLANARCONFIG, (uint16_t)PLANARCONFIG_CONTIG);
-  TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, TIFFDefaultStripSize(tif, 0));
+  TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, rowsperstrip);
   TIFFSetField(tif, TIFFTAG_ORIENTATION, (uint16_t)ORIENTATION_TOPLEFT);
 
   int resolution = dt_conf_get_int("metadata/resolution");
@@ -238,14 +358,20 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
     TIFFSetField(tif, TIFFTAG_RESOLUTIONUNIT, (uint16_t)RESUNIT_INCH);
   }
 
-  const size_t rowsize = (d->global.width * layers) * d->bpp / 8;
-  if((rowdata = malloc(rowsize)) == NULL)
+  if(d->compress > 0)
+  {
+    if(_write_deflate_strips(tif, d, in_void, layers, rowsperstrip))
+    {
+      rc = 1;
+      goto exit;
+    }
+  }
+  else if((rowdata = malloc(rowsize)) == NULL)
   {
     rc = 1;
     goto exit;
   }
-
-  if(d->bpp == 32)
+  else if(d->bpp == 32)
   {
     for(int y = 0; y < d->global.height; y++)
     {
@@ -660,7 +786,7 @@ void gui_reset(dt_imageio_module_format_t *self)
 
 int flags(dt_imageio_module_data_t *data)
 {
-  return FORMAT_FLAGS_SUPPORT_XMP | FORMAT_FLAGS_SUPPORT_LAYERS;
+  return FORMAT_FLAGS_SUPPORT_XMP | FORMAT_FLAGS_SUPPORT_LAYERS | FORMAT_FLAGS_SUPPORT_GRAY;
 }
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
@@ -25,9 +25,11 @@
 #include "common/imageio.h"
 #include "common/imageio_module.h"
 #include "control/conf.h"
+#include "develop/pixelpipe_hb.h"
 #include "imageio/format/imageio_format_api.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <webp/encode.h>
 
@@ -151,9 +153,46 @@ int write_image(dt_imageio_module_data_t *webp, const char *filename, const void
   pic.writer = FileWriter;
   pic.custom_ptr = out;
 
-  WebPPictureImportRGBX(&pic, (const uint8_t *)in_tmp, webp_data->global.width * 4);
+  if(pipe && pipe->colors == 1)
+  {
+    // webp has no single channel mode, but gray needs no rgb to yuv conversion:
+    // the luma follows from the gray value and chroma is neutral.
+    if(!WebPPictureAlloc(&pic))
+      goto error;
+
+    const uint8_t *const in = (const uint8_t *)in_tmp;
+
+    if(pic.use_argb)
+    {
+      for(int y = 0; y < pic.height; y++)
+        for(int x = 0; x < pic.width; x++)
+        {
+          const uint32_t L = in[(size_t)4 * (y * pic.width + x)];
+          pic.argb[(size_t)y * pic.argb_stride + x] = 0xff000000u | (L << 16) | (L << 8) | L;
+        }
+    }
+    else
+    {
+      // same fixed point bt.601 luma as the libwebp rgb import, r = g = b
+      for(int y = 0; y < pic.height; y++)
+        for(int x = 0; x < pic.width; x++)
+        {
+          const int L = in[(size_t)4 * (y * pic.width + x)];
+          pic.y[(size_t)y * pic.y_stride + x] = (56318 * L + (1 << 15) + (16 << 16)) >> 16;
+        }
+
+      const int uv_height = (pic.height + 1) >> 1;
+      for(int y = 0; y < uv_height; y++)
+      {
+        memset(pic.u + (size_t)y * pic.uv_stride, 128, (pic.width + 1) >> 1);
+        memset(pic.v + (size_t)y * pic.uv_stride, 128, (pic.width + 1) >> 1);
+      }
+    }
+  }
+  else
+    WebPPictureImportRGBX(&pic, (const uint8_t *)in_tmp, webp_data->global.width * 4);
 
-  if(!config.lossless)
+  if(!config.lossless && !(pipe && pipe->colors == 1))
   {
     // webp is more efficient at coding YUV images, as we go lossy
     // let the encoder where best to spend its bits instead of forcing it
@@ -315,7 +354,7 @@ void gui_reset(dt_imageio_module_format_t *self)
 int flags(dt_imageio_module_data_t *data)
 {
   // TODO(jinxos): support embedded XMP/ICC
-  return 0;
+  return FORMAT_FLAGS_SUPPORT_GRAY;
 }
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
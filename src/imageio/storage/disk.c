@@ -284,6 +284,15 @@ try_again:
                        num, total, filename);
         return 0;
       }
+
+    // written in the background: claim the name now, the next image must not pick it or miss it when skipping.
+    // the encoder keeps two overwrites of the same name apart
+    if(!fail && d->onsave_action != DT_EXPORT_ONCONFLICT_OVERWRITE
+       && dt_imageio_export_in_background(format, fdata))
+    {
+      FILE *f = g_fopen(filename, "wb");
+      if(f) fclose(f);
+    }
   } // end of critical block
 
   dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
@@ -291,6 +300,9 @@ try_again:
   if(fail)
     return 1;
 
+  // the encoder logs it once the file is written
+  const gboolean background = dt_imageio_export_in_background(format, fdata);
+
   // export image to file
   if(dt_imageio_export(imgid, filename, format, fdata, high_quality, upscale, TRUE, icc_type,
                        icc_filename, icc_intent, self, sdata, num, total, metadata))
@@ -300,8 +312,9 @@ try_again:
     return 1;
   }
 
-  dt_control_log(ngettext("%d/%d exported to `%s'", "%d/%d exported to `%s'", num),
-                 num, total, filename);
+  if(!background)
+    dt_control_log(ngettext("%d/%d exported to `%s'", "%d/%d exported to `%s'", num),
+                   num, total, filename);
   return 0;
 }
 
@@ -314,6 +327,11 @@ void init(dt_imageio_module_storage_t *self)
 {
 }
 
+int flags(dt_imageio_module_storage_t *self)
+{
+  return STORAGE_FLAGS_ASYNC_WRITE;
+}
+
 void *get_params(dt_imageio_module_storage_t *self)
 {
   dt_imageio_disk_t *d = (dt_imageio_disk_t *)calloc(1, sizeof(dt_imageio_disk_t));
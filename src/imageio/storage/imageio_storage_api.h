@@ -85,6 +85,8 @@ REQUIRED(int, set_params, struct dt_imageio_module_storage_t *self, const void *
 OPTIONAL(void, export_dispatched, struct dt_imageio_module_storage_t *self);
 
 OPTIONAL(char *, ask_user_confirmation, struct dt_imageio_module_storage_t *self);
+/* storage flags, see dt_imageio_storage_flags_t */
+OPTIONAL(int, flags, struct dt_imageio_module_storage_t *self);
 
 #ifdef FULL_API_H
 
@@ -21,6 +21,7 @@
 #include "bauhaus/bauhaus.h"
 #include "common/iop_profile.h"
 #include "common/colorspaces.h"
+#include "common/colorspaces_lut3d.h"
 #include "common/colorspaces_inline_conversions.h"
 #include "common/file_location.h"
 #include "common/image_cache.h"
@@ -101,6 +102,7 @@ typedef struct dt_iop_colorin_data_t
   cmsHTRANSFORM *xform_cam_Lab;
   cmsHTRANSFORM *xform_cam_nrgb;
   cmsHTRANSFORM *xform_nrgb_Lab;
+  dt_colorspaces_lut3d_t *lut3d; // baked xform_cam_Lab or xform_cam_nrgb + xform_nrgb_Lab
   float lut[3][LUT_SAMPLES];
   float cmatrix[9];
   float nmatrix[9];
@@ -542,7 +544,9 @@ static void process_lcms2_bm(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_
     for(int j = 0; j < roi_out->width; j++, in += 4, camptr += 4)
       apply_blue_mapping(in, camptr);
     // convert to (L,a/L,b/L) to be able to change L without changing saturation.
-    if(!d->nrgb)
+    if(d->lut3d && dt_colorspaces_lut3d_apply(d->lut3d, out, out, roi_out->width))
+      continue;
+    else if(!d->nrgb)
       cmsDoTransform(d->xform_cam_Lab, out, out, roi_out->width);
     else
     {
@@ -574,7 +578,9 @@ static void process_lcms2_proper(struct dt_iop_module_t *self, dt_dev_pixelpipe_
     const float *in = (const float *)ivoid + (size_t)4 * k * roi_out->width;
     float *out = (float *)ovoid + (size_t)4 * k * roi_out->width;
     // convert to (L,a/L,b/L) to be able to change L without changing saturation.
-    if(!d->nrgb)
+    if(d->lut3d && dt_colorspaces_lut3d_apply(d->lut3d, in, out, roi_out->width))
+      continue;
+    else if(!d->nrgb)
       cmsDoTransform(d->xform_cam_Lab, in, out, roi_out->width);
     else
     {
@@ -671,6 +677,8 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
     cmsDeleteTransform(d->xform_nrgb_Lab);
     d->xform_nrgb_Lab = NULL;
   }
+  dt_colorspaces_lut3d_release(d->lut3d);
+  d->lut3d = NULL;
 
   d->cmatrix[0] = d->nmatrix[0] = d->lmatrix[0] = NAN;
   d->lut[0][0] = -1.0f;
@@ -855,9 +863,24 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
     {
       d->cmatrix[0] = NAN;
       d->xform_cam_Lab = cmsCreateTransform(d->input, TYPE_RGBA_FLT, Lab, TYPE_LabA_FLT, p->intent, 0);
+      input_format = TYPE_RGBA_FLT;
     }
   }
 
+  // bake the lcms2 fallback into a 3d lut, rows leaving its domain still go through lcms2
+  if(isnan(d->cmatrix[0]) && d->xform_cam_Lab)
+  {
+    const int size = (pipe->type & DT_DEV_PIXELPIPE_EXPORT) == DT_DEV_PIXELPIPE_EXPORT
+                         ? DT_COLORSPACES_LUT3D_SIZE_HQ : DT_COLORSPACES_LUT3D_SIZE;
+    uint64_t key = dt_colorspaces_lut3d_hash_profile(5381, d->input);
+    key = dt_colorspaces_lut3d_hash_profile(key, d->nrgb);
+    key = dt_colorspaces_lut3d_hash_int(key, p->intent);
+    if(d->nrgb)
+      d->lut3d = dt_colorspaces_lut3d_get(key, size, input_format, d->xform_cam_nrgb, d->xform_nrgb_Lab);
+    else
+      d->lut3d = dt_colorspaces_lut3d_get(key, size, input_format, d->xform_cam_Lab, NULL);
+  }
+
   d->nonlinearlut = 0;
   // now try to initialize unbounded mode:
   // we do a extrapolation for input values above 1.0f.
@@ -889,6 +912,7 @@ void init_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pi
   d->xform_cam_Lab = NULL;
   d->xform_cam_nrgb = NULL;
   d->xform_nrgb_Lab = NULL;
+  d->lut3d = NULL;
   self->commit_params(self, self->default_params, pipe, piece);
 }
 
@@ -911,6 +935,8 @@ void cleanup_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev
     cmsDeleteTransform(d->xform_nrgb_Lab);
     d->xform_nrgb_Lab = NULL;
   }
+  dt_colorspaces_lut3d_release(d->lut3d);
+  d->lut3d = NULL;
 
   free(piece->data);
   piece->data = NULL;
@@ -20,6 +20,7 @@
 #endif
 #include "bauhaus/bauhaus.h"
 #include "common/colorspaces.h"
+#include "common/colorspaces_lut3d.h"
 #include "common/colorspaces_inline_conversions.h"
 #include "common/file_location.h"
 #include "control/conf.h"
@@ -49,6 +50,7 @@ typedef struct dt_iop_colorout_data_t
   float lut[3][LUT_SAMPLES];
   float cmatrix[9];
   cmsHTRANSFORM *xform;
+  dt_colorspaces_lut3d_t *lut3d; // xform baked, NULL when gamut checking or lcms2 is forced
   float unbounded_coeffs[3][3]; // for extrapolation of shaper curves
 } dt_iop_colorout_data_t;
 
@@ -251,7 +253,8 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     {
       const float *in = ((float *)ivoid) + (size_t)4 * k * width;
       float *out = ((float *)ovoid) + (size_t)4 * k * width;
-      cmsDoTransform(d->xform, in, out, width);
+      if(!d->lut3d || !dt_colorspaces_lut3d_apply(d->lut3d, in, out, width))
+        cmsDoTransform(d->xform, in, out, width);
       for(int j = 0; j < width; j++, out += 4, in += 4)
       {
         out[3] = in[3];
@@ -333,6 +336,8 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
     cmsDeleteTransform(d->xform);
     d->xform = NULL;
   }
+  dt_colorspaces_lut3d_release(d->lut3d);
+  d->lut3d = NULL;
   d->cmatrix[0] = NAN;
   d->lut[0][0] = -1.0f;
   d->lut[1][0] = -1.0f;
@@ -471,6 +476,20 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
     }
   }
 
+  // bake the transform into a 3d lut. gamut check alarms must stay exact per pixel,
+  // and forcing lcms2 asks for the exact transform too
+  if(d->xform && d->mode != DT_PROFILE_GAMUTCHECK && !force_lcms2)
+  {
+    const int size = (pipe->type & DT_DEV_PIXELPIPE_EXPORT) == DT_DEV_PIXELPIPE_EXPORT
+                         ? DT_COLORSPACES_LUT3D_SIZE_HQ : DT_COLORSPACES_LUT3D_SIZE;
+    uint64_t key = dt_colorspaces_lut3d_hash_profile(5381, output);
+    key = dt_colorspaces_lut3d_hash_profile(key, softproof);
+    key = dt_colorspaces_lut3d_hash_int(key, out_intent);
+    key = dt_colorspaces_lut3d_hash_int(key, output_format);
+    key = dt_colorspaces_lut3d_hash_int(key, transformFlags);
+    d->lut3d = dt_colorspaces_lut3d_get(key, size, TYPE_LabA_FLT, d->xform, NULL);
+  }
+
   if(out_type == DT_COLORSPACE_DISPLAY || out_type == DT_COLORSPACE_DISPLAY2)
     pthread_rwlock_unlock(&darktable.color_profiles->xprofile_lock);
 
@@ -501,6 +520,7 @@ void init_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pi
   piece->data = calloc(1, sizeof(dt_iop_colorout_data_t));
   dt_iop_colorout_data_t *d = (dt_iop_colorout_data_t *)piece->data;
   d->xform = NULL;
+  d->lut3d = NULL;
   self->commit_params(self, self->default_params, pipe, piece);
 }
 
@@ -512,6 +532,8 @@ void cleanup_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev
     cmsDeleteTransform(d->xform);
     d->xform = NULL;
   }
+  dt_colorspaces_lut3d_release(d->lut3d);
+  d->lut3d = NULL;
 
   free(piece->data);
   piece->data = NULL;
@@ -19,6 +19,7 @@
 #include "bauhaus/bauhaus.h"
 #include "common/colorspaces.h"
 #include "common/darktable.h"
+#include "common/cpuid.h"
 #include "common/interpolation.h"
 #include "common/image_cache.h"
 #include "control/conf.h"
@@ -2886,7 +2887,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
           dt_colorspaces_cygm_to_rgb(piece->pipe->dsc.processed_maximum, 1, data->CAM_to_RGB);
         }
       }
-      else if(demosaicing_method != (DT_IOP_DEMOSAIC_AMAZE || DT_IOP_DEMOSAIC_RCD))
+      else if(demosaicing_method != DT_IOP_DEMOSAIC_AMAZE && demosaicing_method != DT_IOP_DEMOSAIC_RCD)
         demosaic_ppg(tmp, in, &roo, &roi, piece->pipe->dsc.filters, data->median_thrs);
       else if(demosaicing_method == DT_IOP_DEMOSAIC_RCD)
         rcd_demosaic(piece, tmp, in, &roo, &roi, piece->pipe->dsc.filters);
@@ -2920,9 +2921,6 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     color_smoothing(o, roi_out, data->color_smoothing);
 }
 
-#ifndef RCD_TILESIZE
-  #define RCD_TILESIZE 112
-#endif
 void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
                      const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out,
                      struct dt_develop_tiling_t *tiling)
@@ -3001,7 +2999,8 @@ void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t
     else
       tiling->factor += smooth;                        // + smooth
     tiling->maxbuf = 1.0f;
-    tiling->overhead = sizeof(float) * RCD_TILESIZE * RCD_TILESIZE * 8 * MAX(1, darktable.num_openmp_threads);
+    const size_t tilesize = rcd_tilesize();
+    tiling->overhead = sizeof(float) * tilesize * tilesize * 8 * MAX(1, darktable.num_openmp_threads);
     tiling->xalign = 2;
     tiling->yalign = 2;
     tiling->overlap = 10;
@@ -3026,7 +3025,6 @@ void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t
   }
   return;
 }
-#undef RCD_TILESIZE
 
 void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *params, dt_dev_pixelpipe_t *pipe,
                    dt_dev_pixelpipe_iop_t *piece)
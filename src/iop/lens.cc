@@ -459,9 +459,17 @@ int distort_transform(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, floa
 
   if(modflags & (LF_MODIFY_TCA | LF_MODIFY_DISTORTION | LF_MODIFY_GEOMETRY | LF_MODIFY_SCALE))
   {
-    float *buf = (float *)malloc(2 * 3 * sizeof(float));
+    // points are independent and the modifier is only read, so long mask strokes can be spread
+    // over all threads.
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+    dt_omp_firstprivate(points, points_count) \
+    shared(modifier) \
+    schedule(static) if(points_count > 100)
+#endif
     for(size_t i = 0; i < points_count * 2; i += 2)
     {
+      float buf[6];
       float p1 = points[i];
       float p2 = points[i + 1];
       // just loop 10 times max to find the best position. checking that the convergence is
@@ -479,7 +487,6 @@ int distort_transform(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, floa
       points[i]     = p1;
       points[i + 1] = p2;
     }
-    free(buf);
   }
 
   delete modifier;
@@ -499,14 +506,19 @@ int distort_backtransform(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
 
   if(modflags & (LF_MODIFY_TCA | LF_MODIFY_DISTORTION | LF_MODIFY_GEOMETRY | LF_MODIFY_SCALE))
   {
-    float *buf = (float *)malloc(2 * 3 * sizeof(float));
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+    dt_omp_firstprivate(points, points_count) \
+    shared(modifier) \
+    schedule(static) if(points_count > 100)
+#endif
     for(size_t i = 0; i < points_count * 2; i += 2)
     {
+      float buf[6];
       modifier->ApplySubpixelGeometryDistortion(points[i], points[i + 1], 1, 1, buf);
       points[i] = buf[0];
       points[i + 1] = buf[3];
     }
-    free(buf);
   }
 
   delete modifier;
@@ -40,14 +40,11 @@
 /* Some notes about the algorithm
 * 1. The calculated data at the tiling borders RCD_BORDER must be at least 9 to be stable. Why does 8 **not** work?
 * 2. For the outermost tiles we only have to discard a 6 pixel border region interpolated otherwise.
-* 3. The tilesize has a significant influence on performance, the default is a good guess for modern
-*    x86/64 machines, tested on Xeon E-2288G, i5-8250U.
+* 3. The tilesize has a significant influence on performance. 112 was found best on Xeon E-2288G, i5-8250U
+*    both having 256KiB L2 cache per core, rcd_tilesize() scales that to the detected L2 size.
+*    Defining RCD_TILESIZE at compile time overrides the detection.
 */
 
-#ifndef RCD_TILESIZE
-  #define RCD_TILESIZE 112
-#endif
-
 /* We don't want to use the -Ofast option in dt as it effects are not well specified and there have been issues
    leading to crashes.
    But we can use the 'fast-math' option in code sections if input data and algorithms are well defined.
@@ -77,11 +74,8 @@
 
 #define RCD_BORDER 9          // avoid tile-overlap errors
 #define RCD_MARGIN 6          // for the outermost tiles we can have a smaller outer border
-#define RCD_TILEVALID (RCD_TILESIZE - 2 * RCD_BORDER)
-#define w1 RCD_TILESIZE
-#define w2 (2 * RCD_TILESIZE)
-#define w3 (3 * RCD_TILESIZE)
-#define w4 (4 * RCD_TILESIZE)
+#define RCD_TILESIZE_MIN 64
+#define RCD_TILESIZE_MAX 448
 
 #define eps 1e-5f              // Tolerance to avoid dividing by zero
 #define epssq 1e-10f
@@ -103,19 +97,36 @@ static INLINE float sqrf(float a)
   return a * a;
 }
 
+/* A tile works on about 6.5 floats per pixel (cfa, VH_Dir, rgb and the half sized PQ_Dir and P/Q
+   high pass buffers). Tiles slightly exceeding L2 were measured fastest as only a few rows are hot at
+   any time, rows are kept a multiple of 16 floats for aligned vector access. */
+static int rcd_tilesize()
+{
+#ifdef RCD_TILESIZE
+  return RCD_TILESIZE;
+#else
+  const int ts = (int)sqrtf((float)dt_get_cpu_l2_cache_size() / 20.0f) & ~15;
+  return CLAMP(ts, RCD_TILESIZE_MIN, RCD_TILESIZE_MAX);
+#endif
+}
+
 /** This is basically ppg adopted to only write data to RCD_MARGIN */
 static void rcd_ppg_border(float *const out, const float *const in, const int width, const int height, const uint32_t filters, const int margin)
 {
   const int border = margin + 3;
   // write approximatad 3-pixel border region to out
-  float sum[8];
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(filters, out, in, width, height) \
+  schedule(static)
+#endif
   for(int j = 0; j < height; j++)
   {
     for(int i = 0; i < width; i++)
     {
       if(i == 3 && j >= 3 && j < height - 3) i = width - 3;
       if(i == width) break;
-      memset(sum, 0, sizeof(float) * 8);
+      float sum[8] = { 0.0f };
       for(int y = j - 1; y != j + 2; y++)
       {
         for(int x = i - 1; x != i + 2; x++)
@@ -307,28 +318,43 @@ static void rcd_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict ou
     return;
   }
 
+  dt_times_t start_time = { 0 };
+  if(darktable.unmuted & DT_DEBUG_PERF) dt_get_times(&start_time);
+
   rcd_ppg_border(out, in, width, height, filters, RCD_MARGIN);
 
+  const int ts = rcd_tilesize();
+  const int tilevalid = ts - 2 * RCD_BORDER;
+
   const float scaler = fmaxf(piece->pipe->dsc.processed_maximum[0], fmaxf(piece->pipe->dsc.processed_maximum[1],
                              piece->pipe->dsc.processed_maximum[2]));
   const float revscaler = 1.0f / scaler;
-  const int num_vertical = 1 + (height - 2 * RCD_BORDER -1) / RCD_TILEVALID;
-  const int num_horizontal = 1 + (width - 2 * RCD_BORDER -1) / RCD_TILEVALID;
+  const int num_vertical = 1 + (height - 2 * RCD_BORDER -1) / tilevalid;
+  const int num_horizontal = 1 + (width - 2 * RCD_BORDER -1) / tilevalid;
 
 #ifdef _OPENMP
   #pragma omp parallel \
-  dt_omp_firstprivate(width, height, filters, out, in, scaler, revscaler)
+  dt_omp_firstprivate(width, height, filters, out, in, scaler, revscaler, ts, tilevalid, num_vertical, num_horizontal)
 #endif
   {
-    float *const VH_Dir = dt_alloc_align_float((size_t) RCD_TILESIZE * RCD_TILESIZE);
+    const int w1 = ts;
+    const int w2 = 2 * ts;
+    const int w3 = 3 * ts;
+    const int w4 = 4 * ts;
+    const size_t tilesq = (size_t)ts * ts;
+
+    float *const VH_Dir = dt_alloc_align_float(tilesq);
     // ensure that border elements which are read but never actually set below are zeroed out
-    memset(VH_Dir, 0, sizeof(*VH_Dir) * RCD_TILESIZE * RCD_TILESIZE);
-    float *const PQ_Dir = dt_alloc_align_float((size_t) RCD_TILESIZE * RCD_TILESIZE / 2);
-    float *const cfa =    dt_alloc_align_float((size_t) RCD_TILESIZE * RCD_TILESIZE);
-    float *const P_CDiff_Hpf = dt_alloc_align_float((size_t) RCD_TILESIZE * RCD_TILESIZE / 2);
-    float *const Q_CDiff_Hpf = dt_alloc_align_float((size_t) RCD_TILESIZE * RCD_TILESIZE / 2);
+    memset(VH_Dir, 0, sizeof(*VH_Dir) * tilesq);
+    float *const PQ_Dir = dt_alloc_align_float(tilesq / 2);
+    float *const cfa =    dt_alloc_align_float(tilesq);
+    float *const P_CDiff_Hpf = dt_alloc_align_float(tilesq / 2);
+    float *const Q_CDiff_Hpf = dt_alloc_align_float(tilesq / 2);
+    // three rolling rows of the vertical high pass and one horizontal row
+    float *const bufferV = dt_alloc_align_float((size_t)3 * ts);
+    float *const bufferH = dt_alloc_align_float(ts);
 
-    float (*const rgb)[RCD_TILESIZE * RCD_TILESIZE] = (void *)dt_alloc_align_float((size_t)3 * RCD_TILESIZE * RCD_TILESIZE);
+    float (*const rgb)[tilesq] = (void *)dt_alloc_align_float(3 * tilesq);
 
     // No overlapping use so re-use same buffer
     float *const lpf = PQ_Dir;
@@ -342,61 +368,86 @@ static void rcd_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict ou
     {
       for(int tile_horizontal = 0; tile_horizontal < num_horizontal; tile_horizontal++)
       {
-        const int rowStart = tile_vertical * RCD_TILEVALID;
-        const int rowEnd = MIN(rowStart + RCD_TILESIZE, height);
+        const int rowStart = tile_vertical * tilevalid;
+        const int rowEnd = MIN(rowStart + ts, height);
 
-        const int colStart = tile_horizontal * RCD_TILEVALID;
-        const int colEnd = MIN(colStart + RCD_TILESIZE, width);
+        const int colStart = tile_horizontal * tilevalid;
+        const int colEnd = MIN(colStart + ts, width);
 
-        const int tileRows = MIN(rowEnd - rowStart, RCD_TILESIZE);
-        const int tileCols = MIN(colEnd - colStart, RCD_TILESIZE);
+        const int tileRows = MIN(rowEnd - rowStart, ts);
+        const int tileCols = MIN(colEnd - colStart, ts);
 
-        if (rowStart + RCD_TILESIZE > height || colStart + RCD_TILESIZE > width)
+        if (rowStart + ts > height || colStart + ts > width)
         {
           // VH_Dir is only filled for (4,4)..(height-4,width-4), but the refinement code reads (3,3)...(h-3,w-3),
           // so we need to ensure that the border is zeroed for partial tiles to get consistent results
-          memset(VH_Dir, 0, sizeof(*VH_Dir) * RCD_TILESIZE * RCD_TILESIZE);
+          memset(VH_Dir, 0, sizeof(*VH_Dir) * tilesq);
           // TODO: figure out what part of rgb is being accessed without initialization on partial tiles
-          memset(rgb, 0, sizeof(float) * 3 * RCD_TILESIZE * RCD_TILESIZE);
+          memset(rgb, 0, sizeof(float) * 3 * tilesq);
         }
         // Step 0: fill data and make sure data are not negative.
         for(int row = rowStart; row < rowEnd; row++)
         {
           const int c0 = FC(row, colStart, filters);
           const int c1 = FC(row, colStart + 1, filters);
-          for(int col = colStart, indx = (row - rowStart) * RCD_TILESIZE, 
-                                          in_indx = row * width + colStart; col < colEnd; col++, indx++, in_indx++)
-            cfa[indx] = rgb[c0][indx] = rgb[c1][indx] = safe_in(in[in_indx], revscaler);
+#ifdef _OPENMP
+          #pragma omp simd
+#endif
+          for(int col = colStart; col < colEnd; col++)
+          {
+            const int indx = (row - rowStart) * ts + col - colStart;
+            cfa[indx] = rgb[c0][indx] = rgb[c1][indx] = safe_in(in[(size_t)row * width + col], revscaler);
+          }
         }
 
         // STEP 1: Find vertical and horizontal interpolation directions
-        float bufferV[3][RCD_TILESIZE - 8];
         // Step 1.1: Calculate the square of the vertical and horizontal color difference high pass filter
         for(int row = 3; row < MIN(tileRows - 3, 5); row++ )
-          for(int col = 4, indx = row * RCD_TILESIZE + col; col < tileCols - 4; col++, indx++ )
-            bufferV[row - 3][col - 4] = sqrf((cfa[indx - w3] - cfa[indx - w1] - cfa[indx + w1] 
+#ifdef _OPENMP
+          #pragma omp simd
+#endif
+          for(int col = 4; col < tileCols - 4; col++)
+          {
+            const int indx = row * ts + col;
+            bufferV[(row - 3) * ts + col - 4] = sqrf((cfa[indx - w3] - cfa[indx - w1] - cfa[indx + w1] 
                                         + cfa[indx + w3]) - 3.0f * (cfa[indx - w2] + cfa[indx + w2]) + 6.0f * cfa[indx]);
+          }
 
         // Step 1.2: Obtain the vertical and horizontal directional discrimination strength
-        float DT_ALIGNED_PIXEL bufferH[RCD_TILESIZE];
         // We start with V0, V1 and V2 pointing to row -1, row and row +1
         // After row is processed V0 must point to the old V1, V1 must point to the old V2 and V2 must point to the old V0
         // because the old V0 is not used anymore and will be filled with row + 1 data in next iteration
-        float* V0 = bufferV[0];
-        float* V1 = bufferV[1];
-        float* V2 = bufferV[2];
+        float* V0 = bufferV;
+        float* V1 = bufferV + ts;
+        float* V2 = bufferV + 2 * ts;
         for(int row = 4; row < tileRows - 4; row++ )
         {
-          for(int col = 3, indx = row * RCD_TILESIZE + col; col < tileCols - 3; col++, indx++)
+#ifdef _OPENMP
+          #pragma omp simd
+#endif
+          for(int col = 3; col < tileCols - 3; col++)
+          {
+            const int indx = row * ts + col;
             bufferH[col - 3] = sqrf((cfa[indx -  3] - cfa[indx -  1] - cfa[indx +  1] + cfa[indx +  3]) 
                                - 3.0f * (cfa[indx -  2] + cfa[indx +  2]) + 6.0f * cfa[indx]);
+          }
 
-          for(int col = 4, indx = (row + 1) * RCD_TILESIZE + col; col < tileCols - 4; col++, indx++)
+#ifdef _OPENMP
+          #pragma omp simd
+#endif
+          for(int col = 4; col < tileCols - 4; col++)
+          {
+            const int indx = (row + 1) * ts + col;
             V2[col - 4] = sqrf((cfa[indx - w3] - cfa[indx - w1] - cfa[indx + w1] + cfa[indx + w3]) 
                           - 3.0f * (cfa[indx - w2] + cfa[indx + w2]) + 6.0f * cfa[indx]);
+          }
 
-          for(int col = 4, indx = row * RCD_TILESIZE + col; col < tileCols - 4; col++, indx++ )
+#ifdef _OPENMP
+          #pragma omp simd
+#endif
+          for(int col = 4; col < tileCols - 4; col++)
           {
+            const int indx = row * ts + col;
             const float V_Stat = fmaxf(epssq,      V0[col - 4] +      V1[col - 4] +      V2[col - 4]);
             const float H_Stat = fmaxf(epssq, bufferH[col - 4] + bufferH[col - 3] + bufferH[col - 2]);
             VH_Dir[indx] = V_Stat / ( V_Stat + H_Stat );
@@ -408,29 +459,38 @@ static void rcd_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict ou
         // STEP 2: Calculate the low pass filter
         // Step 2.1: Low pass filter incorporating green, red and blue local samples from the raw data
         for(int row = 2; row < tileRows - 2; row++)
-          for(int col = 2 + (FC(row, 0, filters) & 1), indx = row * RCD_TILESIZE + col, lp_indx = indx / 2;
-                             col < tileCols - 2; col += 2, indx +=2, lp_indx++)
-            lpf[lp_indx] = cfa[indx]
+#ifdef _OPENMP
+          #pragma omp simd
+#endif
+          for(int col = 2 + (FC(row, 0, filters) & 1); col < tileCols - 2; col += 2)
+          {
+            const int indx = row * ts + col;
+            lpf[indx / 2] = cfa[indx]
                         + 0.5f * (cfa[indx - w1]     + cfa[indx + w1] +     cfa[indx - 1] +      cfa[indx + 1])
                        + 0.25f * (cfa[indx - w1 - 1] + cfa[indx - w1 + 1] + cfa[indx + w1 - 1] + cfa[indx + w1 + 1]);
+          }
 
         // STEP 3: Populate the green channel
         // Step 3.1: Populate the green channel at blue and red CFA positions
         for(int row = 4; row < tileRows - 4; row++)
-          for(int col = 4 + (FC(row, 0, filters) & 1), indx = row * RCD_TILESIZE + col, lpindx = indx / 2; 
-              col < tileCols - 4; col += 2, indx += 2, lpindx++)
+#ifdef _OPENMP
+          #pragma omp simd
+#endif
+          for(int col = 4 + (FC(row, 0, filters) & 1); col < tileCols - 4; col += 2)
           {
+            const int indx = row * ts + col;
+            const int lpindx = indx / 2;
             const float cfai = cfa[indx];
 
             // Cardinal gradients
-            const float N_Grad = eps + fabs(cfa[indx - w1] - cfa[indx + w1]) + fabs(cfai - cfa[indx - w2])
-                                 + fabs(cfa[indx - w1] - cfa[indx - w3]) + fabs(cfa[indx - w2] - cfa[indx - w4]);
-            const float S_Grad = eps + fabs(cfa[indx - w1] - cfa[indx + w1]) + fabs(cfai - cfa[indx + w2])
-                                 + fabs(cfa[indx + w1] - cfa[indx + w3]) + fabs(cfa[indx + w2] - cfa[indx + w4]);
-            const float W_Grad = eps + fabs(cfa[indx -  1] - cfa[indx +  1]) + fabs(cfai - cfa[indx -  2])
-                                 + fabs(cfa[indx -  1] - cfa[indx -  3]) + fabs(cfa[indx -  2] - cfa[indx -  4]);
-            const float E_Grad = eps + fabs(cfa[indx -  1] - cfa[indx +  1]) + fabs(cfai - cfa[indx +  2])
-                                 + fabs(cfa[indx +  1] - cfa[indx +  3]) + fabs(cfa[indx +  2] - cfa[indx +  4]);
+            const float N_Grad = eps + fabsf(cfa[indx - w1] - cfa[indx + w1]) + fabsf(cfai - cfa[indx - w2])
+                                 + fabsf(cfa[indx - w1] - cfa[indx - w3]) + fabsf(cfa[indx - w2] - cfa[indx - w4]);
+            const float S_Grad = eps + fabsf(cfa[indx - w1] - cfa[indx + w1]) + fabsf(cfai - cfa[indx + w2])
+                                 + fabsf(cfa[indx + w1] - cfa[indx + w3]) + fabsf(cfa[indx + w2] - cfa[indx + w4]);
+            const float W_Grad = eps + fabsf(cfa[indx -  1] - cfa[indx +  1]) + fabsf(cfai - cfa[indx -  2])
+                                 + fabsf(cfa[indx -  1] - cfa[indx -  3]) + fabsf(cfa[indx -  2] - cfa[indx -  4]);
+            const float E_Grad = eps + fabsf(cfa[indx -  1] - cfa[indx +  1]) + fabsf(cfai - cfa[indx +  2])
+                                 + fabsf(cfa[indx +  1] - cfa[indx +  3]) + fabsf(cfa[indx +  2] - cfa[indx +  4]);
 
             // Cardinal pixel estimations
             const float lpfi = lpf[lpindx];
@@ -448,7 +508,7 @@ static void rcd_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict ou
             const float VH_Central_Value = VH_Dir[indx];
             const float VH_Neighbourhood_Value = 0.25f * (VH_Dir[indx - w1 - 1] + VH_Dir[indx - w1 + 1]
                                                        + VH_Dir[indx + w1 - 1] + VH_Dir[indx + w1 + 1]);
-            const float VH_Disc = (fabs(0.5f - VH_Central_Value) < fabs(0.5f - VH_Neighbourhood_Value)) 
+            const float VH_Disc = (fabsf(0.5f - VH_Central_Value) < fabsf(0.5f - VH_Neighbourhood_Value)) 
                                         ? VH_Neighbourhood_Value : VH_Central_Value;
 
             rgb[1][indx] = intp(VH_Disc, H_Est, V_Est);
@@ -458,8 +518,13 @@ static void rcd_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict ou
 
         // Step 4.0: Calculate the square of the P/Q diagonals color difference high pass filter
         for(int row = 3; row < tileRows - 3; row++)
-          for(int col = 3, indx = row * RCD_TILESIZE + col, indx2 = indx / 2; col < tileCols - 3; col+=2, indx+=2, indx2++)
+#ifdef _OPENMP
+          #pragma omp simd
+#endif
+          for(int col = 3; col < tileCols - 3; col += 2)
           {
+            const int indx = row * ts + col;
+            const int indx2 = indx / 2;
             P_CDiff_Hpf[indx2] = sqrf((cfa[indx - w3 - 3] - cfa[indx - w1 - 1] - cfa[indx + w1 + 1] + cfa[indx + w3 + 3])
                                  - 3.0f * (cfa[indx - w2 - 2] + cfa[indx + w2 + 2]) + 6.0f * cfa[indx]);
             Q_CDiff_Hpf[indx2] = sqrf((cfa[indx - w3 + 3] - cfa[indx - w1 + 1] - cfa[indx + w1 - 1] + cfa[indx + w3 - 3])
@@ -468,10 +533,15 @@ static void rcd_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict ou
 
         // Step 4.1: Obtain the P/Q diagonals directional discrimination strength
         for(int row = 4; row < tileRows - 4; row++)
-          for(int col = 4 + (FC(row, 0, filters) & 1), indx = row * RCD_TILESIZE + col, indx2 = indx / 2, 
-                        indx3 = (indx - w1 - 1) / 2, indx4 = (indx + w1 - 1) / 2; col < tileCols - 4;
-                         col += 2, indx += 2, indx2++, indx3++, indx4++ )
+#ifdef _OPENMP
+          #pragma omp simd
+#endif
+          for(int col = 4 + (FC(row, 0, filters) & 1); col < tileCols - 4; col += 2)
           {
+            const int indx = row * ts + col;
+            const int indx2 = indx / 2;
+            const int indx3 = (indx - w1 - 1) / 2;
+            const int indx4 = (indx + w1 - 1) / 2;
             const float P_Stat = fmaxf(epssq, P_CDiff_Hpf[indx3]     + P_CDiff_Hpf[indx2] + P_CDiff_Hpf[indx4 + 1]);
             const float Q_Stat = fmaxf(epssq, Q_CDiff_Hpf[indx3 + 1] + Q_CDiff_Hpf[indx2] + Q_CDiff_Hpf[indx4]);
             PQ_Dir[indx2] = P_Stat / (P_Stat + Q_Stat);
@@ -479,25 +549,33 @@ static void rcd_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict ou
 
         // Step 4.2: Populate the red and blue channels at blue and red CFA positions
         for(int row = 4; row < tileRows - 4; row++)
-          for(int col = 4 + (FC(row, 0, filters) & 1), indx = row * RCD_TILESIZE + col, c = 2 - FC(row, col, filters), 
-                             pqindx = indx / 2, pqindx2 = (indx - w1 - 1) / 2, pqindx3 = (indx + w1 - 1) / 2;
-                             col < tileCols - 4; col += 2, indx += 2, pqindx++, pqindx2++, pqindx3++)
+        {
+          const int col0 = 4 + (FC(row, 0, filters) & 1);
+          const int c = 2 - FC(row, col0, filters);
+#ifdef _OPENMP
+          #pragma omp simd
+#endif
+          for(int col = col0; col < tileCols - 4; col += 2)
           {
+            const int indx = row * ts + col;
+            const int pqindx = indx / 2;
+            const int pqindx2 = (indx - w1 - 1) / 2;
+            const int pqindx3 = (indx + w1 - 1) / 2;
             // Refined P/Q diagonal local discrimination
             const float PQ_Central_Value   = PQ_Dir[pqindx];
             const float PQ_Neighbourhood_Value = 0.25f * (PQ_Dir[pqindx2] + PQ_Dir[pqindx2 + 1] + PQ_Dir[pqindx3] + PQ_Dir[pqindx3 + 1]);
 
-            const float PQ_Disc = (fabs(0.5f - PQ_Central_Value) < fabs(0.5f - PQ_Neighbourhood_Value)) ? PQ_Neighbourhood_Value : PQ_Central_Value;
+            const float PQ_Disc = (fabsf(0.5f - PQ_Central_Value) < fabsf(0.5f - PQ_Neighbourhood_Value)) ? PQ_Neighbourhood_Value : PQ_Central_Value;
 
             // Diagonal gradients
-            const float NW_Grad = eps + fabs(rgb[c][indx - w1 - 1] - rgb[c][indx + w1 + 1]) + fabs(rgb[c][indx - w1 - 1]
-                                  - rgb[c][indx - w3 - 3]) + fabs(rgb[1][indx] - rgb[1][indx - w2 - 2]);
-            const float NE_Grad = eps + fabs(rgb[c][indx - w1 + 1] - rgb[c][indx + w1 - 1]) + fabs(rgb[c][indx - w1 + 1]
-                                  - rgb[c][indx - w3 + 3]) + fabs(rgb[1][indx] - rgb[1][indx - w2 + 2]);
-            const float SW_Grad = eps + fabs(rgb[c][indx - w1 + 1] - rgb[c][indx + w1 - 1]) + fabs(rgb[c][indx + w1 - 1]
-                                  - rgb[c][indx + w3 - 3]) + fabs(rgb[1][indx] - rgb[1][indx + w2 - 2]);
-            const float SE_Grad = eps + fabs(rgb[c][indx - w1 - 1] - rgb[c][indx + w1 + 1]) + fabs(rgb[c][indx + w1 + 1]
-                                  - rgb[c][indx + w3 + 3]) + fabs(rgb[1][indx] - rgb[1][indx + w2 + 2]);
+            const float NW_Grad = eps + fabsf(rgb[c][indx - w1 - 1] - rgb[c][indx + w1 + 1]) + fabsf(rgb[c][indx - w1 - 1]
+                                  - rgb[c][indx - w3 - 3]) + fabsf(rgb[1][indx] - rgb[1][indx - w2 - 2]);
+            const float NE_Grad = eps + fabsf(rgb[c][indx - w1 + 1] - rgb[c][indx + w1 - 1]) + fabsf(rgb[c][indx - w1 + 1]
+                                  - rgb[c][indx - w3 + 3]) + fabsf(rgb[1][indx] - rgb[1][indx - w2 + 2]);
+            const float SW_Grad = eps + fabsf(rgb[c][indx - w1 + 1] - rgb[c][indx + w1 - 1]) + fabsf(rgb[c][indx + w1 - 1]
+                                  - rgb[c][indx + w3 - 3]) + fabsf(rgb[1][indx] - rgb[1][indx + w2 - 2]);
+            const float SE_Grad = eps + fabsf(rgb[c][indx - w1 - 1] - rgb[c][indx + w1 + 1]) + fabsf(rgb[c][indx + w1 + 1]
+                                  - rgb[c][indx + w3 + 3]) + fabsf(rgb[1][indx] - rgb[1][indx + w2 + 2]);
 
             // Diagonal colour differences
             const float NW_Est = rgb[c][indx - w1 - 1] - rgb[1][indx - w1 - 1];
@@ -512,22 +590,27 @@ static void rcd_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict ou
             // R@B and B@R interpolation
             rgb[c][indx] = rgb[1][indx] + intp(PQ_Disc, Q_Est, P_Est);
           }
+        }
 
         // Step 4.3: Populate the red and blue channels at green CFA positions
         for(int row = 4; row < tileRows - 4; row++)
-          for(int col = 4 + (FC(row, 1, filters) & 1), indx = row * RCD_TILESIZE + col; col < tileCols - 4; col += 2, indx +=2)
+#ifdef _OPENMP
+          #pragma omp simd
+#endif
+          for(int col = 4 + (FC(row, 1, filters) & 1); col < tileCols - 4; col += 2)
           {
+            const int indx = row * ts + col;
             // Refined vertical and horizontal local discrimination
             const float VH_Central_Value = VH_Dir[indx];
             const float VH_Neighbourhood_Value = 0.25f * (VH_Dir[indx - w1 - 1] + VH_Dir[indx - w1 + 1]
                                                  + VH_Dir[indx + w1 - 1] + VH_Dir[indx + w1 + 1]);
-            const float VH_Disc = (fabs(0.5f - VH_Central_Value) < fabs(0.5f - VH_Neighbourhood_Value) )
+            const float VH_Disc = (fabsf(0.5f - VH_Central_Value) < fabsf(0.5f - VH_Neighbourhood_Value) )
                                    ? VH_Neighbourhood_Value : VH_Central_Value;
             const float rgb1 = rgb[1][indx];
-            const float N1 = eps + fabs(rgb1 - rgb[1][indx - w2]);
-            const float S1 = eps + fabs(rgb1 - rgb[1][indx + w2]);
-            const float W1 = eps + fabs(rgb1 - rgb[1][indx -  2]);
-            const float E1 = eps + fabs(rgb1 - rgb[1][indx +  2]);
+            const float N1 = eps + fabsf(rgb1 - rgb[1][indx - w2]);
+            const float S1 = eps + fabsf(rgb1 - rgb[1][indx + w2]);
+            const float W1 = eps + fabsf(rgb1 - rgb[1][indx -  2]);
+            const float E1 = eps + fabsf(rgb1 - rgb[1][indx +  2]);
 
             const float rgb1mw1 = rgb[1][indx - w1];
             const float rgb1pw1 = rgb[1][indx + w1];
@@ -536,14 +619,14 @@ static void rcd_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict ou
 
             for(int c = 0; c <= 2; c += 2)
             {
-              const float SNabs = fabs(rgb[c][indx - w1] - rgb[c][indx + w1]);
-              const float EWabs = fabs(rgb[c][indx -  1] - rgb[c][indx +  1]);
+              const float SNabs = fabsf(rgb[c][indx - w1] - rgb[c][indx + w1]);
+              const float EWabs = fabsf(rgb[c][indx -  1] - rgb[c][indx +  1]);
 
               // Cardinal gradients
-              const float N_Grad = N1 + SNabs + fabs(rgb[c][indx - w1] - rgb[c][indx - w3]);
-              const float S_Grad = S1 + SNabs + fabs(rgb[c][indx + w1] - rgb[c][indx + w3]);
-              const float W_Grad = W1 + EWabs + fabs(rgb[c][indx -  1] - rgb[c][indx -  3]);
-              const float E_Grad = E1 + EWabs + fabs(rgb[c][indx +  1] - rgb[c][indx +  3]);
+              const float N_Grad = N1 + SNabs + fabsf(rgb[c][indx - w1] - rgb[c][indx - w3]);
+              const float S_Grad = S1 + SNabs + fabsf(rgb[c][indx + w1] - rgb[c][indx + w3]);
+              const float W_Grad = W1 + EWabs + fabsf(rgb[c][indx -  1] - rgb[c][indx -  3]);
+              const float E_Grad = E1 + EWabs + fabsf(rgb[c][indx +  1] - rgb[c][indx +  3]);
 
               // Cardinal colour differences
               const float N_Est = rgb[c][indx - w1] - rgb1mw1;
@@ -567,9 +650,13 @@ static void rcd_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict ou
         const int last_horizontal =  colEnd   - ((tile_horizontal == num_horizontal - 1) ? RCD_MARGIN : RCD_BORDER);
 
         for(int row = first_vertical; row < last_vertical; row++)
-          for(int col = first_horizontal, idx = (row - rowStart) * RCD_TILESIZE + col - colStart, o_idx = (row * width + col) * 4;
-              col < last_horizontal; col++, o_idx += 4, idx++)
+#ifdef _OPENMP
+          #pragma omp simd
+#endif
+          for(int col = first_horizontal; col < last_horizontal; col++)
           {
+            const int idx = (row - rowStart) * ts + col - colStart;
+            const size_t o_idx = ((size_t)row * width + col) * 4;
             out[o_idx]   = scaler * fmaxf(0.0f, rgb[0][idx]);
             out[o_idx+1] = scaler * fmaxf(0.0f, rgb[1][idx]);
             out[o_idx+2] = scaler * fmaxf(0.0f, rgb[2][idx]);
@@ -584,6 +671,17 @@ static void rcd_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict ou
     dt_free_align(PQ_Dir);
     dt_free_align(P_CDiff_Hpf);
     dt_free_align(Q_CDiff_Hpf);
+    dt_free_align(bufferV);
+    dt_free_align(bufferH);
+  }
+
+  if(darktable.unmuted & DT_DEBUG_PERF)
+  {
+    dt_times_t end_time = { 0 };
+    dt_get_times(&end_time);
+    const double wall = MAX(end_time.clock - start_time.clock, 1e-6);
+    dt_print(DT_DEBUG_PERF, "[rcd_demosaic] %dx%d, tile size %d: %.1f Mpix/s\n", width, height, ts,
+             1e-6 * width * height / wall);
   }
 }
 
@@ -594,11 +692,8 @@ static void rcd_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict ou
 
 #undef RCD_BORDER
 #undef RCD_MARGIN
-#undef RCD_TILEVALID
-#undef w1
-#undef w2
-#undef w3
-#undef w4
+#undef RCD_TILESIZE_MIN
+#undef RCD_TILESIZE_MAX
 #undef eps
 #undef epssq
 
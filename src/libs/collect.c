@@ -1147,6 +1147,16 @@ static void tree_view(dt_lib_collect_rule_t *dr)
                                 " GROUP BY folder, film_rolls_id", where_ext);
         break;
       case DT_COLLECTION_PROP_TAG:
+        if(!strcmp(where_ext, "(1=1)"))
+        {
+          // no other rule restricts the images, the maintained usage counts are the answer
+          query = g_strdup("SELECT T.name, T.id, U.count"
+                           " FROM memory.tag_usage AS U"
+                           " JOIN data.tags AS T"
+                           "   ON T.id = U.tagid"
+                           " WHERE U.count > 0");
+          break;
+        }
         query = g_strdup_printf("SELECT name, tag_id, COUNT(*) AS count"
                                 " FROM main.images AS mi"
                                 " JOIN main.tagged_images"
@@ -23,6 +23,7 @@
 #include "control/conf.h"
 #include "control/control.h"
 #include "control/jobs.h"
+#include "control/jobs/control_jobs.h"
 #include "dtgtk/button.h"
 #include "gui/gtk.h"
 #include "gui/hist_dialog.h"
@@ -72,30 +73,8 @@ static void _update(dt_lib_module_t *self)
 
 static void compress_button_clicked(GtkWidget *widget, gpointer user_data)
 {
-  const GtkWidget *win = dt_ui_main_window(darktable.gui->ui);
-  const GList *imgs = dt_view_get_images_to_act_on(TRUE, TRUE);
-
-  if(!imgs) return;
-
-  const int missing = dt_history_compress_on_list(imgs);
-  dt_collection_update_query(darktable.collection, DT_COLLECTION_CHANGE_RELOAD,
-                             g_list_copy((GList *)imgs));
-  dt_control_queue_redraw_center();
-
-  if (missing)
-  {
-    GtkWidget *dialog = gtk_message_dialog_new(
-    GTK_WINDOW(win), GTK_DIALOG_DESTROY_WITH_PARENT, GTK_MESSAGE_QUESTION, GTK_BUTTONS_CLOSE,
-    ngettext("no history compression of 1 image.\nsee tag: darktable|problem|history-compress.",
-             "no history compression of %d images.\nsee tag: darktable|problem|history-compress.", missing ), missing);
-#ifdef GDK_WINDOWING_QUARTZ
-    dt_osx_disallow_fullscreen(dialog);
-#endif
-
-    gtk_window_set_title(GTK_WINDOW(dialog), _("history compression warning"));
-    gtk_dialog_run(GTK_DIALOG(dialog));
-    gtk_widget_destroy(dialog);
-  }
+  // runs as a job, long lists stay responsive and can be cancelled
+  dt_control_compress_history();
 }
 
 static void discard_button_clicked(GtkWidget *widget, gpointer user_data)
@@ -27,6 +27,7 @@
 #include "common/image_cache.h"
 #include "common/imageio.h"
 #include "common/imageio_module.h"
+#include "common/mipmap_cache.h"
 #include "common/selection.h"
 #include "common/styles.h"
 #include "common/tags.h"
@@ -65,6 +66,9 @@
 #define G_SOURCE_FUNC(f) ((GSourceFunc) (void (*)(void)) (f))
 #endif
 
+// most raws decoded ahead in each direction of the collection
+#define DT_DARKROOM_PREFETCH_MAX 4
+
 DT_MODULE(1)
 
 static void _update_softproof_gamut_checking(dt_develop_t *d);
@@ -625,6 +629,89 @@ static void dt_dev_cleanup_module_accels(dt_iop_module_t *module)
   dt_accel_cleanup_locals_iop(module);
 }
 
+// bumped on every image change, queued prefetches of an older one are skipped
+static gint _prefetch_generation = 0;
+
+typedef struct _prefetch_t
+{
+  int32_t imgid;
+  gint generation;
+} _prefetch_t;
+
+static int32_t _prefetch_job_run(dt_job_t *job)
+{
+  const _prefetch_t *params = dt_control_job_get_params(job);
+  // the user moved on before we got here
+  if(params->generation != g_atomic_int_get(&_prefetch_generation)) return 0;
+
+  // only the raw decode, the full buffer stays in the mipmap cache for the pipe to pick up
+  dt_mipmap_buffer_t buf;
+  dt_mipmap_cache_get(darktable.mipmap_cache, &buf, params->imgid, DT_MIPMAP_FULL, DT_MIPMAP_BLOCKING, 'r');
+  dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+  return 0;
+}
+
+static void _prefetch_add(const int32_t imgid, const gint generation)
+{
+  dt_job_t *job = dt_control_job_create(&_prefetch_job_run, "prefetch image %d", imgid);
+  if(!job) return;
+  _prefetch_t *params = (_prefetch_t *)calloc(1, sizeof(_prefetch_t));
+  if(!params)
+  {
+    dt_control_job_dispose(job);
+    return;
+  }
+  params->imgid = imgid;
+  params->generation = generation;
+  dt_control_job_set_params_with_size(job, params, sizeof(_prefetch_t), free);
+  dt_control_add_job(darktable.control, DT_JOB_QUEUE_SYSTEM_BG, job);
+}
+
+static int _prefetch_neighbours(const int32_t imgid, const int count, const gboolean next, int32_t *ids)
+{
+  sqlite3_stmt *stmt;
+  // clang-format off
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              next ? "SELECT imgid FROM memory.collected_images"
+                                     " WHERE rowid > (SELECT rowid FROM memory.collected_images WHERE imgid = ?1)"
+                                     " ORDER BY rowid LIMIT ?2"
+                                   : "SELECT imgid FROM memory.collected_images"
+                                     " WHERE rowid < (SELECT rowid FROM memory.collected_images WHERE imgid = ?1)"
+                                     " ORDER BY rowid DESC LIMIT ?2",
+                              -1, &stmt, NULL);
+  // clang-format on
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, count);
+  int n = 0;
+  while(n < count && sqlite3_step(stmt) == SQLITE_ROW) ids[n++] = sqlite3_column_int(stmt, 0);
+  sqlite3_finalize(stmt);
+  return n;
+}
+
+// decode the raws around imgid in the background, so stepping through the collection
+// finds them in the full mipmap cache. the cache is shared with the pipes and exports,
+// so never ask for more than it holds besides the current image and one more.
+static void _prefetch_around(const int32_t imgid)
+{
+  const gint generation = g_atomic_int_add(&_prefetch_generation, 1) + 1;
+
+  const int slots = darktable.mipmap_cache->mip_full.cache.cost_quota;
+  const int count = MIN(MIN(dt_conf_get_int("plugins/darkroom/prefetch"), DT_DARKROOM_PREFETCH_MAX),
+                        (slots - 2) / 2);
+  if(count <= 0 || imgid <= 0) return;
+
+  int32_t next[DT_DARKROOM_PREFETCH_MAX], prev[DT_DARKROOM_PREFETCH_MAX];
+  const int nnext = _prefetch_neighbours(imgid, count, TRUE, next);
+  const int nprev = _prefetch_neighbours(imgid, count, FALSE, prev);
+
+  // the queue is fifo, closest first and forward before backward
+  for(int k = 0; k < count; k++)
+  {
+    if(k < nnext) _prefetch_add(next[k], generation);
+    if(k < nprev) _prefetch_add(prev[k], generation);
+  }
+}
+
 static void dt_dev_change_image(dt_develop_t *dev, const int32_t imgid)
 {
   // stop crazy users from sleeping on key-repeat spacebar:
@@ -840,6 +927,8 @@ static void dt_dev_change_image(dt_develop_t *dev, const int32_t imgid)
   dt_pthread_mutex_BAD_unlock(&dev->preview2_pipe_mutex);
   dt_pthread_mutex_BAD_unlock(&dev->preview_pipe_mutex);
   dt_pthread_mutex_BAD_unlock(&dev->pipe_mutex);
+  // start on the images the user is likely to go to next
+  _prefetch_around(imgid);
   // update hint message
   dt_collection_hint_message(darktable.collection);
   // update accels_window
@@ -2051,6 +2140,7 @@ void enter(dt_view_t *self)
   dt_dev_pop_history_items(dev, dev->history_end);
   // ensure that filmstrip shows current image
   dt_thumbtable_set_offset_image(dt_ui_thumbtable(darktable.gui->ui), dev->image_storage.id, TRUE);
+  _prefetch_around(dev->image_storage.id);
   // get last active plugin:
   gchar *active_plugin = dt_conf_get_string("plugins/darkroom/active");
   if(active_plugin)
@@ -2090,6 +2180,9 @@ void enter(dt_view_t *self)
 
 void leave(dt_view_t *self)
 {
+  // drop prefetches still queued for the filmstrip neighbours
+  g_atomic_int_inc(&_prefetch_generation);
+
   if(darktable.lib->proxy.colorpicker.picker_proxy)
     dt_iop_color_picker_reset(darktable.lib->proxy.colorpicker.picker_proxy->module, FALSE);
 